@@ -0,0 +1,182 @@
+/* Benchmark for the NOCACHE upcall to MRT_ADD_MFC install hot path
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+
+#include "ifvc.h"
+#include "log.h"
+#include "mroute.h"
+#include "timer.h"
+#include "util.h"
+
+/*
+ * Loads N (*,G) rules, then fires N synthetic upcall candidates
+ * through mroute4_dyn_add(), i.e. the rule matcher plus the actual
+ * MRT_ADD_MFC kernel install, and reports installs/sec, p50/p99
+ * install latency and peak RSS per route count.  Run with `make
+ * bench`, needs root (or CAP_NET_ADMIN) and no running smcrouted,
+ * ideally in a scratch network namespace.
+ */
+
+/* Daemon globals expected by the linked-in daemon objects */
+int   running = 1;
+char *ident   = "bench-upcall";
+
+void reload(int signo)
+{
+	(void)signo;
+}
+
+static uint64_t *lat;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* One exact (*,G) rule per group, groups counted up from 225.0.0.0 */
+static void make_route(struct mroute4 *route, int i, int dyn)
+{
+	memset(route, 0, sizeof(*route));
+	route->group.s_addr = htonl(0xE1000000u + i);
+	route->inbound      = 0;
+	if (dyn)
+		route->source.s_addr = htonl(0x0A000002u + i);
+	else
+		route->source.s_addr = htonl(INADDR_ANY);
+}
+
+static void bench_pass(int num)
+{
+	struct mroute4 route;
+	struct rusage ru;
+	uint64_t t0, total;
+	int i, fail = 0;
+
+	mroute4_bulk_begin();
+	for (i = 0; i < num; i++) {
+		make_route(&route, i, 0);
+		route.ttl[1] = 1;
+		mroute4_add(&route);
+	}
+	mroute4_bulk_end();
+
+	/* Synthetic upcall storm, one new (S,G) flow per rule */
+	total = now_ns();
+	for (i = 0; i < num; i++) {
+		make_route(&route, i, 1);
+
+		t0 = now_ns();
+		if (mroute4_dyn_add(&route))
+			fail++;
+		lat[i] = now_ns() - t0;
+	}
+	total = now_ns() - total;
+
+	qsort(lat, num, sizeof(lat[0]), cmp64);
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("%7d routes: %9.0f installs/sec, p50 %7.2f us, p99 %7.2f us, %d failed, peak RSS %ld KiB\n",
+	       num, num / (total / 1e9),
+	       lat[num / 2] / 1e3, lat[num - 1 - num / 100] / 1e3,
+	       fail, ru.ru_maxrss);
+
+	/* Remove rules and all (S,G) spawned from them */
+	for (i = 0; i < num; i++) {
+		make_route(&route, i, 0);
+		mroute4_del(&route);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int counts[] = { 1000, 10000, 100000 };
+	int c, max = 100000;
+	size_t i;
+
+	while ((c = getopt(argc, argv, "m:h")) != EOF) {
+		switch (c) {
+		case 'm':
+			max = atoi(optarg);
+			break;
+
+		default:
+			printf("Usage: bench-upcall [-m MAX_ROUTES]\n");
+			return 0;
+		}
+	}
+
+	setlogmask(LOG_UPTO(LOG_WARNING));
+
+	lat = calloc(max, sizeof(*lat));
+	if (!lat) {
+		fprintf(stderr, "Failed allocating latency buffer: %s\n", strerror(errno));
+		return 1;
+	}
+
+	iface_init();
+	timer_init();
+
+	if (mroute4_enable(1, 0, 0)) {
+		fprintf(stderr, "Failed enabling IPv4 multicast routing API.\n"
+			"Needs root (CAP_NET_ADMIN) and no running smcrouted.\n");
+		return 1;
+	}
+
+	for (i = 0; i < NELEMS(counts); i++) {
+		if (counts[i] > max)
+			break;
+
+		bench_pass(counts[i]);
+	}
+
+	mroute4_disable();
+	iface_exit();
+	free(lat);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
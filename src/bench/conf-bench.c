@@ -0,0 +1,313 @@
+/* Benchmark for the .conf parser, compile cache and apply path
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "conf.h"
+#include "ifvc.h"
+#include "log.h"
+#include "mcgroup.h"
+#include "mroute.h"
+#include "script.h"
+#include "util.h"
+
+/*
+ * Generates synthetic configs of 1k-500k lines and times the three
+ * phases of loading one in isolation: compile (fgets/pop_token and
+ * inet_pton, incl. writing the binary cache), cache replay (second
+ * conf_load() of the same file) and apply (add_mroute() and interface
+ * matching).  The kernel interface layer is stubbed out below, so the
+ * numbers are pure conf.c/ifvc.c cost: lines/sec, heap allocations
+ * per phase and peak RSS.  Run with `make bench-conf`, needs no root
+ * and no network setup; routes never reach the kernel.
+ */
+
+static const char *conf_file = "/tmp/conf-bench.conf";
+
+/* Heap allocation counters, interposed over the glibc entry points */
+static unsigned long n_alloc;
+
+extern void *__libc_malloc(size_t len);
+extern void *__libc_calloc(size_t num, size_t len);
+extern void *__libc_realloc(void *ptr, size_t len);
+
+void *malloc(size_t len)
+{
+	n_alloc++;
+	return __libc_malloc(len);
+}
+
+void *calloc(size_t num, size_t len)
+{
+	n_alloc++;
+	return __libc_calloc(num, len);
+}
+
+void *realloc(void *ptr, size_t len)
+{
+	n_alloc++;
+	return __libc_realloc(ptr, len);
+}
+
+/*
+ * Stubbed kernel/mroute layer: conf.c is linked against these instead
+ * of mroute.c and mcgroup.c, so apply cost is matching and record
+ * building only.  VIF/MIF numbers are handed out locally.
+ */
+static unsigned long n_route4, n_route6, n_join;
+static int next_vif;
+
+void mroute4_bulk_begin(void)
+{
+}
+
+int mroute4_bulk_end(void)
+{
+	return (int)n_route4;
+}
+
+int mroute4_table_select(int id)
+{
+	(void)id;
+	return 0;
+}
+
+void mroute4_table_reset(void)
+{
+}
+
+int mroute4_add(struct mroute4 *route)
+{
+	(void)route;
+	n_route4++;
+	return 0;
+}
+
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+int mroute6_add(struct mroute6 *route)
+{
+	(void)route;
+	n_route6++;
+	return 0;
+}
+#endif
+
+int mroute_add_vif(char *ifname, uint8_t mrdisc, uint8_t threshold)
+{
+	struct iface *iface;
+	struct ifmatch state;
+
+	iface_match_init(&state);
+	while ((iface = iface_match_by_name(ifname, &state))) {
+		iface->mrdisc    = mrdisc;
+		iface->threshold = threshold;
+		if (iface->vif < 0)
+			iface->vif = next_vif++;
+		iface->mif = iface->vif;
+	}
+
+	if (!state.match_count)
+		return 1;
+
+	return 0;
+}
+
+int mroute_del_vif(char *ifname)
+{
+	(void)ifname;
+	return 0;
+}
+
+int mcgroup4_join(const char *ifname, struct in_addr source, struct in_addr group)
+{
+	(void)ifname;
+	(void)source;
+	(void)group;
+	n_join++;
+	return 0;
+}
+
+int mcgroup6_join(const char *ifname, struct in6_addr group)
+{
+	(void)ifname;
+	(void)group;
+	n_join++;
+	return 0;
+}
+
+int script_exec(struct mroute *mroute)
+{
+	(void)mroute;
+	return 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Mostly (S,G) routes with a sprinkling of joins, like a real config */
+static void gen_conf(int num, const char *ifin, const char *ifout)
+{
+	FILE *fp;
+	int i, a, b, c;
+
+	fp = fopen(conf_file, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed creating %s: %s\n", conf_file, strerror(errno));
+		exit(1);
+	}
+
+	fprintf(fp, "# conf-bench generated, %d lines\n", num);
+	for (i = 0; i < num; i++) {
+		a = (i >> 14) & 0x3f;
+		b = (i >> 7)  & 0x7f;
+		c = i & 0x7f;
+
+		if (i % 64 == 0)
+			fprintf(fp, "mgroup from %s group 225.%d.%d.%d\n", ifin, a, b, c);
+		else
+			fprintf(fp, "mroute from %s source 10.%d.%d.%d group 225.%d.%d.%d to %s\n",
+				ifin, a, b, c, a, b, c, ifout);
+	}
+
+	fclose(fp);
+}
+
+static void bench_pass(int num, const char *ifin, const char *ifout)
+{
+	char cache_file[256];
+	uint64_t t0, t_compile, t_replay, t_apply;
+	unsigned long a0, a_compile, a_replay, a_apply;
+	struct rusage ru;
+
+	gen_conf(num, ifin, ifout);
+	snprintf(cache_file, sizeof(cache_file), "%s.cache", conf_file);
+	unlink(cache_file);
+	n_route4 = n_route6 = n_join = 0;
+
+	/* Cold boot: tokenize, inet_pton() and write the binary cache */
+	a0 = n_alloc;
+	t0 = now_ns();
+	if (conf_load((char *)conf_file, 1)) {
+		fprintf(stderr, "Failed parsing %s: %s\n", conf_file, strerror(errno));
+		exit(1);
+	}
+	t_compile = now_ns() - t0;
+	a_compile = n_alloc - a0;
+
+	/* Warm boot: replay the binary cache written above */
+	a0 = n_alloc;
+	t0 = now_ns();
+	conf_load((char *)conf_file, 1);
+	t_replay = now_ns() - t0;
+	a_replay = n_alloc - a0;
+
+	/* Apply: add_mroute() and interface matching, stubbed kernel */
+	a0 = n_alloc;
+	t0 = now_ns();
+	conf_apply_some(-1);
+	t_apply = now_ns() - t0;
+	a_apply = n_alloc - a0;
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("%7d lines: compile %8.0f lines/sec %6lu allocs | "
+	       "replay %9.0f lines/sec %4lu allocs | "
+	       "apply %8.0f lines/sec %4lu allocs | "
+	       "%lu routes, %lu joins, peak RSS %ld KiB\n",
+	       num,
+	       num / (t_compile / 1e9), a_compile,
+	       num / (t_replay / 1e9), a_replay,
+	       num / (t_apply / 1e9), a_apply,
+	       n_route4 + n_route6, n_join, ru.ru_maxrss);
+}
+
+int main(int argc, char *argv[])
+{
+	int counts[] = { 1000, 10000, 100000, 500000 };
+	const char *ifin = NULL, *ifout = NULL;
+	char cache_file[256];
+	struct iface *iface;
+	int c, max = 500000;
+	size_t i;
+
+	while ((c = getopt(argc, argv, "m:h")) != EOF) {
+		switch (c) {
+		case 'm':
+			max = atoi(optarg);
+			break;
+
+		default:
+			printf("Usage: conf-bench [-m MAX_LINES]\n");
+			return 0;
+		}
+	}
+
+	setlogmask(LOG_UPTO(LOG_WARNING));
+
+	iface_init();
+	for (iface = iface_iterator(1); iface; iface = iface_iterator(0)) {
+		iface->vif = iface->mif = next_vif++;
+		if (!ifin)
+			ifin = iface->name;
+		else if (!ifout)
+			ifout = iface->name;
+	}
+
+	if (!ifin) {
+		fprintf(stderr, "No network interfaces found.\n");
+		return 1;
+	}
+	if (!ifout)
+		ifout = ifin;
+
+	for (i = 0; i < NELEMS(counts); i++) {
+		if (counts[i] > max)
+			break;
+
+		bench_pass(counts[i], ifin, ifout);
+	}
+
+	snprintf(cache_file, sizeof(cache_file), "%s.cache", conf_file);
+	unlink(cache_file);
+	unlink(conf_file);
+	iface_exit();
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
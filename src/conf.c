@@ -17,15 +17,20 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "log.h"
 #include "conf.h"
 #include "ifvc.h"
+#include "util.h"
 #include "script.h"
+#include "mroute.h"
 #include "mcgroup.h"
 
 #define MAX_LINE_LEN 512
@@ -33,6 +38,66 @@
 	smclog(LOG_WARNING, "%s:%02d: " fmt, conf, lineno, ##args)
 static const char *conf = NULL;
 
+/*
+ * Compiled configuration cache, CONF.cache next to the .conf file.
+ *
+ * Tokenizing and inet_pton() every line of the text file adds up on
+ * slow embedded targets, so the first parse compiles each statement to
+ * a fixed-size record below and dumps the array to disk.  Subsequent
+ * boots mmap the cache and replay the records; only interface names
+ * are left unresolved since VIF numbering depends on the interfaces
+ * present at runtime.  The cache is discarded when the .conf mtime or
+ * size changed, or when the daemon ran with different -N semantics.
+ */
+#define CONF_CACHE_MAGIC   0x534d4343u	/* "SMCC" */
+#define CONF_CACHE_VERSION 1
+
+enum {
+	CONF_OP_PHYINT = 1,
+	CONF_OP_TABLE,
+	CONF_OP_JOIN,
+	CONF_OP_MROUTE,
+};
+
+struct conf_rec {
+	uint8_t  op;
+	uint8_t  family;	/* join/mroute: AF_INET or AF_INET6 */
+	uint8_t  len;		/* mroute: prefix length for (*,G/LEN) */
+	uint8_t  num;		/* mroute: number of outbound names */
+	int32_t  table;		/* table: kernel routing table id */
+
+	uint8_t  enable;	/* phyint */
+	uint8_t  mrdisc;	/* phyint */
+	uint8_t  threshold;	/* phyint */
+	uint8_t  pad;
+	uint16_t line;		/* .conf line number, for diagnostics */
+	uint16_t pad2;
+
+	struct in6_addr source;	/* IPv4 address in the first four bytes */
+	struct in6_addr group;
+
+	char     ifname[IFNAMSIZ + 1];
+	char     out[32][IFNAMSIZ + 1];
+};
+
+struct conf_cache_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t  do_vifs;	/* replay depends on the -N default */
+	uint8_t  pad;
+	uint32_t num;
+	uint32_t pad2;
+	int64_t  mtime;		/* .conf st_mtime at compile time */
+	int64_t  size;		/* .conf st_size  at compile time */
+};
+
+static struct conf_rec *cache_recs;
+static size_t cache_num, cache_len;
+static size_t apply_pos;	/* next record for conf_apply_some() */
+static int cache_ok;		/* clear when the array is incomplete */
+static int cache_used;		/* last compile came from the cache */
+static char cache_path[256];
+
 static char *pop_token(char **line)
 {
 	char *end, *token;
@@ -74,68 +139,170 @@ static int match(char *keyword, char *token)
 	return !strncmp(keyword, token, len);
 }
 
-static int join_mgroup(int lineno, char *ifname, char *source, char *group)
+static void cache_push(struct conf_rec *rec)
+{
+	if (cache_num == cache_len) {
+		size_t len = cache_len ? cache_len * 2 : 64;
+		struct conf_rec *tmp;
+
+		tmp = realloc(cache_recs, len * sizeof(*tmp));
+		if (!tmp) {
+			cache_ok = 0;
+			return;
+		}
+		cache_recs = tmp;
+		cache_len  = len;
+	}
+
+	cache_recs[cache_num++] = *rec;
+}
+
+/*
+ * Compile one mgroup/ssmgroup statement: convert the addresses once,
+ * here, so cached replays skip inet_pton() entirely.
+ */
+static int rec_join(int lineno, struct conf_rec *rec, char *ifname, char *source, char *group)
 {
-	int result;
+	struct in_addr addr;
 
 	if (!ifname || !group) {
 		errno = EINVAL;
 		return 1;
 	}
 
+	strlcpy(rec->ifname, ifname, sizeof(rec->ifname));
+
 	if (strchr(group, ':')) {
-#if !defined(HAVE_IPV6_MULTICAST_HOST) || !defined(HAVE_IPV6_MULTICAST_ROUTING)
-		WARN("Ignored, IPv6 disabled.");
-		result = 0;
-#else
-		struct in6_addr grp;
+		rec->family = AF_INET6;
 
 		if (source)
 			WARN("IPv6 is not (yet) supported for Source Specific Multicast.");
 
-		if (inet_pton(AF_INET6, group, &grp) <= 0 || !IN6_IS_ADDR_MULTICAST(&grp)) {
+		if (inet_pton(AF_INET6, group, &rec->group) <= 0 ||
+		    !IN6_IS_ADDR_MULTICAST(&rec->group)) {
 			WARN("Invalid IPv6 multicast group: %s", group);
 			return 1;
 		}
 
-		result = mcgroup6_join(ifname, grp);
-#endif
-	} else {
-		struct in_addr src;
-		struct in_addr grp;
+		return 0;
+	}
 
-		memset(&src, 0, sizeof(src));
+	rec->family = AF_INET;
 
-		if (source && (inet_pton(AF_INET, source, &src) <= 0)) {
+	if (source) {
+		if (inet_pton(AF_INET, source, &addr) <= 0) {
 			WARN("Invalid IPv4 multicast source: %s", source);
 			return 1;
 		}
+		memcpy(&rec->source, &addr, sizeof(addr));
+	}
 
-		if ((inet_pton(AF_INET, group, &grp) <= 0) || !IN_MULTICAST(ntohl(grp.s_addr))) {
-			WARN("Invalid IPv4 multicast group: %s", group);
-			return 1;
-		}
-
-		result = mcgroup4_join(ifname, src, grp);
+	if (inet_pton(AF_INET, group, &addr) <= 0 || !IN_MULTICAST(ntohl(addr.s_addr))) {
+		WARN("Invalid IPv4 multicast group: %s", group);
+		return 1;
 	}
+	memcpy(&rec->group, &addr, sizeof(addr));
 
-	return result;
+	return 0;
 }
 
-static int add_mroute(int lineno, char *ifname, char *group, char *source, char *outbound[], int num)
+/* Compile one mroute statement, interface names stay unresolved */
+static int rec_mroute(int lineno, struct conf_rec *rec, char *ifname, char *group, char *source, char *outbound[], int num)
 {
-	int i, total, ret, vif, result = 0;
+	struct in_addr addr;
 	char *ptr;
-	struct mroute4 mroute;
-	struct iface *iface;
-	struct ifmatch state_in, state_out;
+	int i, len;
 
-	if (!ifname || !group || !outbound || !num) {
+	if (!ifname || !group || !num) {
 		errno = EINVAL;
 		return 1;
 	}
 
+	strlcpy(rec->ifname, ifname, sizeof(rec->ifname));
+	for (i = 0; i < num && i < (int)NELEMS(rec->out); i++)
+		strlcpy(rec->out[i], outbound[i], sizeof(rec->out[0]));
+	rec->num = i;
+
 	if (strchr(group, ':')) {
+		rec->family = AF_INET6;
+
+		if (source && inet_pton(AF_INET6, source, &rec->source) <= 0) {
+			WARN("Invalid source IPv6 address: %s", source);
+			return 1;
+		}
+
+		if (inet_pton(AF_INET6, group, &rec->group) <= 0 ||
+		    !IN6_IS_ADDR_MULTICAST(&rec->group)) {
+			WARN("Invalid IPv6 multicast group: %s", group);
+			return 1;
+		}
+
+		return 0;
+	}
+
+	rec->family = AF_INET;
+
+	if (source) {
+		if (inet_pton(AF_INET, source, &addr) <= 0) {
+			WARN("Invalid source IPv4 address: %s", source);
+			return 1;
+		}
+		memcpy(&rec->source, &addr, sizeof(addr));
+	}
+
+	ptr = strchr(group, '/');
+	if (ptr) {
+		if (source) {
+			WARN("GROUP/LEN not yet supported for source specific multicast.");
+			return 1;
+		}
+
+		*ptr++ = 0;
+		len = atoi(ptr);
+		if (len < 0 || len > 32) {
+			WARN("Invalid prefix length, %s/%d", group, len);
+			return 1;
+		}
+		rec->len = len;
+	}
+
+	if (inet_pton(AF_INET, group, &addr) <= 0 || !IN_MULTICAST(ntohl(addr.s_addr))) {
+		WARN("Invalid IPv4 multicast group: %s", group);
+		return 1;
+	}
+	memcpy(&rec->group, &addr, sizeof(addr));
+
+	return 0;
+}
+
+static int join_mgroup(int lineno, struct conf_rec *rec)
+{
+	struct in_addr src, grp;
+
+	(void)lineno;		/* only the IPv6-disabled warning uses it */
+	if (rec->family == AF_INET6) {
+#if !defined(HAVE_IPV6_MULTICAST_HOST) || !defined(HAVE_IPV6_MULTICAST_ROUTING)
+		WARN("Ignored, IPv6 disabled.");
+		return 0;
+#else
+		return mcgroup6_join(rec->ifname, rec->group);
+#endif
+	}
+
+	memcpy(&src, &rec->source, sizeof(src));
+	memcpy(&grp, &rec->group, sizeof(grp));
+
+	return mcgroup4_join(rec->ifname, src, grp);
+}
+
+static int add_mroute(int lineno, struct conf_rec *rec)
+{
+	int i, total, vif, result = 0;
+	struct mroute4 mroute;
+	struct iface *iface;
+	struct ifmatch state_in, state_out;
+
+	if (rec->family == AF_INET6) {
 #if !defined(HAVE_IPV6_MULTICAST_HOST) || !defined(HAVE_IPV6_MULTICAST_ROUTING)
 		WARN("Ignored, IPv6 disabled.");
 		return 0;
@@ -144,31 +311,23 @@ static int add_mroute(int lineno, char *ifname, char *group, char *source, char
 		int mif;
 
 		iface_match_init(&state_in);
-		while ((mif = iface_match_mif_by_name(ifname, &state_in, NULL)) >= 0) {
+		while ((mif = iface_match_mif_by_name(rec->ifname, &state_in, NULL)) >= 0) {
 			memset(&mroute, 0, sizeof(mroute));
 			mroute.inbound = mif;
-
-			if (!source || inet_pton(AF_INET6, source, &mroute.source.sin6_addr) <= 0) {
-				WARN("Invalid source IPv6 address: %s", source ?: "NONE");
-				return 1;
-			}
-
-			if (inet_pton(AF_INET6, group, &mroute.group.sin6_addr) <= 0 || !IN6_IS_ADDR_MULTICAST(&mroute.group.sin6_addr)) {
-				WARN("Invalid IPv6 multicast group: %s", group);
-				return 1;
-			}
+			mroute.source.sin6_addr = rec->source;
+			mroute.group.sin6_addr  = rec->group;
 
 			total = 0;
-			for (i = 0; i < num; i++) {
+			for (i = 0; i < rec->num; i++) {
 				iface_match_init(&state_out);
-				while ((mif = iface_match_mif_by_name(outbound[i], &state_out, &iface)) >= 0) {
+				while ((mif = iface_match_mif_by_name(rec->out[i], &state_out, &iface)) >= 0) {
 					if (mif == mroute.inbound) {
 						state_out.match_count--;
 						/* In case of wildcard matches, in==out is
 						 * quite normal, so don't complain
 						 */
-						if (!ifname_is_wildcard(ifname) && !ifname_is_wildcard(outbound[i]))
-							WARN("Same outbound IPv6 interface (%s) as inbound (%s)?", outbound[i], ifname);
+						if (!ifname_is_wildcard(rec->ifname) && !ifname_is_wildcard(rec->out[i]))
+							WARN("Same outbound IPv6 interface (%s) as inbound (%s)?", rec->out[i], rec->ifname);
 						continue;
 					}
 
@@ -177,7 +336,7 @@ static int add_mroute(int lineno, char *ifname, char *group, char *source, char
 					total++;
 				}
 				if (!state_out.match_count)
-					WARN("Invalid outbound IPv6 interface: %s", outbound[i]);
+					WARN("Invalid outbound IPv6 interface: %s", rec->out[i]);
 			}
 
 			if (!total) {
@@ -189,7 +348,7 @@ static int add_mroute(int lineno, char *ifname, char *group, char *source, char
 		}
 
 		if (!state_in.match_count) {
-			WARN("Invalid inbound IPv6 interface: %s", ifname);
+			WARN("Invalid inbound IPv6 interface: %s", rec->ifname);
 			return 1;
 		}
 		return result;
@@ -197,49 +356,24 @@ static int add_mroute(int lineno, char *ifname, char *group, char *source, char
 	}
 
 	iface_match_init(&state_in);
-	while ((vif = iface_match_vif_by_name(ifname, &state_in, NULL)) >= 0) {
+	while ((vif = iface_match_vif_by_name(rec->ifname, &state_in, NULL)) >= 0) {
 		memset(&mroute, 0, sizeof(mroute));
 		mroute.inbound = vif;
-
-		if (!source) {
-			mroute.source.s_addr = htonl(INADDR_ANY);
-		} else if (inet_pton(AF_INET, source, &mroute.source) <= 0) {
-			WARN("Invalid source IPv4 address: %s", source);
-			return 1;
-		}
-
-		ptr = strchr(group, '/');
-		if (ptr) {
-			if (mroute.source.s_addr != htonl(INADDR_ANY)) {
-				WARN("GROUP/LEN not yet supported for source specific multicast.");
-				return 1;
-			}
-
-			*ptr++ = 0;
-			mroute.len = atoi(ptr);
-			if (mroute.len < 0 || mroute.len > 32) {
-				WARN("Invalid prefix length, %s/%d", group, mroute.len);
-				return 1;
-			}
-		}
-
-		ret = inet_pton(AF_INET, group, &mroute.group);
-		if (ret <= 0 || !IN_MULTICAST(ntohl(mroute.group.s_addr))) {
-			WARN("Invalid IPv4 multicast group: %s", group);
-			return 1;
-		}
+		mroute.len     = rec->len;
+		memcpy(&mroute.source, &rec->source, sizeof(mroute.source));
+		memcpy(&mroute.group, &rec->group, sizeof(mroute.group));
 
 		total = 0;
-		for (i = 0; i < num; i++) {
+		for (i = 0; i < rec->num; i++) {
 			iface_match_init(&state_out);
-			while ((vif = iface_match_vif_by_name(outbound[i], &state_out, &iface)) >= 0) {
+			while ((vif = iface_match_vif_by_name(rec->out[i], &state_out, &iface)) >= 0) {
 				if (vif == mroute.inbound) {
 					state_out.match_count--;
-					if (!ifname_is_wildcard(ifname) && !ifname_is_wildcard(outbound[i]))
+					if (!ifname_is_wildcard(rec->ifname) && !ifname_is_wildcard(rec->out[i]))
 						/* In case of wildcard matches, in==out is
 						 * quite normal, so don't complain
 						 */
-						WARN("Same outbound IPv4 interface (%s) as inbound (%s)?", outbound[i], ifname);
+						WARN("Same outbound IPv4 interface (%s) as inbound (%s)?", rec->out[i], rec->ifname);
 					continue;
 				}
 
@@ -248,7 +382,7 @@ static int add_mroute(int lineno, char *ifname, char *group, char *source, char
 				total++;
 			}
 			if (!state_out.match_count)
-				WARN("Invalid outbound IPv4 interface: %s", outbound[i]);
+				WARN("Invalid outbound IPv4 interface: %s", rec->out[i]);
 		}
 
 		if (!total) {
@@ -260,12 +394,36 @@ static int add_mroute(int lineno, char *ifname, char *group, char *source, char
 	}
 
 	if (!state_in.match_count) {
-		WARN("Invalid inbound IPv4 interface: %s", ifname);
+		WARN("Invalid inbound IPv4 interface: %s", rec->ifname);
 		return 1;
 	}
 	return result;
 }
 
+/* Execute one compiled record, shared by the parser and cache replay */
+static int conf_apply(int lineno, struct conf_rec *rec)
+{
+	switch (rec->op) {
+	case CONF_OP_JOIN:
+		return join_mgroup(lineno, rec);
+
+	case CONF_OP_MROUTE:
+		return add_mroute(lineno, rec);
+
+	case CONF_OP_PHYINT:
+		if (rec->enable)
+			return mroute_add_vif(rec->ifname, rec->mrdisc, rec->threshold);
+		return mroute_del_vif(rec->ifname);
+
+	case CONF_OP_TABLE:
+		if (mroute4_table_select(rec->table))
+			WARN("Failed switching to routing table %d: %s", rec->table, strerror(errno));
+		return 0;
+	}
+
+	return 0;
+}
+
 /*
  * This function parses the given configuration file according to the
  * below format rules.  Joins multicast groups and creates multicast
@@ -273,9 +431,14 @@ static int add_mroute(int lineno, char *ifname, char *group, char *source, char
  *
  * Format:
  *    phyint IFNAME <enable|disable> [threshold <1-255>]
+ *    table  ID
  *    mgroup   from IFNAME                group MCGROUP
  *    ssmgroup from IFNAME source ADDRESS group MCGROUP
  *    mroute   from IFNAME source ADDRESS group MCGROUP to IFNAME [IFNAME ...]
+ *
+ * The table command switches kernel routing table for all mroute lines
+ * that follow, until the next table command.  Lines before the first
+ * table command go in the default table, see also the -t option.
  */
 static int conf_parse(const char *file, int do_vifs)
 {
@@ -298,14 +461,19 @@ static int conf_parse(const char *file, int do_vifs)
 	}
 
 	conf = file;
+	cache_num = 0;
+	cache_ok  = 1;
+
 	while ((line = fgets(linebuf, MAX_LINE_LEN, fp))) {
 		int   op = 0, num = 0, enable = do_vifs;
 		int   mrdisc = 0, threshold = DEFAULT_THRESHOLD;
+		int   table = 0;
 		char *token;
 		char *ifname = NULL;
 		char *source = NULL;
 		char *group  = NULL;
 		char *dest[32];
+		struct conf_rec rec;
 
 		while ((token = pop_token(&line))) {
 			/* Strip comments. */
@@ -324,6 +492,15 @@ static int conf_parse(const char *file, int do_vifs)
 						op = 0;
 				} else if (match("ssmgroup", token)) {
 					op = 1; /* Compat */
+				} else if (match("table", token)) {
+					token = pop_token(&line);
+					if (!token)
+						WARN("Missing routing table id, skipping.");
+					else {
+						op = 4;
+						table = atoi(token);
+					}
+					break;
 				} else {
 					WARN("Unknown command %s, skipping.", token);
 					continue;
@@ -356,15 +533,27 @@ static int conf_parse(const char *file, int do_vifs)
 			}
 		}
 
+		memset(&rec, 0, sizeof(rec));
+		rec.line = lineno;
 		if (op == 1) {
-			join_mgroup(lineno, ifname, source, group);
+			rec.op = CONF_OP_JOIN;
+			if (!rec_join(lineno, &rec, ifname, source, group))
+				cache_push(&rec);
 		} else if (op == 2) {
-			add_mroute(lineno, ifname, group, source, dest, num);
+			rec.op = CONF_OP_MROUTE;
+			if (!rec_mroute(lineno, &rec, ifname, group, source, dest, num))
+				cache_push(&rec);
 		} else if (op == 3) {
-			if (enable)
-				mroute_add_vif(ifname, mrdisc, threshold);
-			else
-				mroute_del_vif(ifname);
+			rec.op        = CONF_OP_PHYINT;
+			rec.enable    = enable;
+			rec.mrdisc    = mrdisc;
+			rec.threshold = threshold;
+			strlcpy(rec.ifname, ifname, sizeof(rec.ifname));
+			cache_push(&rec);
+		} else if (op == 4) {
+			rec.op    = CONF_OP_TABLE;
+			rec.table = table;
+			cache_push(&rec);
 		}
 
 		lineno++;
@@ -376,23 +565,198 @@ static int conf_parse(const char *file, int do_vifs)
 	return 0;
 }
 
-/* Parse .conf file and setup routes */
-void conf_read(char *file, int do_vifs)
+/* Dump the compiled records next to the .conf, atomically via rename() */
+static void conf_cache_write(const char *file, struct stat *st, int do_vifs)
+{
+	struct conf_cache_hdr hdr;
+	char tmp[sizeof(cache_path) + 4];
+	FILE *fp;
+
+	if (!cache_ok)
+		return;
+
+	snprintf(cache_path, sizeof(cache_path), "%s.cache", file);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", cache_path);
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		smclog(LOG_DEBUG, "Cannot write config cache %s: %s", tmp, strerror(errno));
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic   = CONF_CACHE_MAGIC;
+	hdr.version = CONF_CACHE_VERSION;
+	hdr.do_vifs = do_vifs ? 1 : 0;
+	hdr.num     = cache_num;
+	hdr.mtime   = st->st_mtime;
+	hdr.size    = st->st_size;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    (cache_num && fwrite(cache_recs, sizeof(*cache_recs), cache_num, fp) != cache_num)) {
+		smclog(LOG_DEBUG, "Failed writing config cache %s: %s", tmp, strerror(errno));
+		fclose(fp);
+		unlink(tmp);
+		return;
+	}
+
+	fclose(fp);
+	if (rename(tmp, cache_path))
+		unlink(tmp);
+}
+
+/*
+ * Replay a compiled config if it is still current: same .conf mtime
+ * and size, same format version and same -N default.
+ *
+ * Returns:
+ * POSIX OK(0) when the cache was used, non-zero to run the text parser.
+ */
+static int conf_cache_load(const char *file, struct stat *st, int do_vifs)
 {
-	if (access(file, R_OK)) {
+	struct conf_cache_hdr *hdr;
+	struct conf_rec *rec;
+	struct stat cst;
+	int fd;
+
+	snprintf(cache_path, sizeof(cache_path), "%s.cache", file);
+	fd = open(cache_path, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	if (fstat(fd, &cst) || (size_t)cst.st_size < sizeof(*hdr)) {
+		close(fd);
+		return 1;
+	}
+
+	hdr = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return 1;
+
+	if (hdr->magic != CONF_CACHE_MAGIC || hdr->version != CONF_CACHE_VERSION ||
+	    hdr->do_vifs != (do_vifs ? 1 : 0) ||
+	    hdr->mtime != (int64_t)st->st_mtime || hdr->size != (int64_t)st->st_size ||
+	    sizeof(*hdr) + hdr->num * sizeof(*rec) != (size_t)cst.st_size) {
+		munmap(hdr, cst.st_size);
+		return 1;
+	}
+
+	if (hdr->num > cache_len) {
+		rec = realloc(cache_recs, hdr->num * sizeof(*rec));
+		if (!rec) {
+			munmap(hdr, cst.st_size);
+			return 1;
+		}
+		cache_recs = rec;
+		cache_len  = hdr->num;
+	}
+
+	memcpy(cache_recs, hdr + 1, hdr->num * sizeof(*rec));
+	cache_num = hdr->num;
+	cache_ok  = 1;
+
+	smclog(LOG_DEBUG, "Loaded compiled configuration %s", cache_path);
+	munmap(hdr, cst.st_size);
+
+	return 0;
+}
+
+/*
+ * Compile @file into the record array, from the cache when it is still
+ * current, otherwise through the text parser, refreshing the cache.
+ */
+static int conf_compile(const char *file, struct stat *st, int do_vifs)
+{
+	apply_pos  = 0;
+	cache_used = 1;
+	if (!conf_cache_load(file, st, do_vifs)) {
+		conf = file;	/* record line numbers refer to the .conf */
+		return 0;
+	}
+
+	cache_used = 0;
+	if (conf_parse(file, do_vifs))
+		return 1;
+
+	conf_cache_write(file, st, do_vifs);
+
+	return 0;
+}
+
+/**
+ * conf_apply_some - Execute a bounded slice of the compiled records
+ * @budget: Max number of records to apply, negative for all of them
+ *
+ * Lets the reload path spread config application over several event
+ * loop iterations, so upcall and IPC processing keep running while a
+ * large config loads.
+ *
+ * Returns:
+ * Number of records still left to apply.
+ */
+int conf_apply_some(int budget)
+{
+	while (apply_pos < cache_num && budget != 0) {
+		struct conf_rec *rec = &cache_recs[apply_pos++];
+
+		conf_apply(rec->line, rec);
+		if (budget > 0)
+			budget--;
+	}
+
+	return (int)(cache_num - apply_pos);
+}
+
+/**
+ * conf_load - Compile the .conf file without applying it
+ * @file:    Path to .conf file
+ * @do_vifs: Create VIFs for all interfaces by default
+ *
+ * Returns:
+ * POSIX OK(0) when records are ready for conf_apply_some(), non-zero
+ * when the file is missing or cannot be parsed.
+ */
+int conf_load(char *file, int do_vifs)
+{
+	struct stat st;
+
+	if (stat(file, &st)) {
 		if (errno == ENOENT)
 			smclog(LOG_NOTICE, "Configuration file %s does not exist", file);
 		else
 			smclog(LOG_WARNING, "Unexpected error when accessing %s: %s", file, strerror(errno));
 
 		smclog(LOG_NOTICE, "Continuing anyway, waiting for client to connect.");
-		return;
+		return 1;
 	}
 
-	if (conf_parse(file, do_vifs))
+	if (conf_compile(file, &st, do_vifs)) {
 		smclog(LOG_WARNING, "Failed parsing %s: %s", file, strerror(errno));
-	else
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Parse .conf file and setup routes */
+void conf_read(char *file, int do_vifs)
+{
+	int num;
+
+	mroute4_bulk_begin();
+	if (!conf_load(file, do_vifs)) {
+		conf_apply_some(-1);
 		script_exec(NULL);
+	}
+
+	/* Route ops from IPC clients always target the default table */
+	mroute4_table_reset();
+
+	num = mroute4_bulk_end();
+	if (num)
+		smclog(LOG_INFO, "Loaded %d multicast routes from %s%s",
+		       num, file, cache_used ? " (cached)" : "");
 }
 
 /**
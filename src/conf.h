@@ -5,8 +5,12 @@
 
 #ifdef ENABLE_DOTCONF
 void    conf_read(char *file, int do_vifs);
+int     conf_load(char *file, int do_vifs);
+int     conf_apply_some(int budget);
 #else
 #define conf_read(file, do_vifs)
+#define conf_load(file, do_vifs) (1)
+#define conf_apply_some(budget)  (0)
 #endif
 
 #endif /* SMCROUTE_CONF_H_ */
@@ -38,6 +38,71 @@
 static unsigned int num_ifaces = 0, num_ifaces_alloc = 0;
 static struct iface *iface_list = NULL;
 
+/*
+ * Name-keyed hash index over iface_list, so name lookups during config
+ * load and IPC commands are O(1) instead of a strcmp() scan.  Chains
+ * are index based since realloc() may move the array.
+ */
+#define IFACE_HASH_SIZE 256
+
+static int hash_head[IFACE_HASH_SIZE];
+static int *hash_next = NULL;
+
+/*
+ * vif -> iface cache, self validating: a hit is only trusted if the
+ * entry still has that vif, since mroute.c owns iface->vif and may
+ * reassign it at any time.  MAXVIFS is 32 on all supported systems.
+ */
+static int vif_map[256];
+
+static unsigned int hash_ifname(const char *ifname)
+{
+	unsigned int hash = 5381;
+
+	while (*ifname)
+		hash = hash * 33 + (unsigned char)*ifname++;
+
+	return hash % IFACE_HASH_SIZE;
+}
+
+static void hash_insert(int i)
+{
+	unsigned int hash = hash_ifname(iface_list[i].name);
+
+	hash_next[i] = hash_head[hash];
+	hash_head[hash] = i;
+}
+
+/* Grow vector as needed and initialize a new interface entry */
+static struct iface *iface_alloc(const char *ifname)
+{
+	struct iface *iface;
+
+	if (num_ifaces == num_ifaces_alloc) {
+		num_ifaces_alloc *= 2;
+		iface_list = realloc(iface_list, num_ifaces_alloc * sizeof(struct iface));
+		hash_next  = realloc(hash_next, num_ifaces_alloc * sizeof(int));
+		if (!iface_list || !hash_next) {
+			smclog(LOG_ERR, "Failed allocating space for interfaces: %s", strerror(errno));
+			exit(255);
+		}
+		/* Initialize 2nd half of interface list */
+		memset(&iface_list[num_ifaces], 0, num_ifaces * sizeof(struct iface));
+	}
+
+	iface = &iface_list[num_ifaces++];
+	memset(iface, 0, sizeof(*iface));
+	strlcpy(iface->name, ifname, sizeof(iface->name));
+	iface->ifindex = if_nametoindex(iface->name);
+	iface->vif = -1;
+	iface->mif = -1;
+	iface->mrdisc = 0;
+	iface->threshold = DEFAULT_THRESHOLD;
+	hash_insert(num_ifaces - 1);
+
+	return iface;
+}
+
 /**
  * iface_init - Setup vector of active interfaces
  *
@@ -48,15 +113,22 @@ void iface_init(void)
 {
 	struct iface *iface;
 	struct ifaddrs *ifaddr, *ifa;
+	size_t i;
 
 	num_ifaces = 0;
 
 	if (iface_list)
 		free(iface_list);
 
+	for (i = 0; i < NELEMS(hash_head); i++)
+		hash_head[i] = -1;
+	for (i = 0; i < NELEMS(vif_map); i++)
+		vif_map[i] = -1;
+
 	num_ifaces_alloc = 1;
 	iface_list = calloc(num_ifaces_alloc, sizeof(struct iface));
-	if (!iface_list) {
+	hash_next  = realloc(hash_next, num_ifaces_alloc * sizeof(int));
+	if (!iface_list || !hash_next) {
 		smclog(LOG_ERR, "Failed allocating space for interfaces: %s", strerror(errno));
 		exit(255);
 	}
@@ -74,21 +146,8 @@ void iface_init(void)
 			continue;
 		}
 
-		/* Allocate more space? */
-		if (num_ifaces == num_ifaces_alloc) {
-			num_ifaces_alloc *= 2;
-			iface_list = realloc(iface_list, num_ifaces_alloc * sizeof(struct iface));
-			if (!iface_list) {
-				smclog(LOG_ERR, "Failed allocating space for interfaces: %s", strerror(errno));
-				exit(255);
-			}
-			/* Initialize 2nd half of interface list */
-			memset(&iface_list[num_ifaces], 0, num_ifaces * sizeof(struct iface));
-		}
-
 		/* Copy data from interface iterator 'ifa' */
-		iface = &iface_list[num_ifaces++];
-		strlcpy(iface->name, ifa->ifa_name, sizeof(iface->name));
+		iface = iface_alloc(ifa->ifa_name);
 
 		/*
 		 * Only copy interface address if inteface has one.  On
@@ -100,15 +159,48 @@ void iface_init(void)
 		if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET)
 			iface->inaddr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
 		iface->flags = ifa->ifa_flags;
-		iface->ifindex = if_nametoindex(iface->name);
-		iface->vif = -1;
-		iface->mif = -1;
-		iface->mrdisc = 0;
-		iface->threshold = DEFAULT_THRESHOLD;
 	}
 	freeifaddrs(ifaddr);
 }
 
+/**
+ * iface_add - Add an interface discovered at runtime
+ * @ifname: Interface name
+ *
+ * Used by the netlink link tracker when an interface shows up after
+ * startup, e.g. PPP or VLAN interfaces provisioned at runtime.  Safe
+ * to call for known interfaces, the existing entry is then refreshed.
+ *
+ * Returns:
+ * Pointer to a @struct iface for the interface.
+ */
+struct iface *iface_add(const char *ifname)
+{
+	struct ifaddrs *ifaddr, *ifa;
+	struct iface *iface;
+
+	iface = iface_find_by_name(ifname);
+	if (!iface)
+		iface = iface_alloc(ifname);
+
+	iface->ifindex = if_nametoindex(iface->name);
+
+	/* Pick up interface address, if it has one already */
+	if (getifaddrs(&ifaddr) != -1) {
+		for (ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+			if (strcmp(ifa->ifa_name, iface->name))
+				continue;
+
+			if (ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_INET)
+				iface->inaddr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+			iface->flags = ifa->ifa_flags;
+		}
+		freeifaddrs(ifaddr);
+	}
+
+	return iface;
+}
+
 /**
  * iface_exit - Tear down interface list and clean up
  */
@@ -118,6 +210,10 @@ void iface_exit(void)
 		free(iface_list);
 		iface_list = NULL;
 	}
+	if (hash_next) {
+		free(hash_next);
+		hash_next = NULL;
+	}
 }
 
 /**
@@ -131,14 +227,14 @@ void iface_exit(void)
  */
 struct iface *iface_find_by_name(const char *ifname)
 {
-	unsigned int i;
 	struct iface *iface;
 	struct iface *candidate = NULL;
+	int i;
 
-	if (!ifname)
+	if (!ifname || !num_ifaces)
 		return NULL;
 
-	for (i = 0; i < num_ifaces; i++) {
+	for (i = hash_head[hash_ifname(ifname)]; i >= 0; i = hash_next[i]) {
 		iface = &iface_list[i];
 		if (!strcmp(ifname, iface->name)) {
 			if (iface->vif >= 0)
@@ -180,6 +276,18 @@ struct iface *iface_match_by_name(const char *ifname, struct ifmatch *state)
 	if (ifname_is_wildcard(ifname))
 		match_len = strlen(ifname) - 1;
 
+	/* Exact names are unique, so the first call can use the hash
+	 * index and terminate the iteration right away. */
+	if (match_len == UINT_MAX && !state->iter) {
+		state->iter = num_ifaces;
+
+		iface = iface_find_by_name(ifname);
+		if (iface)
+			state->match_count++;
+
+		return iface;
+	}
+
 	for (; state->iter < num_ifaces; state->iter++) {
 		iface = &iface_list[state->iter];
 		if (!strncmp(ifname, iface->name, match_len)) {
@@ -213,10 +321,48 @@ struct iface *iface_find_by_vif(int vif)
 {
 	size_t i;
 
+	if (vif < 0)
+		return NULL;
+
+	if (vif < (int)NELEMS(vif_map)) {
+		int cached = vif_map[vif];
+
+		if (cached >= 0 && cached < (int)num_ifaces && iface_list[cached].vif == vif)
+			return &iface_list[cached];
+	}
+
+	for (i = 0; i < num_ifaces; i++) {
+		struct iface *iface = &iface_list[i];
+
+		if (iface->vif >= 0 && iface->vif == vif) {
+			if (vif < (int)NELEMS(vif_map))
+				vif_map[vif] = i;
+			return iface;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * iface_find_by_mif - Find by IPv6 virtual interface index
+ * @mif: Virtual multicast interface index
+ *
+ * Returns:
+ * Pointer to a @struct iface of the requested interface, or %NULL if no
+ * interface matching @mif exists.
+ */
+struct iface *iface_find_by_mif(int mif)
+{
+	size_t i;
+
+	if (mif < 0)
+		return NULL;
+
 	for (i = 0; i < num_ifaces; i++) {
 		struct iface *iface = &iface_list[i];
 
-		if (iface->vif >= 0 && iface->vif == vif)
+		if (iface->mif >= 0 && iface->mif == mif)
 			return iface;
 	}
 
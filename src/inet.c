@@ -36,6 +36,53 @@
 
 #define MC_ALL_SNOOPERS      "224.0.0.106"
 
+/*
+ * Frozen packet templates, one per message type.  The IGMP payload has
+ * no per-interface fields and the kernel fills in the IP header, so a
+ * single template serves every interface: type, code and checksum are
+ * baked at inet_init() time and inet_send() is down to one sendto().
+ * Previously each send rebuilt the message, re-parsed the destination
+ * address string, and left the checksum zero.
+ */
+static struct sockaddr_in all_snoopers;
+static struct igmp announce_pkt;
+static struct igmp term_pkt;
+
+static uint16_t in_cksum(void *buf, size_t len)
+{
+	uint16_t *w = (uint16_t *)buf;
+	uint32_t sum = 0;
+
+	while (len > 1) {
+		sum += *w++;
+		len -= 2;
+	}
+	if (len)
+		sum += *(uint8_t *)w;
+
+	sum  = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+
+	return (uint16_t)~sum;
+}
+
+static void freeze(struct igmp *igmp, uint8_t type, uint8_t code)
+{
+	memset(igmp, 0, sizeof(*igmp));
+	igmp->igmp_type  = type;
+	igmp->igmp_code  = code;
+	igmp->igmp_cksum = in_cksum(igmp, sizeof(*igmp));
+}
+
+void inet_init(uint8_t interval)
+{
+	memset(&all_snoopers, 0, sizeof(all_snoopers));
+	all_snoopers.sin_family      = AF_INET;
+	all_snoopers.sin_addr.s_addr = inet_addr(MC_ALL_SNOOPERS);
+
+	freeze(&announce_pkt, IGMP_MRDISC_ANNOUNCE, interval);
+	freeze(&term_pkt, IGMP_MRDISC_TERM, 0);
+}
 
 int inet_open(char *ifname)
 {
@@ -105,27 +152,29 @@ int inet_close(int sd)
 		socket_close(sd);
 }
 
-static void compose_addr(struct sockaddr_in *sin, char *group)
-{
-	memset(sin, 0, sizeof(*sin));
-	sin->sin_family      = AF_INET;
-	sin->sin_addr.s_addr = inet_addr(group);
-}
-
 int inet_send(int sd, uint8_t type, uint8_t interval)
 {
+	struct igmp *igmp;
 	ssize_t num;
-	struct igmp igmp;
-	struct sockaddr dest;
 
-	memset(&igmp, 0, sizeof(igmp));
-	igmp.igmp_type = type;
-	igmp.igmp_code = interval;
-	igmp.igmp_cksum = 0;
+	switch (type) {
+	case IGMP_MRDISC_ANNOUNCE:
+		igmp = &announce_pkt;
+		break;
+	case IGMP_MRDISC_TERM:
+		igmp = &term_pkt;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
 
-	compose_addr((struct sockaddr_in *)&dest, MC_ALL_SNOOPERS);
+	/* The code is the only mutable field, repatch and refreeze */
+	if (igmp->igmp_code != interval)
+		freeze(igmp, type, interval);
 
-	num = sendto(sd, &igmp, sizeof(igmp), 0, &dest, sizeof(dest));
+	num = sendto(sd, igmp, sizeof(*igmp), 0,
+		     (struct sockaddr *)&all_snoopers, sizeof(all_snoopers));
 	if (num < 0)
 		return -1;
 
@@ -135,19 +184,20 @@ int inet_send(int sd, uint8_t type, uint8_t interval)
 /* If called with interval=0, only read() */
 int inet_recv(int sd, uint8_t interval)
 {
-	char buf[1530];
+	/* Receive buffer shared by all mrdisc sockets, single threaded */
+	static char buf[1530];
 	ssize_t num;
 	struct ip *ip;
 	struct igmp *igmp;
 
-	memset(buf, 0, sizeof(buf));
 	num = read(sd, buf, sizeof(buf));
 	if (num < 0)
 		return -1;
 
 	ip = (struct ip *)buf;
 	igmp = (struct igmp *)(buf + (ip->ip_hl << 2));
-	if (igmp->igmp_type == IGMP_MRDISC_SOLICIT && interval > 0) {
+	if (num >= (ssize_t)((ip->ip_hl << 2) + sizeof(*igmp)) &&
+	    igmp->igmp_type == IGMP_MRDISC_SOLICIT && interval > 0) {
 		smclog(LOG_DEBUG, "Received mrdisc solicitation");
 		return inet_send(sd, IGMP_MRDISC_ANNOUNCE, interval);
 	}
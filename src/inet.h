@@ -26,6 +26,8 @@
 #define IGMP_MRDISC_SOLICIT  0x31
 #define IGMP_MRDISC_TERM     0x32
 
+void inet_init (uint8_t interval);
+
 int inet_open  (char *ifname);
 int inet_close (int sd);
 
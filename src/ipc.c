@@ -22,6 +22,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,57 +30,357 @@
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include "ipc.h"
 #include "log.h"
 #include "msg.h"
 #include "socket.h"
+#include "stats.h"
 #include "mroute.h"
+#include "util.h"
 
 extern char *ident;
 static struct sockaddr_un sun;
 
 
-/* Receive command from the smcroutectl */
-static void ipc_read(int sd)
+/*
+ * Client connections are persistent and concurrent: smcroutectl batch
+ * mode sends many commands over one connection, and several control
+ * clients may be connected at once.  Each client gets its own carry
+ * buffer for partial command reassembly and an elastic reply buffer
+ * drained with non-blocking writes, so a stalled reader -- say a big
+ * `show` piped over a congested ssh session -- never wedges the event
+ * loop.  A client is disconnected only when its pending replies grow
+ * past %IPC_OUTBUF_MAX.
+ */
+#define IPC_CLIENT_MAX  16
+#define IPC_OUTBUF_MAX  (4 * 1024 * 1024)
+
+static struct client {
+	int    sd;		/* -1: free slot */
+	int    dead;		/* reply path failed, drop after dispatch */
+	size_t inlen;		/* partial command bytes carried over */
+	char   inbuf[MX_CMDPKT_SZ * 2];
+	char  *out;		/* replies the socket has not accepted */
+	size_t outsz;		/* allocated, grows on demand, kept on reuse */
+	size_t outlen;
+} clients[IPC_CLIENT_MAX];
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Event stream subscribers, `smcroutectl monitor` */
+#define IPC_MONITOR_MAX   8
+
+static int monitor[IPC_MONITOR_MAX];
+
+static struct client *client_find(int sd)
 {
-	char buf[MX_CMDPKT_SZ];
-	struct ipc_msg *msg;
+	size_t i;
 
-	memset(buf, 0, sizeof(buf));
-	msg = (struct ipc_msg *)ipc_receive(sd, buf, sizeof(buf));
-	if (!msg) {
-		/* Skip logging client disconnects */
-		if (errno != ECONNRESET)
-			smclog(LOG_WARNING, "Failed receving IPC message from client: %s", strerror(errno));
-		return;
+	for (i = 0; i < NELEMS(clients); i++) {
+		if (clients[i].sd == sd)
+			return &clients[i];
 	}
 
-	if (msg_do(sd, msg)) {
-		if (EINVAL == errno)
-			smclog(LOG_WARNING, "Unkown or malformed IPC message '%c' from client.", msg->cmd);
-		errno = 0;
-		ipc_send(sd, log_message, strlen(log_message) + 1);
-	} else {
-		ipc_send(sd, "", 1);
+	return NULL;
+}
+
+/* Client hung up or must be dropped, forget its slot */
+static void monitor_del(int sd)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(monitor); i++) {
+		if (monitor[i] == sd)
+			monitor[i] = -1;
+	}
+}
+
+static void client_drop(struct client *c)
+{
+	monitor_del(c->sd);
+	socket_close(c->sd);
+	c->sd     = -1;
+	c->dead   = 0;
+	c->inlen  = 0;
+	c->outlen = 0;
+}
+
+/* Queue reply bytes the kernel socket buffer did not accept */
+static int client_buffer(struct client *c, char *buf, size_t len)
+{
+	if (c->outlen + len > c->outsz) {
+		size_t sz = c->outsz ? c->outsz : 8192;
+		char *tmp;
+
+		while (sz < c->outlen + len)
+			sz *= 2;
+		if (sz > IPC_OUTBUF_MAX) {
+			errno = ENOSPC;
+			return -1;
+		}
+
+		tmp = realloc(c->out, sz);
+		if (!tmp)
+			return -1;
+		c->out   = tmp;
+		c->outsz = sz;
 	}
 
-	free(msg);
+	memcpy(c->out + c->outlen, buf, len);
+	c->outlen += len;
+	socket_wantwr(c->sd, 1);
+
+	return 0;
+}
+
+/* Drain pending replies, stop polling for writable once empty */
+static int client_flush(struct client *c)
+{
+	ssize_t n;
+
+	if (!c->outlen)
+		return 0;
+
+	n = send(c->sd, c->out, c->outlen, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+	memmove(c->out, c->out + n, c->outlen - n);
+	c->outlen -= n;
+	if (!c->outlen)
+		socket_wantwr(c->sd, 0);
+
+	return 0;
+}
+
+/*
+ * Reply transmission: hand the records straight to the (non-blocking)
+ * socket while nothing is queued, buffer whatever the kernel did not
+ * accept and let the event loop drain it when the socket drains.
+ */
+static int client_write(struct client *c, struct iovec *iov, int num)
+{
+	ssize_t n = 0;
+	int i;
+
+	if (!c->outlen) {
+		n = writev(c->sd, iov, num);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			n = 0;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		size_t skip = MIN((size_t)n, iov[i].iov_len);
+
+		n -= skip;
+		if (skip == iov[i].iov_len)
+			continue;
+
+		if (client_buffer(c, (char *)iov[i].iov_base + skip, iov[i].iov_len - skip))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * ipc_monitor - Subscribe a client to the event stream
+ * @sd: Client socket from ipc_accept()
+ *
+ * Returns:
+ * POSIX OK(0), or -1 with @errno set when all slots are taken.
+ */
+int ipc_monitor(int sd)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(monitor); i++) {
+		if (monitor[i] != -1)
+			continue;
+
+		monitor[i] = sd;
+
+		return 0;
+	}
+
+	smclog(LOG_WARNING, "Too many monitor subscribers, max %d", IPC_MONITOR_MAX);
+	errno = ENOSPC;
+
+	return -1;
+}
+
+/**
+ * ipc_event - Push one event record to all monitor subscribers
+ * @buf: Length-prefixed struct event_msg record
+ * @len: Length in bytes of @buf
+ */
+void ipc_event(void *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(monitor); i++) {
+		struct iovec io = { buf, len };
+		struct client *c;
+
+		if (monitor[i] == -1)
+			continue;
+
+		c = client_find(monitor[i]);
+		if (c && !client_write(c, &io, 1))
+			continue;
+
+		smclog(LOG_NOTICE, "Monitor subscriber gone or too slow, dropping");
+		if (c)
+			client_drop(c);
+		else {
+			socket_close(monitor[i]);
+			monitor[i] = -1;
+		}
+	}
+}
+
+/* Validate and unpack one command packet, at least msg->len bytes */
+static struct ipc_msg *ipc_parse(char *buf, size_t len)
+{
+	struct ipc_msg *msg = (struct ipc_msg *)buf;
+	size_t i, count;
+	char *ptr;
+
+	/* Upper bound: smcroutectl add in1 source group out1 out2 .. out32 */
+	count = msg->count;
+	if (count > (MAXVIFS + 3)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	msg = malloc(sizeof(struct ipc_msg) + count * sizeof(char *));
+	if (!msg)
+		return NULL;
+
+	memcpy(msg, buf, sizeof(struct ipc_msg));
+
+	ptr = buf + offsetof(struct ipc_msg, argv);
+	for (i = 0; i < count; i++) {
+		/* Verify ptr, attacker may set too large msg->count */
+		if (ptr >= (buf + len)) {
+			free(msg);
+			errno = EBADMSG;
+			return NULL;
+		}
+
+		msg->argv[i] = ptr;
+		ptr += strlen(ptr) + 1;
+	}
+	msg->count = count;
+
+	return msg;
+}
+
+/* Receive and dispatch command(s) from one smcroutectl client */
+static void ipc_client(int sd, void *arg)
+{
+	struct client *c = arg;
+	ssize_t len;
+
+	/* Registered for write readiness too, drain queued replies first */
+	if (client_flush(c))
+		goto drop;
+
+	while ((len = recv(sd, c->inbuf + c->inlen, sizeof(c->inbuf) - c->inlen - 1, MSG_DONTWAIT)) > 0) {
+		size_t off = 0;
+
+		c->inlen += len;
+		c->inbuf[c->inlen] = 0;	/* Make sure to always have at least one NUL, for strlen() */
+
+		while (c->inlen - off >= sizeof(struct ipc_msg)) {
+			struct ipc_msg *hdr = (struct ipc_msg *)&c->inbuf[off];
+			struct ipc_msg *msg;
+
+			if (hdr->len < sizeof(struct ipc_msg) || hdr->len > MX_CMDPKT_SZ)
+				goto drop;
+
+			if (c->inlen - off < hdr->len)
+				break;	/* Wait for remainder */
+
+			msg = ipc_parse(&c->inbuf[off], hdr->len);
+			if (!msg) {
+				smclog(LOG_WARNING, "Failed receving IPC message from client: %s", strerror(errno));
+				goto drop;
+			}
+
+			stats.ipc_commands++;
+			if (msg_do(sd, msg)) {
+				if (EINVAL == errno)
+					smclog(LOG_WARNING, "Unkown or malformed IPC message '%c' from client.", msg->cmd);
+				errno = 0;
+				ipc_send(sd, log_message, strlen(log_message) + 1);
+			} else {
+				ipc_send(sd, "", 1);
+			}
+
+			free(msg);
+			if (c->dead)
+				goto drop;
+			off += hdr->len;
+		}
+
+		memmove(c->inbuf, &c->inbuf[off], c->inlen - off);
+		c->inlen -= off;
+	}
+
+	if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+
+	/* Client hung up, or protocol error */
+drop:
+	client_drop(c);
 }
 
 static void ipc_accept(int sd, void *arg)
 {
-	int client;
+	struct client *c = NULL;
 	socklen_t socklen = 0;
+	size_t i;
+	int client;
 
 	(void)arg;
 	client = accept(sd, NULL, &socklen);
 	if (client < 0)
 		return;
 
-	ipc_read(client);
-	close(client);
+	for (i = 0; i < NELEMS(clients); i++) {
+		if (clients[i].sd == -1) {
+			c = &clients[i];
+			break;
+		}
+	}
+	if (!c) {
+		smclog(LOG_WARNING, "Too many IPC clients, max %d", IPC_CLIENT_MAX);
+		close(client);
+		return;
+	}
+
+	/* Replies must never block the daemon, see client_write() */
+	fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+
+	if (socket_register(client, ipc_client, c) < 0) {
+		smclog(LOG_WARNING, "Failed registering IPC client socket: %s", strerror(errno));
+		close(client);
+		return;
+	}
+
+	c->sd     = client;
+	c->dead   = 0;
+	c->inlen  = 0;
+	c->outlen = 0;
 }
 
 /**
@@ -90,8 +391,14 @@ static void ipc_accept(int sd, void *arg)
  */
 int ipc_init(void)
 {
-	int sd;
 	socklen_t len;
+	size_t i;
+	int sd;
+
+	for (i = 0; i < NELEMS(monitor); i++)
+		monitor[i] = -1;
+	for (i = 0; i < NELEMS(clients); i++)
+		clients[i].sd = -1;
 
 	if (strlen(LOCALSTATEDIR) + strlen(ident) + 11 >= sizeof(sun.sun_path)) {
 		smclog(LOG_ERR, "Too long socket path, max %zd chars", sizeof(sun.sun_path));
@@ -114,7 +421,7 @@ int ipc_init(void)
 	smclog(LOG_DEBUG, "Binding IPC socket to %s", sun.sun_path);
 
 	len = offsetof(struct sockaddr_un, sun_path) + strlen(sun.sun_path);
-	if (bind(sd, (struct sockaddr *)&sun, len) < 0 || listen(sd, 1)) {
+	if (bind(sd, (struct sockaddr *)&sun, len) < 0 || listen(sd, IPC_CLIENT_MAX)) {
 		smclog(LOG_WARNING, "Failed binding IPC socket, client disabled: %s", strerror(errno));
 		socket_close(sd);
 		return -1;
@@ -137,85 +444,105 @@ void ipc_exit(void)
  * @buf: Message to send
  * @len: Message length in bytes of @buf
  *
- * Sends the IPC message in @buf of the size @len to the peer.
+ * Sends the IPC message in @buf of the size @len to the peer, or queues
+ * it on the client's reply buffer when the socket is not ready.
  *
  * Returns:
- * Number of bytes successfully sent, or -1 with @errno on failure.
+ * Number of bytes sent or queued, or -1 with @errno on failure; the
+ * client is then torn down once command dispatch is done.
  */
 int ipc_send(int sd, char *buf, size_t len)
 {
-	if (write(sd, buf, len) != (ssize_t)len)
+	struct iovec io = { buf, len };
+	struct client *c;
+
+	c = client_find(sd);
+	if (!c) {
+		if (write(sd, buf, len) != (ssize_t)len)
+			return -1;
+
+		return len;
+	}
+
+	if (client_write(c, &io, 1)) {
+		c->dead = 1;
 		return -1;
+	}
 
 	return len;
 }
 
+/*
+ * Scatter-gather reply batching for the show commands.  The caller
+ * owns @buf and must keep it valid until the next ipc_flush(), see
+ * the record arenas in mroute.c and mcgroup.c.
+ */
+static struct iovec iov[IPC_IOV_MAX];
+static int iov_num = 0;
+
 /**
- * ipc_server_read - Read IPC message from client
+ * ipc_queue - Queue reply record for batched transmission
  * @sd:  Client socket from ipc_accept()
- * @buf: Buffer for message
- * @len: Size of @buf in bytes
+ * @buf: Reply record to send
+ * @len: Length in bytes of @buf
  *
- * Reads a message from the IPC socket and stores in @buf, respecting
- * the size @len.  Connects and resets connection as necessary.
+ * Queues @buf for transmission, auto-flushes with a single writev()
+ * when %IPC_IOV_MAX records have been gathered.  Call ipc_flush() to
+ * send any remaining records when done.
  *
  * Returns:
- * Pointer to a successfuly read command packet in @buf, or %NULL on error.
+ * POSIX OK(0), or -1 with @errno on failure.
  */
-void *ipc_receive(int sd, char *buf, size_t len)
+int ipc_queue(int sd, void *buf, size_t len)
 {
-	size_t sz;
+	iov[iov_num].iov_base = buf;
+	iov[iov_num].iov_len  = len;
 
-	sz = recv(sd, buf, len, 0);
-	if (!sz) {
-		errno = ECONNRESET;
-		return NULL;
-	}
+	if (++iov_num == IPC_IOV_MAX)
+		return ipc_flush(sd);
 
-	/* successful read */
-	if (sz >= sizeof(struct ipc_msg)) {
-		struct ipc_msg *msg = (struct ipc_msg *)buf;
-
-		/* Make sure to always have at least one NUL, for strlen() */
-		buf[sz] = 0;
+	return 0;
+}
 
-		if (sz == msg->len) {
-			char *ptr;
-			size_t i, count;
+/**
+ * ipc_flush - Send all queued reply records in one writev()
+ * @sd: Client socket from ipc_accept()
+ *
+ * Records the socket does not accept are copied to the client's reply
+ * buffer, so the record arenas may be reused as soon as this returns.
+ *
+ * Returns:
+ * POSIX OK(0), or -1 with @errno on failure.
+ */
+int ipc_flush(int sd)
+{
+	struct client *c;
+	ssize_t total = 0;
+	int i, num;
 
-			/* Upper bound: smcroutectl add in1 source group out1 out2 .. out32 */
-			count = msg->count;
-			if (count > (MAXVIFS + 3)) {
-				errno = EINVAL;
-				return NULL;
-			}
+	if (!iov_num)
+		return 0;
 
-			msg = malloc(sizeof(struct ipc_msg) + msg->count * sizeof(char *));
-			if (!msg)
-				return NULL;
+	num = iov_num;
+	iov_num = 0;
 
-			memcpy(msg, buf, sizeof(struct ipc_msg));
+	c = client_find(sd);
+	if (!c) {
+		for (i = 0; i < num; i++)
+			total += iov[i].iov_len;
 
-			ptr = buf + offsetof(struct ipc_msg, argv);
-			for (i = 0; i < count; i++) {
-				/* Verify ptr, attacker may set too large msg->count */
-				if (ptr >= (buf + len)) {
-					free(msg);
-					errno = EBADMSG;
-					return NULL;
-				}
+		if (writev(sd, iov, num) != total)
+			return -1;
 
-				msg->argv[i] = ptr;
-				ptr += strlen(ptr) + 1;
-			}
-			msg->count = count;
+		return 0;
+	}
 
-			return msg;
-		}
+	if (client_write(c, iov, num)) {
+		c->dead = 1;
+		return -1;
 	}
 
-	errno = EAGAIN;
-	return NULL;
+	return 0;
 }
 
 /**
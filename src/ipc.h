@@ -4,15 +4,24 @@
 
 #include "config.h"
 
+/* Max records queued by ipc_queue() before writev() flush */
+#define IPC_IOV_MAX 64
+
 #ifdef ENABLE_CLIENT
 int   ipc_init    (void);
 void  ipc_exit    (void);
 
 int   ipc_send    (int sd, char *buf, size_t len);
-void *ipc_receive (int sd, char *buf, size_t len);
+int   ipc_queue   (int sd, void *buf, size_t len);
+int   ipc_flush   (int sd);
+
+int   ipc_monitor (int sd);
+void  ipc_event   (void *buf, size_t len);
 #else
 #define ipc_init()
 #define ipc_exit()
+#define ipc_monitor(sd)     (-1)
+#define ipc_event(buf, len)
 #endif
 
 #endif /* SMCROUTE_IPC_H_ */
@@ -19,9 +19,21 @@
 
 #define SYSLOG_NAMES
 
+#include "config.h"
+
+#include <errno.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <semaphore.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#endif
 
 #include "log.h"
 #include "util.h"
@@ -50,6 +62,169 @@ int loglvl(const char *level)
 	return atoi(level);
 }
 
+#ifdef HAVE_PTHREAD
+/*
+ * syslog() blocks on the log socket, and smclog() sits in the middle
+ * of the kernel upcall hot path -- with debug logging enabled a route
+ * storm used to double install latency.  Records are pushed into a
+ * lock-free ring instead and written by a low-priority thread; when
+ * the ring overflows messages are counted, not waited for.
+ *
+ * Both the control thread and the upcall worker log, so slots are
+ * claimed with a compare-and-swap and handed to the writer with a
+ * per-slot ready flag.
+ */
+#define LOG_RING_SIZE 1024	/* must be a power of two */
+
+struct log_rec {
+	int  severity;
+	int  ready;		/* slot filled, cleared by the writer */
+	char text[sizeof(log_message)];
+};
+
+static struct log_rec log_ring[LOG_RING_SIZE];
+static unsigned int log_head;	/* claimed by producers with CAS */
+static unsigned int log_tail;	/* written by the writer thread only */
+
+static uint64_t log_drops;	/* messages dropped due to a full ring */
+
+static sem_t log_sem;
+static pthread_t log_thread;
+static int log_running = 0;
+static int log_stop = 0;
+
+/* Queue one preformatted record, non-zero if the caller must log inline */
+static int log_queue(int severity, const char *text)
+{
+	struct log_rec *rec;
+	unsigned int head, tail;
+
+	if (!log_running)
+		return 1;
+
+	do {
+		head = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+		tail = __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE);
+		if (head - tail >= LOG_RING_SIZE) {
+			__atomic_fetch_add(&log_drops, 1, __ATOMIC_RELAXED);
+			return 0;	/* dropped, but counted */
+		}
+	} while (!__atomic_compare_exchange_n(&log_head, &head, head + 1, 0,
+					      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	rec = &log_ring[head & (LOG_RING_SIZE - 1)];
+	rec->severity = severity;
+	strlcpy(rec->text, text, sizeof(rec->text));
+	__atomic_store_n(&rec->ready, 1, __ATOMIC_RELEASE);
+
+	sem_post(&log_sem);
+
+	return 0;
+}
+
+static void log_drain(void)
+{
+	struct log_rec *rec;
+	uint64_t drops;
+
+	rec = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+	while (__atomic_load_n(&rec->ready, __ATOMIC_ACQUIRE)) {
+		syslog(rec->severity, "%s", rec->text);
+		__atomic_store_n(&rec->ready, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&log_tail, log_tail + 1, __ATOMIC_RELEASE);
+		rec = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+	}
+
+	drops = __atomic_exchange_n(&log_drops, 0, __ATOMIC_RELAXED);
+	if (drops)
+		syslog(LOG_WARNING, "Log ring full, dropped %llu messages",
+		       (unsigned long long)drops);
+}
+
+static void *log_loop(void *arg)
+{
+	(void)arg;
+#ifdef __linux__
+	/* Forwarding setup is more important than writing its log */
+	setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);
+#endif
+
+	while (1) {
+		while (sem_wait(&log_sem) && errno == EINTR)
+			;
+
+		log_drain();
+		if (__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	return NULL;
+}
+
+/**
+ * log_init - Hand syslog writing over to a low-priority thread
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set, smclog()
+ * then keeps writing inline.
+ */
+static pthread_t log_main;	/* control thread, owns log_message */
+
+int log_init(void)
+{
+	if (log_running)
+		return 0;
+
+	if (sem_init(&log_sem, 0, 0))
+		return -1;
+
+	log_main = pthread_self();
+	log_stop = 0;
+	if (pthread_create(&log_thread, NULL, log_loop, NULL)) {
+		sem_destroy(&log_sem);
+		return -1;
+	}
+	log_running = 1;
+
+	return 0;
+}
+
+void log_exit(void)
+{
+	if (!log_running)
+		return;
+
+	__atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+	sem_post(&log_sem);
+	pthread_join(log_thread, NULL);
+	log_running = 0;
+
+	/* Flush anything still queued, smclog() is synchronous again */
+	log_drain();
+	sem_destroy(&log_sem);
+	log_head = log_tail = 0;
+}
+
+#else  /* no pthreads, logging stays synchronous */
+
+static int log_queue(int severity, const char *text)
+{
+	(void)severity;
+	(void)text;
+	return 1;
+}
+
+int log_init(void)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+void log_exit(void)
+{
+}
+#endif /* HAVE_PTHREAD */
+
 /**
  * smclog - Log message to syslog or stderr
  * @severity: Standard syslog() severity levels
@@ -59,17 +234,31 @@ int loglvl(const char *level)
  * @severity is greater than the @log_level threshold.  When @code is
  * set it is appended to the log, along with the error message.
  *
- * When @severity is %LOG_ERR or worse this function will call exit().
+ * In the daemon the record is queued to a low-priority writer thread
+ * so hot paths never block on the syslog socket; before log_init() and
+ * after log_exit() messages are written inline as before.
  */
 void smclog(int severity, const char *fmt, ...)
 {
+	char text[sizeof(log_message)];
 	va_list args;
 
 	va_start(args, fmt);
-	vsnprintf(log_message, sizeof(log_message), fmt, args);
+	vsnprintf(text, sizeof(text), fmt, args);
 	va_end(args);
 
-	syslog(severity, "%s", log_message);
+	/*
+	 * The IPC error reply echoes the latest message, see ipc.c, and
+	 * only the control thread serves clients -- the worker, loader
+	 * and writer threads must not clobber it mid-reply.
+	 */
+#ifdef HAVE_PTHREAD
+	if (!log_running || pthread_equal(pthread_self(), log_main))
+#endif
+		strlcpy(log_message, text, sizeof(log_message));
+
+	if (log_queue(severity, text))
+		syslog(severity, "%s", text);
 }
 
 /**
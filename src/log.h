@@ -8,6 +8,8 @@ extern int  log_level;
 extern char log_message[128];
 
 int loglvl(const char *level);
+int log_init(void);
+void log_exit(void);
 void smclog(int severity, const char *fmt, ...);
 
 #endif /* SMCROUTE_LOG_H_ */
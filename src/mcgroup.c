@@ -36,23 +36,58 @@
 #include "log.h"
 #include "ipc.h"
 #include "ifvc.h"
+#include "msg.h"
+#include "pool.h"
 #include "queue.h"
 #include "socket.h"
+#include "util.h"
+
+/*
+ * Socket holding kernel IGMP memberships.  The kernel caps memberships
+ * per socket (igmp_max_memberships, default 20), so joins are spread
+ * over a pool of sockets, each tracking how many memberships it holds.
+ */
+struct mcsock {
+	LIST_ENTRY(mcsock) link;
+
+	int sd;
+	int num;		/* kernel memberships held by this socket */
+};
 
 struct mgroup {
 	LIST_ENTRY(mgroup) link;
+	LIST_ENTRY(mgroup) hlink;	/* (vif, source, group) hash bucket */
 
+	struct mcsock *sock;	/* socket holding the kernel membership */
 	short          inbound;
 	struct in_addr source;
 	struct in_addr group;
+	uint8_t        unused;	/* mark-and-sweep flag for conf reload */
 };
 
 /*
- * Track IGMP join, any-source and source specific
+ * Track IGMP join, any-source and source specific.  The list drives
+ * show and mark-and-sweep, the hash index makes join/leave and the
+ * duplicate check O(1) also at tens of thousands of groups.
  */
 LIST_HEAD(, mgroup) mgroup_static_list = LIST_HEAD_INITIALIZER();
 
-static int mcgroup4_socket = -1;
+#define MGROUP_HASH_SIZE 512
+
+static LIST_HEAD(, mgroup) mgroup_hash[MGROUP_HASH_SIZE];
+
+/* Group and socket entries are pool allocated, released in bulk on shutdown */
+static struct pool mgroup_pool;
+static struct pool mcsock_pool;
+
+static LIST_HEAD(, mcsock) mcsock4_list = LIST_HEAD_INITIALIZER();
+static int mcsock4_max = 20;	/* kernel cap on memberships per socket */
+
+static int mcgroup4_initialized = 0;
+
+#ifdef __linux__
+#define IGMP_MAX_MEMBERSHIPS "/proc/sys/net/ipv4/igmp_max_memberships"
+#endif
 
 #ifdef HAVE_LINUX_FILTER_H
 /* Extremely simple "drop everything" filter for Linux so we do not get
@@ -77,133 +112,217 @@ static struct iface *match_valid_iface(const char *ifname, struct ifmatch *state
 	return iface;
 }
 
-static void list_add(struct iface *iface, struct in_addr source, struct in_addr group)
+static unsigned int hash_mgroup(short vif, struct in_addr source, struct in_addr group)
+{
+	uint32_t hash = ntohl(source.s_addr) ^ ntohl(group.s_addr) ^ (uint32_t)vif;
+
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	return hash % MGROUP_HASH_SIZE;
+}
+
+static struct mgroup *mgroup_find(short vif, struct in_addr source, struct in_addr group)
 {
 	struct mgroup *entry;
 
-	entry = malloc(sizeof(*entry));
-	if (!entry) {
-		smclog(LOG_ERR, "Failed adding mgroup to list: %s", strerror(errno));
-		return;
+	LIST_FOREACH(entry, &mgroup_hash[hash_mgroup(vif, source, group)], hlink) {
+		if (entry->inbound       == vif           &&
+		    entry->source.s_addr == source.s_addr &&
+		    entry->group.s_addr  == group.s_addr)
+			return entry;
 	}
 
-	memset(entry, 0, sizeof(*entry));
-	entry->inbound = iface->vif;
-	entry->source  = source;
-	entry->group   = group;
-	LIST_INSERT_HEAD(&mgroup_static_list, entry, link);
+	return NULL;
 }
 
-static void list_rem(struct iface *iface, struct in_addr source, struct in_addr group)
+/* First socket with room for one more membership, grows the pool */
+static struct mcsock *mcsock4_get(void)
 {
-	struct mgroup *entry, *tmp;
+	struct mcsock *sock;
 
-	LIST_FOREACH_SAFE(entry, &mgroup_static_list, link, tmp) {
-		if (entry->inbound       != iface->vif    ||
-		    entry->source.s_addr != source.s_addr ||
-		    entry->group.s_addr  != group.s_addr)
-			continue;
+	LIST_FOREACH(sock, &mcsock4_list, link) {
+		if (sock->num < mcsock4_max)
+			return sock;
+	}
 
-		LIST_REMOVE(entry, link);
-		free(entry);
+	sock = pool_alloc(&mcsock_pool);
+	if (!sock) {
+		smclog(LOG_ERR, "failed allocating IPv4 mcgroup socket: %s", strerror(errno));
+		return NULL;
 	}
+
+	sock->sd = socket_create(AF_INET, SOCK_DGRAM, 0, NULL, NULL);
+	if (sock->sd < 0) {
+		smclog(LOG_ERR, "failed creating IPv4 mcgroup socket: %s", strerror(errno));
+		pool_free(&mcsock_pool, sock);
+		return NULL;
+	}
+
+#ifdef HAVE_LINUX_FILTER_H
+	if (setsockopt(sock->sd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
+		smclog(LOG_WARNING, "failed setting IPv4 socket filter, continuing anyway");
+#endif
+	sock->num = 0;
+	LIST_INSERT_HEAD(&mcsock4_list, sock, link);
+
+	return sock;
 }
 
+/* Membership gone, close the socket when it holds no more */
+static void mcsock4_put(struct mcsock *sock)
+{
+	if (--sock->num > 0)
+		return;
+
+	LIST_REMOVE(sock, link);
+	socket_close(sock->sd);
+	pool_free(&mcsock_pool, sock);
+}
 
 static void mcgroup4_init(void)
 {
-	if (mcgroup4_socket < 0) {
-		mcgroup4_socket = socket_create(AF_INET, SOCK_DGRAM, 0, NULL, NULL);
-		if (mcgroup4_socket < 0) {
-			smclog(LOG_ERR, "failed creating IPv4 mcgroup socket: %s", strerror(errno));
-			exit(255);
+	size_t i;
+
+	if (mcgroup4_initialized)
+		return;
+
+	pool_init(&mgroup_pool, sizeof(struct mgroup), 128);
+	pool_init(&mcsock_pool, sizeof(struct mcsock), 8);
+	for (i = 0; i < NELEMS(mgroup_hash); i++)
+		LIST_INIT(&mgroup_hash[i]);
+
+#ifdef __linux__
+	{
+		FILE *fp;
+		int num;
+
+		fp = fopen(IGMP_MAX_MEMBERSHIPS, "r");
+		if (fp) {
+			if (fscanf(fp, "%d", &num) == 1 && num > 0)
+				mcsock4_max = num;
+			fclose(fp);
 		}
+	}
+#endif
+	mcgroup4_initialized = 1;
+}
 
-#ifdef HAVE_LINUX_FILTER_H
-		if (setsockopt(mcgroup4_socket, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0)
-			smclog(LOG_WARNING, "failed setting IPv4 socket filter, continuing anyway");
+/* Issue the kernel membership call, ASM or source specific */
+static int kern_join_leave4(int sd, int cmd, struct iface *iface, struct in_addr source, struct in_addr group)
+{
+	struct ip_mreq mreq;
+
+	if (source.s_addr != htonl(INADDR_ANY)) {
+#ifdef IP_ADD_SOURCE_MEMBERSHIP
+		struct ip_mreq_source mreqsrc;
+
+		memset(&mreqsrc, 0, sizeof(mreqsrc));
+		mreqsrc.imr_multiaddr.s_addr  = group.s_addr;
+		mreqsrc.imr_sourceaddr.s_addr = source.s_addr;
+		mreqsrc.imr_interface.s_addr  = iface->inaddr.s_addr;
+
+		return setsockopt(sd, IPPROTO_IP,
+				  cmd == 'j' ? IP_ADD_SOURCE_MEMBERSHIP : IP_DROP_SOURCE_MEMBERSHIP,
+				  &mreqsrc, sizeof(mreqsrc));
+#else
+		smclog(LOG_WARNING, "Source specific join/leave not supported, ignoring source %s", inet_ntoa(source));
 #endif
 	}
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.imr_multiaddr.s_addr = group.s_addr;
+	mreq.imr_interface.s_addr = iface->inaddr.s_addr;
+
+	return setsockopt(sd, IPPROTO_IP,
+			  cmd == 'j' ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP,
+			  &mreq, sizeof(mreq));
 }
 
-static int mcgroup_join_leave_ipv4(int sd, int cmd, const char *ifname, struct in_addr group)
+static int group_join(struct iface *iface, struct in_addr source, struct in_addr group)
 {
-	int opt, ret = 0;
-	struct ip_mreq mreq;
-	struct iface *iface;
-	struct ifmatch state;
-	struct in_addr any_src;
+	struct mgroup *entry;
+	struct mcsock *sock;
 
-	any_src.s_addr = htonl(INADDR_ANY);
-	iface_match_init(&state);
-	while ((iface = match_valid_iface(ifname, &state))) {
-		if (cmd == 'j') {
-			list_add(iface, any_src, group);
-			opt = IP_ADD_MEMBERSHIP;
-		} else {
-			list_rem(iface, any_src, group);
-			opt = IP_DROP_MEMBERSHIP;
-		}
-		mreq.imr_multiaddr.s_addr = group.s_addr;
-		mreq.imr_interface.s_addr = iface->inaddr.s_addr;
-		if (setsockopt(sd, IPPROTO_IP, opt, &mreq, sizeof(mreq))) {
-			if (EADDRNOTAVAIL == errno && cmd == 'l')
-				smclog(LOG_DEBUG, "failed leaving group, not a member of %s", inet_ntoa(group));
-			else if (EADDRINUSE == errno && cmd == 'j')
-				smclog(LOG_DEBUG, "failed joining group, already member of %s", inet_ntoa(group));
-			else
-				smclog(LOG_DEBUG, "failed group %s: %s", cmd == 'j' ? "join" : "leave", strerror(errno));
-			ret = 1;
-		}
+	/* Skip kernel join if already a member, reload case */
+	entry = mgroup_find(iface->vif, source, group);
+	if (entry) {
+		entry->unused = 0;
+		return 0;
 	}
 
-	if (!state.match_count)
+	sock = mcsock4_get();
+	if (!sock)
 		return 1;
-	else
-		return ret;
+
+	if (kern_join_leave4(sock->sd, 'j', iface, source, group)) {
+		if (EADDRINUSE == errno)
+			smclog(LOG_DEBUG, "failed joining group, already member of %s", inet_ntoa(group));
+		else
+			smclog(LOG_DEBUG, "failed group join: %s", strerror(errno));
+		return 1;
+	}
+	sock->num++;
+
+	entry = pool_alloc(&mgroup_pool);
+	if (!entry) {
+		smclog(LOG_ERR, "Failed adding mgroup to list: %s", strerror(errno));
+		return 0;	/* kernel join is in place regardless */
+	}
+
+	memset(entry, 0, sizeof(*entry));
+	entry->sock    = sock;
+	entry->inbound = iface->vif;
+	entry->source  = source;
+	entry->group   = group;
+	LIST_INSERT_HEAD(&mgroup_static_list, entry, link);
+	LIST_INSERT_HEAD(&mgroup_hash[hash_mgroup(iface->vif, source, group)], entry, hlink);
+
+	return 0;
 }
 
-static int mcgroup_join_leave_ssm_ipv4(int sd, int cmd, const char *ifname, struct in_addr source, struct in_addr group)
+static int group_leave(struct iface *iface, struct in_addr source, struct in_addr group)
 {
-#ifndef IP_ADD_SOURCE_MEMBERSHIP
-	smclog(LOG_WARNING, "Source specific join/leave not supported, ignoring source %s", inet_ntoa(source));
-	return mcgroup_join_leave_ipv4(sd, cmd, ifname, group);
-#else
-	int opt, ret = 0;
-	struct ip_mreq_source mreqsrc;
+	struct mgroup *entry;
+	int ret = 0;
+
+	entry = mgroup_find(iface->vif, source, group);
+	if (!entry) {
+		smclog(LOG_DEBUG, "failed leaving group, not a member of %s", inet_ntoa(group));
+		return 1;
+	}
+
+	if (kern_join_leave4(entry->sock->sd, 'l', iface, source, group)) {
+		smclog(LOG_DEBUG, "failed group leave: %s", strerror(errno));
+		ret = 1;
+	}
+
+	mcsock4_put(entry->sock);
+	LIST_REMOVE(entry, link);
+	LIST_REMOVE(entry, hlink);
+	pool_free(&mgroup_pool, entry);
+
+	return ret;
+}
+
+static int mcgroup_join_leave_ipv4(int cmd, const char *ifname, struct in_addr source, struct in_addr group)
+{
+	int ret = 0;
 	struct iface *iface;
 	struct ifmatch state;
 
 	iface_match_init(&state);
 	while ((iface = match_valid_iface(ifname, &state))) {
-		if (cmd == 'j') {
-			list_add(iface, source, group);
-			opt = IP_ADD_SOURCE_MEMBERSHIP;
-		} else {
-			list_rem(iface, source, group);
-			opt = IP_DROP_SOURCE_MEMBERSHIP;
-		}
-		mreqsrc.imr_multiaddr.s_addr = group.s_addr;
-		mreqsrc.imr_sourceaddr.s_addr = source.s_addr;
-		mreqsrc.imr_interface.s_addr = iface->inaddr.s_addr;
-		if (setsockopt(sd, IPPROTO_IP, opt, &mreqsrc, sizeof(mreqsrc))) {
-			if (EADDRNOTAVAIL == errno && cmd == 'j')
-				smclog(LOG_DEBUG, "failed join, already member of %s", inet_ntoa(group));
-			else if (EADDRNOTAVAIL == errno && cmd == 'l')
-				smclog(LOG_DEBUG, "failed leave, not a member of %s from that source", inet_ntoa(group));
-			else if (EINVAL == errno && cmd == 'l')
-				smclog(LOG_DEBUG, "failed leave, not a member of %s", inet_ntoa(group));
-			else
-				smclog(LOG_WARNING, "failed %s: %s", cmd == 'j' ? "join" : "leave", strerror(errno));
-			ret = 1;
-		}
+		if (cmd == 'j')
+			ret += group_join(iface, source, group);
+		else
+			ret += group_leave(iface, source, group);
 	}
 
 	if (!state.match_count)
 		return 1;
-	else
-		return ret;
-#endif
+
+	return ret;
 }
 
 /*
@@ -218,10 +337,7 @@ int mcgroup4_join(const char *ifname, struct in_addr source, struct in_addr grou
 {
 	mcgroup4_init();
 
-	if (!source.s_addr)
-		return mcgroup_join_leave_ipv4(mcgroup4_socket, 'j', ifname, group);
-
-	return mcgroup_join_leave_ssm_ipv4(mcgroup4_socket, 'j', ifname, source, group);
+	return mcgroup_join_leave_ipv4('j', ifname, source, group);
 }
 
 /*
@@ -234,10 +350,49 @@ int mcgroup4_leave(const char *ifname, struct in_addr source, struct in_addr gro
 {
 	mcgroup4_init();
 
-	if (!source.s_addr)
-		return mcgroup_join_leave_ipv4(mcgroup4_socket, 'l', ifname, group);
+	return mcgroup_join_leave_ipv4('l', ifname, source, group);
+}
+
+/**
+ * mcgroup4_mark_all - Mark all joined groups for sweeping
+ *
+ * Used by the .conf reload logic: mark all joined groups, re-read the
+ * .conf file, which clears the mark on groups still in the file, then
+ * sweep to leave the groups no longer wanted.
+ */
+void mcgroup4_mark_all(void)
+{
+	struct mgroup *entry;
 
-	return mcgroup_join_leave_ssm_ipv4(mcgroup4_socket, 'l', ifname, source, group);
+	LIST_FOREACH(entry, &mgroup_static_list, link)
+		entry->unused = 1;
+}
+
+/**
+ * mcgroup4_sweep_all - Leave all groups still marked as unused
+ */
+void mcgroup4_sweep_all(void)
+{
+	struct mgroup *entry, *tmp;
+
+	LIST_FOREACH_SAFE(entry, &mgroup_static_list, link, tmp) {
+		struct iface *iface;
+
+		if (!entry->unused)
+			continue;
+
+		iface = iface_find_by_vif(entry->inbound);
+		if (iface) {
+			mcgroup4_leave(iface->name, entry->source, entry->group);
+			continue;
+		}
+
+		/* Interface gone, kernel already dropped the membership */
+		mcsock4_put(entry->sock);
+		LIST_REMOVE(entry, link);
+		LIST_REMOVE(entry, hlink);
+		pool_free(&mgroup_pool, entry);
+	}
 }
 
 /*
@@ -245,18 +400,24 @@ int mcgroup4_leave(const char *ifname, struct in_addr source, struct in_addr gro
  */
 void mcgroup4_disable(void)
 {
-	struct mgroup *entry, *tmp;
+	struct mcsock *sock;
+	size_t i;
 
-	if (mcgroup4_socket != -1) {
-		socket_close(mcgroup4_socket);
-		mcgroup4_socket = -1;
-	}
+	if (!mcgroup4_initialized)
+		return;
 
-	LIST_FOREACH_SAFE(entry, &mgroup_static_list, link, tmp) {
-		LIST_REMOVE(entry, link);
-		free(entry);
+	while ((sock = LIST_FIRST(&mcsock4_list)))  {
+		LIST_REMOVE(sock, link);
+		socket_close(sock->sd);
 	}
 
+	/* Bulk release all tracked group memberships */
+	LIST_INIT(&mgroup_static_list);
+	for (i = 0; i < NELEMS(mgroup_hash); i++)
+		LIST_INIT(&mgroup_hash[i]);
+	pool_exit(&mgroup_pool);
+	pool_exit(&mcsock_pool);
+	mcgroup4_initialized = 0;
 }
 
 #ifdef HAVE_IPV6_MULTICAST_HOST
@@ -356,31 +517,39 @@ void mcgroup6_disable(void)
 /* Write all joined IGMP/MLD groups to client socket */
 int mcgroup_show(int sd, int detail)
 {
-	char buf[256];
-	char sg[INET_ADDRSTRLEN * 2 + 5];
+	/* Backs queued, not yet flushed, iovec entries in ipc_queue() */
+	static char arena[IPC_IOV_MAX][sizeof(struct show_msg) + IFNAMSIZ + 1];
+	static int slot = 0;
 	struct mgroup *g;
 
 	(void)detail;
 	LIST_FOREACH(g, &mgroup_static_list, link) {
-		char src[INET_ADDRSTRLEN] = "*";
-		char grp[INET_ADDRSTRLEN];
+		struct show_msg *sm = (struct show_msg *)arena[slot];
 		struct iface *i;
+		size_t len;
 
 		i = iface_find_by_vif(g->inbound);
 
-		if (g->source.s_addr != htonl(INADDR_ANY))
-			inet_ntop(AF_INET, &g->source, src, sizeof(src));
-		inet_ntop(AF_INET, &g->group, grp, sizeof(grp));
-
-		snprintf(sg, sizeof(sg), "(%s, %s)", src, grp);
-		snprintf(buf, sizeof(buf), "%-34s %s\n", sg, i->name);
+		memset(sm, 0, sizeof(*sm));
+		sm->type   = 'g';
+		sm->source = g->source.s_addr;
+		sm->group  = g->group.s_addr;
+		/* Interface may have been unregistered, swept on next reload */
+		len = snprintf(sm->ifname, IFNAMSIZ + 1, "%s", i ? i->name : "<gone>");
+		sm->len = sizeof(*sm) + len + 1;
 
-		if (ipc_send(sd, buf, strlen(buf)) < 0) {
+		slot = (slot + 1) % IPC_IOV_MAX;
+		if (ipc_queue(sd, sm, sm->len) < 0) {
 			smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
 			return -1;
 		}
 	}
 
+	if (ipc_flush(sd) < 0) {
+		smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
+		return -1;
+	}
+
 	return 0;
 }
 #endif
@@ -4,6 +4,8 @@
 
 int  mcgroup4_join      (const char *ifname, struct in_addr  source, struct in_addr  group);
 int  mcgroup4_leave     (const char *ifname, struct in_addr  source, struct in_addr  group);
+void mcgroup4_mark_all  (void);
+void mcgroup4_sweep_all (void);
 void mcgroup4_disable   (void);
 
 int  mcgroup6_join      (const char *ifname, struct in6_addr group);
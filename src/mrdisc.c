@@ -41,6 +41,7 @@ struct ifsock {
 };
 
 static uint8_t interval       = 20;
+static unsigned int tick      = 0;
 static LIST_HEAD(, ifsock) il = LIST_HEAD_INITIALIZER();
 
 
@@ -74,7 +75,20 @@ static void announce(struct ifsock *entry)
 int mrdisc_init(int period)
 {
 	interval = period;
-	if (timer_add(interval, mrdisc_send, NULL) < 0) {
+	if (!interval)
+		interval = MRDISC_INTERVAL_DEFAULT;
+
+	/* Bake the frozen announcement templates */
+	inet_init(interval);
+
+	/*
+	 * One-second tick, each interface announces once per interval on
+	 * its own VIF-derived phase.  Announcing all interfaces from one
+	 * timer shot means a synchronized burst of sequential sendto()
+	 * calls every interval, a visible latency spike in the event
+	 * loop with hundreds of mrdisc interfaces.
+	 */
+	if (timer_add(1, mrdisc_send, NULL) < 0) {
 		smclog(LOG_ERR, "Failed starting mrdisc announcement timer.");
 		return -1;
 	}
@@ -195,7 +209,12 @@ void mrdisc_send(void *arg)
 	struct ifsock *entry;
 
 	(void)arg;
+	tick++;
 	LIST_FOREACH(entry, &il, link) {
+		/* Not this interface's phase of the interval yet */
+		if ((unsigned int)(entry->vif % interval) != tick % interval)
+			continue;
+
 		if (entry->refcnt == 0) {
 			smclog(LOG_DEBUG, "Skipping mrdisc on inactive %s", entry->ifname);
 			continue;
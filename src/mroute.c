@@ -35,6 +35,10 @@
 #include <unistd.h>
 #include <time.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>		/* recv() + MSG_DONTWAIT */
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include "log.h"
 #include "ifvc.h"
@@ -43,8 +47,13 @@
 #include "socket.h"
 #include "mrdisc.h"
 #include "mroute.h"
+#include "msg.h"
+#include "pool.h"
+#include "shm.h"
+#include "stats.h"
 #include "timer.h"
 #include "util.h"
+#include "worker.h"
 
 /* MAX_MC_VIFS from mroute.h must have same value as MAXVIFS from mroute.h */
 #if MAX_MC_VIFS != MAXVIFS
@@ -63,789 +72,2810 @@
  */
 static int cache_timeout = 0;
 
-/*
- * Raw IGMP socket used as interface for the IPv4 mrouted API.
- * Receives IGMP packets and upcall messages from the kernel.
- */
-static int mroute4_socket = -1;
+#define MROUTE4_HASH_SIZE 1024
 
-/*
- * User added/configured (*,G) matched on-demand at runtime.  See
- * mroute4_dyn_list for the (S,G) routes set from this "template".
- */
-LIST_HEAD(, mroute4) mroute4_conf_list = LIST_HEAD_INITIALIZER();
+struct conf4_snap;
 
 /*
- * Dynamically, on-demand, set (S,G) routes.  Tracks if the user
- * removes a configured (*,G) route.
+ * Per routing-table IPv4 state.  One instance per `table <id>` section
+ * in the .conf file, each with its own kernel socket bound with
+ * MRT_TABLE, so a single daemon can serve several VRFs.  The lists and
+ * hash indexes mirror what used to be file-scope state:
+ *
+ *  - conf_list:   user added/configured (*,G) rules matched on-demand
+ *  - dyn_list:    (S,G) routes learned from those rules, kept ordered
+ *                 on last_use, oldest first, for cheap expiry
+ *  - static_list: regular static routes, mostly for 'smcroutectl show'
+ *  - sg_hash:     exact (S,G) index over static and learned routes,
+ *                 keyed on (source, group), O(1) upcall and del lookups
+ *  - conf_hash:   (*,G/len) rules keyed on the masked group prefix,
+ *                 doubling as a longest-prefix-match table: one probe
+ *                 per prefix length in use, longest first
+ *
+ * All mroute4 entries come from the per-table pool, avoiding one
+ * malloc()/free() round-trip per kernel upcall.
  */
-LIST_HEAD(, mroute4) mroute4_dyn_list = LIST_HEAD_INITIALIZER();
+struct mrt4_table {
+	LIST_ENTRY(mrt4_table) link;
+
+	int id;			/* kernel routing table id, 0 = default */
+	int sd;			/* mrouted API socket bound to this table */
+
+	LIST_HEAD(, mroute4) conf_list;
+	TAILQ_HEAD(, mroute4) dyn_list;
+	LIST_HEAD(, mroute4) static_list;
+
+	LIST_HEAD(, mroute4) sg_hash[MROUTE4_HASH_SIZE];
+	LIST_HEAD(, mroute4) conf_hash[MROUTE4_HASH_SIZE];
+	int len_cnt[33];	/* rules per prefix length, (*,G) counts as /32 */
+
+	struct pool pool;
+
+	/* Internal virtual interface (VIF) descriptor vector, each slot
+	 * with a reverse index over the routes referencing the VIF */
+	struct {
+		struct iface *iface;
+		struct iface *stale;	/* owner before the last MRT_DEL_VIF */
+		LIST_HEAD(, mroute4) routes;
+	} vif_list[MAXVIFS];
+
+	/* Rule snapshots published to the upcall worker, default table only */
+	struct conf4_snap *snap;
+	struct conf4_snap *retired;
+	unsigned int snap_seen;
+};
+
+static LIST_HEAD(, mrt4_table) table4_list = LIST_HEAD_INITIALIZER();
+static struct mrt4_table *table4_default;	/* first enabled table */
+static struct mrt4_table *t4;			/* current table for route ops */
+static int do_vifs4 = 0;			/* from mroute4_enable() */
+
+static int is_exact_match4(struct mroute4 *a, struct mroute4 *b);
+static int is_match4(struct mroute4 *rule, struct mroute4 *cand);
+static int is_active4(struct mroute4 *route);
+static int kern_add4(struct mroute4 *route, int active);
+static int kern_add4_raw(int sd, struct mroute4 *route);
+static int kern_del4(struct mroute4 *route, int active);
+static int mroute4_add_vif(struct iface *iface);
+static void handle_nocache4(int sd, void *arg);
+
+static unsigned int hash_sg4(struct in_addr source, struct in_addr group)
+{
+	uint32_t hash = ntohl(source.s_addr) ^ ntohl(group.s_addr);
+
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	return hash % MROUTE4_HASH_SIZE;
+}
 
 /*
- * Tracks regular static routes, mostly for 'smcroutectl show'
+ * Set by mroute4_bulk_begin() during .conf load, counts added routes
+ * and skips the advisory overlap scan, the hash indexes already catch
+ * exact duplicates.
  */
-LIST_HEAD(, mroute4) mroute4_static_list = LIST_HEAD_INITIALIZER();
+static int bulk_mode = 0;
+static int bulk_count = 0;
 
-#ifdef HAVE_IPV6_MULTICAST_ROUTING
+#ifdef HAVE_PTHREAD
 /*
- * Raw ICMPv6 socket used as interface for the IPv6 mrouted API.
- * Receives MLD packets and upcall messages from the kenrel.
+ * Bulk loader pool.  During .conf bulk load and reload every MRT_ADD_MFC
+ * is a blocking setsockopt(), issued one at a time from the control
+ * thread, which serializes cold-start route programming.  The pool
+ * overlaps those calls with parsing and list/index insertion: kern_add4()
+ * queues a snapshot of the mfcctl payload and a few short-lived threads
+ * issue the setsockopt() calls.  MRT_ADD_MFC replaces an existing entry,
+ * so a route updated twice during one load is simply programmed twice,
+ * in queue order.  Failures are counted and reported in aggregate when
+ * the pool is drained at bulk end.
  */
-static int mroute6_socket = -1;
+#define LOADER_RING_SIZE   4096	/* must be a power of two */
+#define LOADER_THREADS_MAX 4
+
+struct loader_job {
+	int sd;
+	int af;			/* AF_INET or AF_INET6 */
+	union {
+		struct mfcctl mc4;
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+		struct mf6cctl mc6;
 #endif
+	} u;
+};
 
-/* IPv4 internal virtual interfaces (VIF) descriptor vector */
-static struct {
-	struct iface *iface;
-} vif_list[MAXVIFS];
-
-static int mroute4_add_vif(struct iface *iface);
+static struct loader_job loader_ring[LOADER_RING_SIZE];
+static unsigned int loader_head;	/* control thread enqueues */
+static unsigned int loader_tail;	/* pool threads dequeue */
+static unsigned int loader_busy;	/* jobs claimed, not yet programmed */
+static unsigned int loader_fail;
 
-#ifdef HAVE_IPV6_MULTICAST_ROUTING
-/* IPv6 internal virtual interfaces (VIF) descriptor vector */
-static struct mif {
-	struct iface *iface;
-} mif_list[MAXMIFS];
+static pthread_mutex_t loader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  loader_work  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  loader_idle  = PTHREAD_COND_INITIALIZER;
 
-static int mroute6_add_mif(struct iface *iface);
-#endif
+static pthread_t loader_thread[LOADER_THREADS_MAX];
+static int loader_num = 0;		/* pool threads running */
+static int loader_active = 0;		/* accepting jobs */
 
-/* Check for kernel IGMPMSG_NOCACHE for (*,G) hits. I.e., source-less routes. */
-static void handle_nocache4(int sd, void *arg)
+static void *loader_loop(void *arg)
 {
-	int result;
-	char tmp[128];
-	struct ip *ip;
-	struct igmpmsg *igmpctl;
-
 	(void)arg;
-	memset(tmp, 0, sizeof(tmp));
-	result = read(sd, tmp, sizeof(tmp));
-	if (result < 0) {
-		smclog(LOG_WARNING, "Failed reading IGMP message from kernel: %s", strerror(errno));
-		return;
-	}
-
-	/* packets sent up from kernel to daemon have ip->ip_p = 0 */
-	ip = (struct ip *)tmp;
-	igmpctl = (struct igmpmsg *)tmp;
-
-	/* Check for IGMPMSG_NOCACHE to do (*,G) based routing. */
-	if (ip->ip_p == 0 && igmpctl->im_msgtype == IGMPMSG_NOCACHE) {
-		struct iface *iface;
-		struct mroute mrt;
-		struct mroute4 mroute;
-		char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
-
-		memset(&mroute, 0, sizeof(mroute));
-		mroute.group.s_addr  = igmpctl->im_dst.s_addr;
-		mroute.source.s_addr = igmpctl->im_src.s_addr;
-		mroute.inbound       = igmpctl->im_vif;
+	pthread_mutex_lock(&loader_mutex);
+	while (1) {
+		struct loader_job job;
 
-		inet_ntop(AF_INET, &mroute.group,  group,  INET_ADDRSTRLEN);
-		inet_ntop(AF_INET, &mroute.source, origin, INET_ADDRSTRLEN);
-		smclog(LOG_DEBUG, "New multicast data from %s to group %s on VIF %d", origin, group, mroute.inbound);
+		while (loader_head == loader_tail && loader_active)
+			pthread_cond_wait(&loader_work, &loader_mutex);
+		if (loader_head == loader_tail)
+			break;	/* drained and told to stop */
 
-		iface = iface_find_by_vif(mroute.inbound);
-		if (!iface) {
-			smclog(LOG_WARNING, "No matching interface for VIF %d, cannot add mroute.", mroute.inbound);
-			return;
-		}
+		job = loader_ring[loader_tail & (LOADER_RING_SIZE - 1)];
+		loader_tail++;
+		loader_busy++;
+		pthread_mutex_unlock(&loader_mutex);
 
-		/* Find any matching route for this group on that iif. */
-		result = mroute4_dyn_add(&mroute);
-		if (result) {
-			/*
-			 * This is a common error, the router receives streams it is not
-			 * set up to route -- we ignore these by default, but if the user
-			 * sets a more permissive log level we help out by showing what
-			 * is going on.
-			 */
-			if (ENOENT == errno)
-				smclog(LOG_INFO, "Multicast from %s, group %s, on %s does not match any (*,G) rule",
-				       origin, group, iface->name);
-			return;
-		}
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+		if (job.af == AF_INET6) {
+			if (setsockopt(job.sd, IPPROTO_IPV6, MRT6_ADD_MFC, &job.u.mc6, sizeof(job.u.mc6)))
+				loader_fail++;	/* racy inc, good enough for a tally */
+		} else
+#endif
+		if (setsockopt(job.sd, IPPROTO_IP, MRT_ADD_MFC, &job.u.mc4, sizeof(job.u.mc4)))
+			loader_fail++;	/* racy inc, good enough for a tally */
 
-		mrt.version = 4;
-		mrt.u.mroute4 = mroute;
-		script_exec(&mrt);
+		pthread_mutex_lock(&loader_mutex);
+		loader_busy--;
+		pthread_cond_broadcast(&loader_idle);
 	}
+	pthread_mutex_unlock(&loader_mutex);
+
+	return NULL;
 }
 
-static void cache_flush(void *arg)
+/* Claim the next free ring slot, blocks while the ring is full */
+static struct loader_job *loader_claim(void)
 {
-	(void)arg;
+	pthread_mutex_lock(&loader_mutex);
+	while (loader_head - loader_tail >= LOADER_RING_SIZE)
+		pthread_cond_wait(&loader_idle, &loader_mutex);
 
-	smclog(LOG_INFO, "Cache timeout, flushing unused (*,G) routes!");
-	mroute4_dyn_expire(cache_timeout);
+	return &loader_ring[loader_head & (LOADER_RING_SIZE - 1)];
 }
 
-/**
- * mroute4_enable - Initialise IPv4 multicast routing
- *
- * Setup the kernel IPv4 multicast routing API and lock the multicast
- * routing socket to this program (only!).
- *
- * Returns:
- * POSIX OK(0) on success, non-zero on error with @errno set.
- */
-int mroute4_enable(int do_vifs, int table_id, int timeout)
+static void loader_commit(void)
 {
-	int arg = 1;
-	struct iface *iface;
-	static int running = 0;
+	loader_head++;
+	pthread_cond_signal(&loader_work);
+	pthread_mutex_unlock(&loader_mutex);
+}
 
-	mroute4_socket = socket_create(AF_INET, SOCK_RAW, IPPROTO_IGMP, handle_nocache4, NULL);
-	if (mroute4_socket < 0) {
-		if (ENOPROTOOPT == errno)
-			smclog(LOG_WARNING, "Kernel does not even support IGMP, skipping ...");
+/* Queue one MRT_ADD_MFC for the pool, or -1 when no pool is running */
+static int loader_queue4(int sd, struct mroute4 *route)
+{
+	struct loader_job *job;
 
+	if (!loader_num)
 		return -1;
-	}
-
-#ifdef MRT_TABLE /* Currently only available on Linux  */
-	if (table_id != 0) {
-		smclog(LOG_INFO, "Setting IPv4 multicast routing table id %d", table_id);
-		if (setsockopt(mroute4_socket, IPPROTO_IP, MRT_TABLE, &table_id, sizeof(table_id)) < 0) {
-			smclog(LOG_ERR, "Cannot set IPv4 multicast routing table id: %s", strerror(errno));
-			smclog(LOG_ERR, "Make sure your kernel has CONFIG_IP_MROUTE_MULTIPLE_TABLES=y");
-			goto error;
-		}
-	}
-#else
-	(void)table_id;
-#endif
-
-	if (setsockopt(mroute4_socket, IPPROTO_IP, MRT_INIT, (void *)&arg, sizeof(arg))) {
-		switch (errno) {
-		case EADDRINUSE:
-			smclog(LOG_ERR, "IPv4 multicast routing API already in use: %s", strerror(errno));
-			break;
-
-		case EOPNOTSUPP:
-			smclog(LOG_ERR, "Kernel does not support IPv4 multicast routing, skipping ...");
-			break;
-
-		default:
-			smclog(LOG_ERR, "Failed initializing IPv4 multicast routing API: %s", strerror(errno));
-			break;
-		}
 
-		goto error;
-	}
+	job = loader_claim();
+	job->sd = sd;
+	job->af = AF_INET;
+	memset(&job->u.mc4, 0, sizeof(job->u.mc4));
+	job->u.mc4.mfcc_origin = route->source;
+	job->u.mc4.mfcc_mcastgrp = route->group;
+	job->u.mc4.mfcc_parent = route->inbound;
+	memcpy(job->u.mc4.mfcc_ttls, route->ttl, NELEMS(job->u.mc4.mfcc_ttls) * sizeof(job->u.mc4.mfcc_ttls[0]));
+	loader_commit();
 
-	/* Initialize virtual interface table */
-	memset(&vif_list, 0, sizeof(vif_list));
+	return 0;
+}
 
-	/* Create virtual interfaces (VIFs) for all non-loopback interfaces supporting multicast */
-	if (do_vifs) {
-		for (iface = iface_iterator(1); iface; iface = iface_iterator(0))
-			mroute4_add_vif(iface);
-	}
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+/* IPv6 counterpart of loader_queue4() */
+static int loader_queue6(int sd, struct mroute6 *route)
+{
+	struct loader_job *job;
+	size_t i;
 
-	LIST_INIT(&mroute4_conf_list);
-	LIST_INIT(&mroute4_dyn_list);
-	LIST_INIT(&mroute4_static_list);
+	if (!loader_num)
+		return -1;
 
-	if (timeout && !running) {
-		running++;
-		cache_timeout = timeout;
-		timer_add(timeout, cache_flush, NULL);
+	job = loader_claim();
+	job->sd = sd;
+	job->af = AF_INET6;
+	memset(&job->u.mc6, 0, sizeof(job->u.mc6));
+	job->u.mc6.mf6cc_origin   = route->source;
+	job->u.mc6.mf6cc_mcastgrp = route->group;
+	job->u.mc6.mf6cc_parent   = route->inbound;
+	for (i = 0; i < NELEMS(route->ttl); i++) {
+		if (route->ttl[i] > 0)
+			IF_SET(i, &job->u.mc6.mf6cc_ifset);
 	}
+	loader_commit();
 
 	return 0;
-error:
-	socket_close(mroute4_socket);
-	mroute4_socket = -1;
+}
+#endif
 
-	return -1;
+/* Wait for all queued adds to hit the kernel, pool stays running */
+static void loader_drain(void)
+{
+	if (!loader_num)
+		return;
+
+	pthread_mutex_lock(&loader_mutex);
+	while (loader_head != loader_tail || loader_busy)
+		pthread_cond_wait(&loader_idle, &loader_mutex);
+	pthread_mutex_unlock(&loader_mutex);
 }
 
-/**
- * mroute4_disable - Disable IPv4 multicast routing
- *
- * Disable IPv4 multicast routing and release kernel routing socket.
- */
-void mroute4_disable(void)
+static void loader_start(void)
 {
-	struct mroute4 *entry, *tmp;
+	long num, i;
 
-	if (mroute4_socket < 0)
+	if (loader_num)
 		return;
 
-	/* Drop all kernel routes set by smcroute */
-	if (setsockopt(mroute4_socket, IPPROTO_IP, MRT_DONE, NULL, 0))
-		smclog(LOG_WARNING, "Failed shutting down IPv4 multicast routing socket: %s", strerror(errno));
+	num = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num < 2)
+		return;		/* nothing to overlap with */
+	if (num > LOADER_THREADS_MAX)
+		num = LOADER_THREADS_MAX;
 
-	socket_close(mroute4_socket);
-	mroute4_socket = -1;
+	loader_head = loader_tail = 0;
+	loader_busy = loader_fail = 0;
+	loader_active = 1;
 
-	/* Free list of (*,G) routes on SIGHUP */
-	LIST_FOREACH_SAFE(entry, &mroute4_conf_list, link, tmp) {
-		LIST_REMOVE(entry, link);
-		free(entry);
-	}
-	LIST_FOREACH_SAFE(entry, &mroute4_dyn_list, link, tmp) {
-		LIST_REMOVE(entry, link);
-		free(entry);
-	}
-	LIST_FOREACH_SAFE(entry, &mroute4_static_list, link, tmp) {
-		LIST_REMOVE(entry, link);
-		free(entry);
+	for (i = 0; i < num; i++) {
+		if (pthread_create(&loader_thread[i], NULL, loader_loop, NULL))
+			break;
 	}
-}
 
+	loader_num = i;
+	if (!loader_num)
+		loader_active = 0;
+}
 
-/* Create a virtual interface from @iface so it can be used for IPv4 multicast routing. */
-static int mroute4_add_vif(struct iface *iface)
+static void loader_stop(void)
 {
-	struct vifctl vc;
-	int vif = -1;
-	size_t i;
+	int i;
 
-	if (mroute4_socket < 0)
-		return -1;
+	if (!loader_num)
+		return;
 
-	if ((iface->flags & IFF_MULTICAST) != IFF_MULTICAST) {
-		smclog(LOG_INFO, "Interface %s is not multicast capable, skipping VIF.", iface->name);
-		iface->vif = -1;
-		return 0;
-	}
+	pthread_mutex_lock(&loader_mutex);
+	loader_active = 0;
+	pthread_cond_broadcast(&loader_work);
+	pthread_mutex_unlock(&loader_mutex);
 
-	/* find a free vif */
-	for (i = 0; i < NELEMS(vif_list); i++) {
-		if (!vif_list[i].iface) {
-			vif = i;
-			break;
-		}
-	}
+	for (i = 0; i < loader_num; i++)
+		pthread_join(loader_thread[i], NULL);
+	loader_num = 0;
 
-	/* no more space */
-	if (vif == -1) {
-		errno = ENOMEM;
-		smclog(LOG_WARNING, "Kernel MAXVIFS (%d) too small for number of interfaces: %s", MAXVIFS, strerror(errno));
-		return 1;
+	if (loader_fail) {
+		stats.kern_add_fail += loader_fail;
+		smclog(LOG_WARNING, "%u multicast routes failed kernel install during bulk load",
+		       loader_fail);
+		loader_fail = 0;
 	}
+}
 
-	memset(&vc, 0, sizeof(vc));
-	vc.vifc_vifi = vif;
-	vc.vifc_flags = 0;      /* no tunnel, no source routing, register ? */
-	vc.vifc_threshold = iface->threshold;
-	vc.vifc_rate_limit = 0;	/* hopefully no limit */
-#ifdef VIFF_USE_IFINDEX		/* Register VIF using ifindex, not lcl_addr, since Linux 2.6.33 */
-	vc.vifc_flags |= VIFF_USE_IFINDEX;
-	vc.vifc_lcl_ifindex = iface->ifindex;
-#else
-	vc.vifc_lcl_addr.s_addr = iface->inaddr.s_addr;
+#else  /* no pthreads, bulk loads program the kernel inline */
+
+static int loader_queue4(int sd, struct mroute4 *route)
+{
+	(void)sd;
+	(void)route;
+	return -1;
+}
+
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+static int loader_queue6(int sd, struct mroute6 *route)
+{
+	(void)sd;
+	(void)route;
+	return -1;
+}
 #endif
-	vc.vifc_rmt_addr.s_addr = htonl(INADDR_ANY);
 
-	smclog(LOG_DEBUG, "Map iface %-16s => VIF %-2d ifindex %2d flags 0x%04x TTL threshold %u",
-	       iface->name, vc.vifc_vifi, iface->ifindex, vc.vifc_flags, iface->threshold);
+static void loader_drain(void)
+{
+}
 
-	if (setsockopt(mroute4_socket, IPPROTO_IP, MRT_ADD_VIF, (void *)&vc, sizeof(vc))) {
-		smclog(LOG_ERR, "Failed adding VIF for iface %s: %s", iface->name, strerror(errno));
-		iface->vif = -1;
-		return 1;
-	}
+static void loader_start(void)
+{
+}
 
-	iface->vif = vif;
-	vif_list[vif].iface = iface;
+static void loader_stop(void)
+{
+}
+#endif /* HAVE_PTHREAD */
 
-	if (iface->mrdisc)
-		return mrdisc_register(iface->name, vif);
+static void hash_init4(void)
+{
+	size_t i;
 
-	return 0;
+	for (i = 0; i < NELEMS(t4->sg_hash); i++)
+		LIST_INIT(&t4->sg_hash[i]);
+	for (i = 0; i < NELEMS(t4->conf_hash); i++)
+		LIST_INIT(&t4->conf_hash[i]);
+	memset(t4->len_cnt, 0, sizeof(t4->len_cnt));
 }
 
-static int mroute4_del_vif(struct iface *iface)
+static void hash_add4(struct mroute4 *entry)
 {
-	int ret;
-	int16_t vif = iface->vif;
+	unsigned int hash = hash_sg4(entry->source, entry->group);
 
-	if (mroute4_socket < 0)
-		return -1;
+	LIST_INSERT_HEAD(&t4->sg_hash[hash], entry, hlink);
+}
 
-	if (-1 == vif)
-		return 0;	/* No VIF setup for iface, skip */
+static struct mroute4 *hash_find4(struct mroute4 *route)
+{
+	unsigned int hash = hash_sg4(route->source, route->group);
+	struct mroute4 *entry, *dyn = NULL;
 
-	smclog(LOG_DEBUG, "Removing  %-16s => VIF %-2d", iface->name, vif);
+	LIST_FOREACH(entry, &t4->sg_hash[hash], hlink) {
+		if (!is_exact_match4(entry, route))
+			continue;
 
-#ifdef __linux__
-	struct vifctl vc = { .vifc_vifi = vif };
-	ret = setsockopt(mroute4_socket, IPPROTO_IP, MRT_DEL_VIF, (void *)&vc, sizeof(vc));
-#else
-	ret = setsockopt(mroute4_socket, IPPROTO_IP, MRT_DEL_VIF, (void *)&vif, sizeof(vif));
-#endif
-	if (ret)
-		smclog(LOG_ERR, "Failed deleting VIF for iface %s: %s", iface->name, strerror(errno));
-	else
-		iface->vif = -1;
+		/* Prefer static routes, they shadow learned (S,G) */
+		if (!entry->dyn)
+			return entry;
 
-	if (iface->mrdisc)
-		return mrdisc_deregister(vif);
+		dyn = entry;
+	}
 
-	return 0;
+	return dyn;
 }
 
-/* Actually set in kernel - called by mroute4_add() and mroute4_check_add() */
-static int kern_add4(struct mroute4 *route, int active)
+/*
+ * Per-VIF reverse index over the kernel-programmed (S,G) entries: each
+ * entry sits in the list of its inbound VIF and of every VIF in its
+ * oifs bitmask, linked through the matching vlink[] slot.  Interface
+ * flap fan-out walks only the routes actually referencing the VIF,
+ * instead of testing the ttl[] vector of every route in the table.
+ * The (*,G) rules are templates, not kernel entries, and stay out.
+ */
+static uint32_t oifs_mask4(struct mroute4 *route)
 {
-	char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
-	struct mfcctl mc;
+	uint32_t mask = 0;
+	size_t i;
 
-	if (mroute4_socket < 0)
-		return -1;
+	for (i = 0; i < NELEMS(route->ttl); i++) {
+		if (route->ttl[i])
+			mask |= 1u << i;
+	}
 
-	memset(&mc, 0, sizeof(mc));
+	return mask;
+}
 
-	mc.mfcc_origin = route->source;
-	mc.mfcc_mcastgrp = route->group;
-	mc.mfcc_parent = route->inbound;
+/* All VIFs referenced by @route, inbound and outbound */
+static uint32_t vif_refs4(struct mroute4 *route)
+{
+	uint32_t refs = route->oifs;
 
-	/* copy the TTL vector */
-	if (sizeof(mc.mfcc_ttls[0]) != sizeof(route->ttl[0]) || NELEMS(mc.mfcc_ttls) != NELEMS(route->ttl)) {
-		smclog(LOG_ERR, "Critical data type validation error in %s!", __FILE__);
-		exit(255);
-	}
+	if (route->inbound >= 0 && route->inbound < MAX_MC_VIFS)
+		refs |= 1u << route->inbound;
 
-	memcpy(mc.mfcc_ttls, route->ttl, NELEMS(mc.mfcc_ttls) * sizeof(mc.mfcc_ttls[0]));
-	if (setsockopt(mroute4_socket, IPPROTO_IP, MRT_ADD_MFC, &mc, sizeof(mc))) {
-		smclog(LOG_WARNING, "failed adding IPv4 multicast route: %s", strerror(errno));
-		return 1;
+	return refs;
+}
+
+static void vif_index_add4(struct mroute4 *route)
+{
+	uint32_t refs;
+	int vif;
+
+	route->oifs = oifs_mask4(route);
+	refs = vif_refs4(route);
+	for (vif = 0; refs; vif++, refs >>= 1) {
+		if (refs & 1)
+			LIST_INSERT_HEAD(&t4->vif_list[vif].routes, route, vlink[vif]);
 	}
+}
 
-	if (active) {
-		smclog(LOG_DEBUG, "Add %s -> %s from VIF %d",
-		       inet_ntop(AF_INET, &mc.mfcc_origin,   origin, INET_ADDRSTRLEN),
-		       inet_ntop(AF_INET, &mc.mfcc_mcastgrp, group,  INET_ADDRSTRLEN), mc.mfcc_parent);
+static void vif_index_del4(struct mroute4 *route)
+{
+	uint32_t refs = vif_refs4(route);
+	int vif;
 
-		/* Only enable mrdisc for active routes, i.e. with outbound */
-		mrdisc_enable(route->inbound);
+	for (vif = 0; refs; vif++, refs >>= 1) {
+		if (refs & 1)
+			LIST_REMOVE(route, vlink[vif]);
 	}
+}
 
-	return 0;
+/* Outbound set rewritten, e.g. (*,G) template change: relink.  The
+ * unlink still sees the old oifs, only vif_index_add4() rewrites it. */
+static void vif_index_update4(struct mroute4 *route)
+{
+	vif_index_del4(route);
+	vif_index_add4(route);
 }
 
-/* Actually remove from kernel - called by mroute4_del() */
-static int kern_del4(struct mroute4 *route, int active)
+/*
+ * Event stream hooks for `smcroutectl monitor`: one compact record
+ * per kernel route install/remove and VIF change, instead of a fork
+ * per event like the script.  No-ops without subscribers.
+ */
+static void route4_event(uint8_t type, struct mroute4 *route)
 {
-	char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
-	struct mfcctl mc;
+	struct event_msg ev;
 
-	if (mroute4_socket < 0)
-		return -1;
+	memset(&ev, 0, sizeof(ev));
+	ev.len    = sizeof(ev);
+	ev.type   = type;
+	ev.table  = t4->id;
+	ev.source = route->source.s_addr;
+	ev.group  = route->group.s_addr;
 
-	memset(&mc, 0, sizeof(mc));
-	mc.mfcc_origin = route->source;
-	mc.mfcc_mcastgrp = route->group;
-	if (setsockopt(mroute4_socket, IPPROTO_IP, MRT_DEL_MFC, &mc, sizeof(mc))) {
-		if (ENOENT == errno)
-			smclog(LOG_DEBUG, "failed removing multicast route, does not exist.");
-		else
-			smclog(LOG_DEBUG, "failed removing IPv4 multicast route: %s", strerror(errno));
-		return 1;
-	}
+	ipc_event(&ev, ev.len);
+}
 
-	if (active) {
-		smclog(LOG_DEBUG, "Del %s -> %s",
-		       inet_ntop(AF_INET, &mc.mfcc_origin,  origin, INET_ADDRSTRLEN),
-		       inet_ntop(AF_INET, &mc.mfcc_mcastgrp, group, INET_ADDRSTRLEN));
+static void vif_event(uint8_t type, char *ifname)
+{
+	char buf[sizeof(struct event_msg) + IFNAMSIZ + 1];
+	struct event_msg *ev = (struct event_msg *)buf;
 
-		/* Only disable mrdisc for active routes. */
-		mrdisc_disable(route->inbound);
-	}
+	memset(buf, 0, sizeof(buf));
+	ev->type = type;
+	ev->len  = sizeof(*ev) + strlcpy(ev->ifname, ifname, IFNAMSIZ + 1) + 1;
 
-	return 0;
+	ipc_event(ev, ev->len);
 }
 
-/*
- * Used for exact (S,G) matching
- */
-static int is_exact_match4(struct mroute4 *a, struct mroute4 *b)
+/* Group address mask for a (*,G/len) rule, len 0 means exact group */
+static uint32_t group_mask4(short len)
 {
-	if (a->source.s_addr == b->source.s_addr &&
-	    a->group.s_addr  == b->group.s_addr  &&
-	    a->len           == b->len &&
-	    a->inbound       == b->inbound)
-		return 1;
+	if (len <= 0 || len >= 32)
+		return htonl(0xFFFFFFFFu);
 
-	return 0;
+	return htonl(0xFFFFFFFFu << (32 - len));
+}
+
+static void conf_hash_add4(struct mroute4 *entry)
+{
+	struct in_addr masked;
+
+	masked.s_addr = entry->group.s_addr & group_mask4(entry->len);
+	LIST_INSERT_HEAD(&t4->conf_hash[hash_sg4(entry->source, masked)], entry, hlink);
+	t4->len_cnt[entry->len > 0 ? entry->len : 32]++;
+}
+
+static void conf_hash_del4(struct mroute4 *entry)
+{
+	LIST_REMOVE(entry, hlink);
+	t4->len_cnt[entry->len > 0 ? entry->len : 32]--;
+}
+
+/* Exact rule lookup, used by .conf load and reload dedup */
+static struct mroute4 *conf_hash_find4(struct mroute4 *route)
+{
+	struct mroute4 *entry;
+	struct in_addr masked;
+
+	masked.s_addr = route->group.s_addr & group_mask4(route->len);
+	LIST_FOREACH(entry, &t4->conf_hash[hash_sg4(route->source, masked)], hlink) {
+		if (entry->group.s_addr == route->group.s_addr &&
+		    entry->len           == route->len          &&
+		    entry->inbound       == route->inbound)
+			return entry;
+	}
+
+	return NULL;
 }
 
 /*
- * Used for (*,G) matches
- *
- * The incoming candidate is compared to the configured rule, e.g.
- * does 225.1.2.3 fall inside 225.0.0.0/8?  => Yes
- * does 225.1.2.3 fall inside 225.0.0.0/15? => Yes
- * does 225.1.2.3 fall inside 225.0.0.0/16? => No
+ * Longest-prefix-match for a NOCACHE candidate: one hash probe per
+ * prefix length in use, longest first, so exact rules always win over
+ * covering prefix rules.
  */
-static int is_match4(struct mroute4 *rule, struct mroute4 *cand)
+static struct mroute4 *conf_match_find4(struct mroute4 *cand)
 {
-	uint32_t g1, g2, mask;
+	struct in_addr any = { 0 }, masked;
+	struct mroute4 *entry;
+	int len;
 
-	if (rule->inbound != cand->inbound)
-		return 0;
+	for (len = 32; len > 0; len--) {
+		if (!t4->len_cnt[len])
+			continue;
 
-	if (rule->len > 0)
-		mask = 0xFFFFFFFFu << (32 - rule->len);
-	else
-		mask = 0xFFFFFFFFu;
-	mask = htonl(mask);
-	g1 = rule->group.s_addr & mask;
-	g2 = cand->group.s_addr & mask;
+		masked.s_addr = cand->group.s_addr & group_mask4(len);
+		LIST_FOREACH(entry, &t4->conf_hash[hash_sg4(any, masked)], hlink) {
+			if ((entry->len > 0 ? entry->len : 32) != len)
+				continue;
 
-	return g1 == g2;
+			if (is_match4(entry, cand))
+				return entry;
+		}
+	}
+
+	return NULL;
 }
 
-/**
- * mroute4_dyn_add - Add route to kernel if it matches a known (*,G) route.
- * @route: Pointer to candidate struct mroute4 IPv4 multicast route
- *
- * Returns:
- * POSIX OK(0) on success, non-zero on error with @errno set.
+/*
+ * Read-only copy of the (*,G/len) rule table for the upcall worker
+ * thread.  The control thread rebuilds and atomically publishes a new
+ * snapshot whenever the rules change; the worker picks it up at the
+ * start of each drain batch and acknowledges the generation it runs
+ * on, after which older snapshots can be reclaimed.  Matching uses the
+ * same hash-per-prefix-length probing as conf_match_find4(), but over
+ * index chains in one flat allocation.
  */
-int mroute4_dyn_add(struct mroute4 *route)
+struct conf4_snap {
+	struct conf4_snap *next;	/* retired snapshot chain */
+	unsigned int gen;
+	int len_cnt[33];
+	int head[MROUTE4_HASH_SIZE];
+	struct conf4_rule {
+		struct mroute4 r;
+		int next;
+	} rule[];
+};
+
+static unsigned int snap_gen;
+
+/* Set when the worker thread owns the kernel upcall sockets */
+static int upcall_worker = 0;
+
+static void conf4_snap_update(void)
 {
-	struct mroute4 *entry, *new_entry;
-	int ret;
+	struct conf4_snap *snap, *old, **prev;
+	struct mroute4 *entry;
+	unsigned int seen;
+	size_t num = 0, i;
 
-	LIST_FOREACH(entry, &mroute4_conf_list, link) {
-		/* Find matching (*,G) ... and interface. */
-		if (!is_match4(entry, route))
-			continue;
+	/* Only the default table is served by the worker thread */
+	if (!upcall_worker || !t4 || t4 != table4_default)
+		return;
 
-		/* Use configured template (*,G) outbound interfaces. */
-		memcpy(route->ttl, entry->ttl, NELEMS(route->ttl) * sizeof(route->ttl[0]));
-		break;
+	LIST_FOREACH(entry, &t4->conf_list, link)
+		num++;
+
+	snap = malloc(sizeof(*snap) + num * sizeof(snap->rule[0]));
+	if (!snap)
+		return;		/* worker keeps matching the old rules */
+
+	memset(snap->len_cnt, 0, sizeof(snap->len_cnt));
+	for (i = 0; i < NELEMS(snap->head); i++)
+		snap->head[i] = -1;
+
+	i = 0;
+	LIST_FOREACH(entry, &t4->conf_list, link) {
+		struct in_addr masked;
+		unsigned int hash;
+
+		masked.s_addr = entry->group.s_addr & group_mask4(entry->len);
+		hash = hash_sg4(entry->source, masked);
+
+		snap->rule[i].r    = *entry;
+		snap->rule[i].next = snap->head[hash];
+		snap->head[hash]   = i;
+		snap->len_cnt[entry->len > 0 ? entry->len : 32]++;
+		i++;
 	}
+	snap->gen  = ++snap_gen;
+	snap->next = NULL;
 
-	if (!entry) {
-		/*
-		 * No match, add entry without outbound interfaces
-		 * nevertheless to avoid continuous cache misses from
-		 * the kernel. Note that this still gets reported as an
-		 * error (ENOENT) below.
-		 */
-		memset(route->ttl, 0, NELEMS(route->ttl) * sizeof(route->ttl[0]));
+	old = t4->snap;
+	__atomic_store_n(&t4->snap, snap, __ATOMIC_RELEASE);
+
+	/* Retire the old snapshot, reclaim those the worker is done with */
+	if (old) {
+		old->next = t4->retired;
+		t4->retired = old;
+	}
+	seen = __atomic_load_n(&t4->snap_seen, __ATOMIC_ACQUIRE);
+	prev = &t4->retired;
+	while (*prev) {
+		if ((*prev)->gen < seen) {
+			old = *prev;
+			*prev = old->next;
+			free(old);
+		} else
+			prev = &(*prev)->next;
 	}
+}
 
-	ret = kern_add4(route, entry ? 1 : 0);
-	if (ret)
-		return ret;
+static void conf4_snap_exit(struct mrt4_table *tbl)
+{
+	struct conf4_snap *snap;
 
-	/*
-	 * Add to list of dynamically added routes. Necessary if the user
-	 * removes the (*,G) using the command line interface rather than
-	 * updating the conf file and SIGHUP. Note: if we fail to alloc()
-	 * memory we don't do anything, just add kernel route silently.
-	 */
-	new_entry = malloc(sizeof(struct mroute4));
-	if (new_entry) {
-		memcpy(new_entry, route, sizeof(struct mroute4));
-		LIST_INSERT_HEAD(&mroute4_dyn_list, new_entry, link);
+	while ((snap = tbl->retired)) {
+		tbl->retired = snap->next;
+		free(snap);
 	}
+	free(tbl->snap);
+	tbl->snap = NULL;
+	tbl->snap_seen = 0;
+}
 
-	/* Signal to cache handler we've added a stop filter */
-	if (!entry) {
-		errno = ENOENT;
-		return -1;
+/* Worker thread variant of conf_match_find4(), probes @snap only */
+static struct mroute4 *snap_match4(struct conf4_snap *snap, struct mroute4 *cand)
+{
+	struct in_addr any = { 0 }, masked;
+	int len, i;
+
+	for (len = 32; len > 0; len--) {
+		if (!snap->len_cnt[len])
+			continue;
+
+		masked.s_addr = cand->group.s_addr & group_mask4(len);
+		for (i = snap->head[hash_sg4(any, masked)]; i != -1; i = snap->rule[i].next) {
+			struct mroute4 *entry = &snap->rule[i].r;
+
+			if ((entry->len > 0 ? entry->len : 32) != len)
+				continue;
+
+			if (is_match4(entry, cand))
+				return entry;
+		}
 	}
 
-	return 0;
+	return NULL;
 }
 
-/* 
- * Query kernel for install MFC entry usage statistics
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+/*
+ * Raw ICMPv6 socket used as interface for the IPv6 mrouted API.
+ * Receives MLD packets and upcall messages from the kenrel.
  */
-static int get_stats4(struct mroute4 *route, unsigned long *pktcnt, unsigned long *bytecnt, unsigned long *wrong_if)
-{
-	struct sioc_sg_req sg_req;
+static int mroute6_socket = -1;
 
-	if (mroute4_socket < 0)
-		return -1;
+/*
+ * IPv6 counterparts of the IPv4 lists above: configured (*,G) rules
+ * matched on-demand, (S,G) routes learned from them, and regular
+ * static routes.
+ */
+LIST_HEAD(, mroute6) mroute6_conf_list = LIST_HEAD_INITIALIZER();
+LIST_HEAD(, mroute6) mroute6_dyn_list = LIST_HEAD_INITIALIZER();
+LIST_HEAD(, mroute6) mroute6_static_list = LIST_HEAD_INITIALIZER();
 
-	memset(&sg_req, 0, sizeof(sg_req));
-	sg_req.src = route->source;
-	sg_req.grp = route->group;
+/*
+ * Hash indexes over exact (S,G) entries and (*,G) conf rules.  IPv6
+ * has no GROUP/LEN prefix rules, so an exact group hash covers the
+ * whole NOCACHE match path, no linear rule scan needed.
+ */
+#define MROUTE6_HASH_SIZE 1024
 
-	if (ioctl(mroute4_socket, SIOCGETSGCNT, &sg_req) < 0) {
-		if (wrong_if)
-			smclog(LOG_WARNING, "Failed getting MFC stats: %s", strerror(errno));
-		return errno;
-	}
+static LIST_HEAD(, mroute6) mroute6_sg_hash[MROUTE6_HASH_SIZE];
+static LIST_HEAD(, mroute6) mroute6_conf_hash[MROUTE6_HASH_SIZE];
 
-	if (pktcnt)
-		*pktcnt = sg_req.pktcnt;
-	if (bytecnt)
-		*bytecnt = sg_req.bytecnt;
-	if (wrong_if)
-		*wrong_if = sg_req.wrong_if;
+static struct pool mroute6_pool;
 
-	return 0;
+static unsigned int hash_addr6(const struct in6_addr *addr)
+{
+	uint32_t w[4], hash;
+
+	memcpy(w, addr->s6_addr, sizeof(w));
+	hash = w[0] ^ w[1] ^ w[2] ^ w[3];
+	hash ^= hash >> 16;
+	hash ^= hash >> 8;
+
+	return hash % MROUTE6_HASH_SIZE;
 }
 
-static int is_active4(struct mroute4 *route)
+static unsigned int hash_sg6(struct mroute6 *route)
 {
-	size_t i;
+	return (hash_addr6(&route->source.sin6_addr) ^
+		hash_addr6(&route->group.sin6_addr)) % MROUTE6_HASH_SIZE;
+}
 
-	for (i = 0; i < NELEMS(route->ttl); i++) {
-		if (route->ttl[i])
-			return 1;
-	}
+/*
+ * Used for exact (S,G) matching
+ */
+static int is_exact_match6(struct mroute6 *a, struct mroute6 *b)
+{
+	if (!memcmp(&a->source.sin6_addr, &b->source.sin6_addr, sizeof(a->source.sin6_addr)) &&
+	    !memcmp(&a->group.sin6_addr,  &b->group.sin6_addr,  sizeof(a->group.sin6_addr))  &&
+	    a->inbound == b->inbound)
+		return 1;
 
 	return 0;
 }
 
 /*
- * Get valid packet usage statistics (i.e. number of actually forwarded
- * packets) from the kernel for an installed MFC entry
+ * Used for (*,G) matches, exact group + inbound interface
  */
-static unsigned long get_valid_pkt4(struct mroute4 *route)
+static int is_match6(struct mroute6 *rule, struct mroute6 *cand)
 {
-	unsigned long pktcnt = 0, wrong_if = 0;
-
-	if (get_stats4(route, &pktcnt, NULL, &wrong_if) < 0)
+	if (rule->inbound != cand->inbound)
 		return 0;
 
-	return pktcnt - wrong_if;
+	return !memcmp(&rule->group.sin6_addr, &cand->group.sin6_addr, sizeof(rule->group.sin6_addr));
 }
 
-/**
- * mroute4_dyn_expire - Expire dynamically added (*,G) routes
- * @max_idle: Timeout for routes in seconds, 0 to expire all dynamic routes
- *
- * This function flushes all (*,G) routes which haven't been used (i.e. no
- * packets matching them have been forwarded) in the last max_idle seconds.
- * It is called periodically on cache-timeout or on request of smcroutectl.
- * The latter is useful in case of topology changes (e.g. VRRP fail-over)
- * or similar.
- */
-void mroute4_dyn_expire(int max_idle)
+static int is_active6(struct mroute6 *route)
 {
-	struct mroute4 *entry, *tmp;
-	struct timespec now;
+	return route->oifs != 0;
+}
 
-	clock_gettime(CLOCK_MONOTONIC, &now);
+static void hash_init6(void)
+{
+	size_t i;
 
-	LIST_FOREACH_SAFE(entry, &mroute4_dyn_list, link, tmp) {
-		if (!entry->last_use) {
-			/* New entry */
-			entry->last_use = now.tv_sec;
-			entry->valid_pkt = get_valid_pkt4(entry);
-		}
+	for (i = 0; i < NELEMS(mroute6_sg_hash); i++)
+		LIST_INIT(&mroute6_sg_hash[i]);
+	for (i = 0; i < NELEMS(mroute6_conf_hash); i++)
+		LIST_INIT(&mroute6_conf_hash[i]);
+}
+
+static void hash_add6(struct mroute6 *entry)
+{
+	LIST_INSERT_HEAD(&mroute6_sg_hash[hash_sg6(entry)], entry, hlink);
+}
 
-		if (entry->last_use + max_idle <= now.tv_sec) {
-			unsigned long valid_pkt;
+static struct mroute6 *hash_find6(struct mroute6 *route)
+{
+	struct mroute6 *entry, *dyn = NULL;
 
-			valid_pkt = get_valid_pkt4(entry);
-			if (valid_pkt != entry->valid_pkt) {
-				/* Used since last check, update */
-				entry->last_use = now.tv_sec;
-				entry->valid_pkt = valid_pkt;
-				continue;
-			}
+	LIST_FOREACH(entry, &mroute6_sg_hash[hash_sg6(route)], hlink) {
+		if (!is_exact_match6(entry, route))
+			continue;
 
-			/* Not used, expire */
-			kern_del4(entry, is_active4(entry));
-			LIST_REMOVE(entry, link);
-			free(entry);
-		}
+		/* Prefer static routes, they shadow learned (S,G) */
+		if (!entry->dyn)
+			return entry;
+
+		dyn = entry;
 	}
+
+	return dyn;
 }
 
-static int mroute4_exists(struct mroute4 *route)
+static void conf_hash_add6(struct mroute6 *entry)
 {
-	struct mroute4 *entry;
+	LIST_INSERT_HEAD(&mroute6_conf_hash[hash_addr6(&entry->group.sin6_addr)], entry, hlink);
+}
 
-	LIST_FOREACH(entry, &mroute4_conf_list, link) {
-		if (is_match4(entry, route)) {
-			smclog(LOG_INFO, "(*,G) route already exists");
-			return 1;
-		}
-	}
-	LIST_FOREACH(entry, &mroute4_static_list, link) {
-		if (is_exact_match4(entry, route)) {
-			smclog(LOG_INFO, "Static route already exists");
-			return 1;
-		}
+/* Rules are keyed on group only, @route may carry any source */
+static struct mroute6 *conf_hash_find6(struct mroute6 *route)
+{
+	struct mroute6 *entry;
+
+	LIST_FOREACH(entry, &mroute6_conf_hash[hash_addr6(&route->group.sin6_addr)], hlink) {
+		if (is_match6(entry, route))
+			return entry;
 	}
 
-	return 0;
+	return NULL;
 }
 
-/**
- * mroute4_add - Add route to kernel, or save a wildcard route for later use
+/*
+ * IPv6 rule snapshot for the upcall worker, see conf4_snap above.  No
+ * prefix rules here, so it is a plain exact-group hash over one flat
+ * allocation.
+ */
+struct conf6_snap {
+	struct conf6_snap *next;	/* retired snapshot chain */
+	unsigned int gen;
+	int head[MROUTE6_HASH_SIZE];
+	struct conf6_rule {
+		struct mroute6 r;
+		int next;
+	} rule[];
+};
+
+static struct conf6_snap *conf6_snap;	/* published for the worker */
+static struct conf6_snap *conf6_retired;
+static unsigned int snap6_seen;		/* last gen picked up by worker */
+
+static void conf6_snap_update(void)
+{
+	struct conf6_snap *snap, *old, **prev;
+	struct mroute6 *entry;
+	unsigned int seen;
+	size_t num = 0, i;
+
+	if (!upcall_worker)
+		return;
+
+	LIST_FOREACH(entry, &mroute6_conf_list, link)
+		num++;
+
+	snap = malloc(sizeof(*snap) + num * sizeof(snap->rule[0]));
+	if (!snap)
+		return;		/* worker keeps matching the old rules */
+
+	for (i = 0; i < NELEMS(snap->head); i++)
+		snap->head[i] = -1;
+
+	i = 0;
+	LIST_FOREACH(entry, &mroute6_conf_list, link) {
+		unsigned int hash = hash_addr6(&entry->group.sin6_addr);
+
+		snap->rule[i].r    = *entry;
+		snap->rule[i].next = snap->head[hash];
+		snap->head[hash]   = i;
+		i++;
+	}
+	snap->gen  = ++snap_gen;
+	snap->next = NULL;
+
+	old = conf6_snap;
+	__atomic_store_n(&conf6_snap, snap, __ATOMIC_RELEASE);
+
+	if (old) {
+		old->next = conf6_retired;
+		conf6_retired = old;
+	}
+	seen = __atomic_load_n(&snap6_seen, __ATOMIC_ACQUIRE);
+	prev = &conf6_retired;
+	while (*prev) {
+		if ((*prev)->gen < seen) {
+			old = *prev;
+			*prev = old->next;
+			free(old);
+		} else
+			prev = &(*prev)->next;
+	}
+}
+
+static void conf6_snap_exit(void)
+{
+	struct conf6_snap *snap;
+
+	while ((snap = conf6_retired)) {
+		conf6_retired = snap->next;
+		free(snap);
+	}
+	free(conf6_snap);
+	conf6_snap = NULL;
+	snap6_seen = 0;
+}
+
+/* Worker thread variant of conf_hash_find6(), probes @snap only */
+static struct mroute6 *snap_match6(struct conf6_snap *snap, struct mroute6 *cand)
+{
+	int i;
+
+	for (i = snap->head[hash_addr6(&cand->group.sin6_addr)]; i != -1; i = snap->rule[i].next) {
+		if (is_match6(&snap->rule[i].r, cand))
+			return &snap->rule[i].r;
+	}
+
+	return NULL;
+}
+#endif /* HAVE_IPV6_MULTICAST_ROUTING */
+
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+/* IPv6 internal virtual interfaces (VIF) descriptor vector */
+static struct mif {
+	struct iface *iface;
+	struct iface *stale;		/* previous owner, for flap rebuild */
+	LIST_HEAD(, mroute6) routes;	/* reverse index, see mlink[] */
+} mif_list[MAXMIFS];
+
+static int mroute6_add_mif(struct iface *iface);
+
+/* IPv6 counterparts of the oifs/reverse-index helpers above */
+static uint32_t oifs_mask6(struct mroute6 *route)
+{
+	uint32_t mask = 0;
+	size_t i;
+
+	for (i = 0; i < NELEMS(route->ttl); i++) {
+		if (route->ttl[i])
+			mask |= 1u << i;
+	}
+
+	return mask;
+}
+
+/* All MIFs referenced by @route, inbound and outbound */
+static uint32_t mif_refs6(struct mroute6 *route)
+{
+	uint32_t refs = route->oifs;
+
+	if (route->inbound >= 0 && route->inbound < MAX_MC_MIFS)
+		refs |= 1u << route->inbound;
+
+	return refs;
+}
+
+static void mif_index_add6(struct mroute6 *route)
+{
+	uint32_t refs;
+	int mif;
+
+	route->oifs = oifs_mask6(route);
+	refs = mif_refs6(route);
+	for (mif = 0; refs; mif++, refs >>= 1) {
+		if (refs & 1)
+			LIST_INSERT_HEAD(&mif_list[mif].routes, route, mlink[mif]);
+	}
+}
+
+static void mif_index_del6(struct mroute6 *route)
+{
+	uint32_t refs = mif_refs6(route);
+	int mif;
+
+	for (mif = 0; refs; mif++, refs >>= 1) {
+		if (refs & 1)
+			LIST_REMOVE(route, mlink[mif]);
+	}
+}
+
+/* Outbound set rewritten: relink, the unlink still sees the old oifs */
+static void mif_index_update6(struct mroute6 *route)
+{
+	mif_index_del6(route);
+	mif_index_add6(route);
+}
+#endif
+
+/* Max number of kernel upcalls drained per event loop wakeup */
+#define NOCACHE_BUDGET 100
+
+/* Process one IGMP message or kernel upcall from the mroute socket */
+static void nocache4_process(char *tmp)
+{
+	struct ip *ip;
+	struct igmpmsg *igmpctl;
+
+	/* packets sent up from kernel to daemon have ip->ip_p = 0 */
+	ip = (struct ip *)tmp;
+	igmpctl = (struct igmpmsg *)tmp;
+
+	/* Check for IGMPMSG_NOCACHE to do (*,G) based routing. */
+	if (ip->ip_p == 0 && igmpctl->im_msgtype == IGMPMSG_NOCACHE) {
+		struct iface *iface;
+		struct mroute mrt;
+		struct mroute4 mroute;
+		struct timespec t0, t1;
+		char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
+
+		stats.upcalls++;
+		memset(&mroute, 0, sizeof(mroute));
+		mroute.group.s_addr  = igmpctl->im_dst.s_addr;
+		mroute.source.s_addr = igmpctl->im_src.s_addr;
+		mroute.inbound       = igmpctl->im_vif;
+
+		inet_ntop(AF_INET, &mroute.group,  group,  INET_ADDRSTRLEN);
+		inet_ntop(AF_INET, &mroute.source, origin, INET_ADDRSTRLEN);
+		smclog(LOG_DEBUG, "New multicast data from %s to group %s on VIF %d", origin, group, mroute.inbound);
+
+		iface = iface_find_by_vif(mroute.inbound);
+		if (!iface) {
+			smclog(LOG_WARNING, "No matching interface for VIF %d, cannot add mroute.", mroute.inbound);
+			return;
+		}
+
+		/* Find any matching route for this group on that iif. */
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (mroute4_dyn_add(&mroute)) {
+			/*
+			 * This is a common error, the router receives streams it is not
+			 * set up to route -- we ignore these by default, but if the user
+			 * sets a more permissive log level we help out by showing what
+			 * is going on.  EEXIST is a duplicate upcall for an already
+			 * installed route, skipped silently.
+			 */
+			if (ENOENT == errno) {
+				stats.upcall_nomatch++;
+				smclog(LOG_INFO, "Multicast from %s, group %s, on %s does not match any (*,G) rule",
+				       origin, group, iface->name);
+			}
+			return;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		stats_lat_sample((uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + (t1.tv_nsec - t0.tv_nsec));
+
+		mrt.version = 4;
+		mrt.u.mroute4 = mroute;
+		script_exec(&mrt);
+	}
+}
+
+/* Check for kernel IGMPMSG_NOCACHE for (*,G) hits. I.e., source-less routes. */
+static void handle_nocache4(int sd, void *arg)
+{
+	struct mrt4_table *saved = t4;
+	int budget = NOCACHE_BUDGET;
+	char tmp[128];
+	ssize_t result;
+
+	/* Upcalls are matched against the rules of the table they came from */
+	t4 = arg;
+
+	/*
+	 * Drain the socket in a batch rather than one message per select
+	 * wakeup.  When a source farm comes online thousands of NOCACHE
+	 * upcalls queue up and overflow the socket buffer, losing routes.
+	 * Duplicate (S,G) within the batch are rejected by the hash check
+	 * in mroute4_dyn_add().
+	 */
+	while (budget-- > 0) {
+		memset(tmp, 0, sizeof(tmp));
+		result = recv(sd, tmp, sizeof(tmp), MSG_DONTWAIT);
+		if (result < 0) {
+			if (EAGAIN != errno && EWOULDBLOCK != errno) {
+				stats.upcall_drops++;
+				smclog(LOG_WARNING, "Failed reading IGMP message from kernel: %s", strerror(errno));
+			}
+			break;
+		}
+
+		nocache4_process(tmp);
+	}
+
+	t4 = saved;
+}
+
+/*
+ * Worker thread side of the NOCACHE path: parse, match against the
+ * published rule snapshot, program the kernel and hand the result to
+ * the control thread, which does all tracking, logging, stats and
+ * script execution.  Runs lock free: the only shared state is the
+ * snapshot pointer and the handoff ring.  Duplicate upcalls within a
+ * burst are weeded out by the control thread, MRT_ADD_MFC simply
+ * replaces an identical entry.
+ */
+void mroute4_upcall_drain(int sd)
+{
+	struct conf4_snap *snap;
+	int pushed = 0;
+	char tmp[128];
+
+	snap = __atomic_load_n(&table4_default->snap, __ATOMIC_ACQUIRE);
+	if (snap)
+		__atomic_store_n(&table4_default->snap_seen, snap->gen, __ATOMIC_RELEASE);
+
+	while (1) {
+		struct igmpmsg *igmpctl = (struct igmpmsg *)tmp;
+		struct ip *ip = (struct ip *)tmp;
+		struct mroute4 mroute, *entry;
+		struct timespec t0, t1;
+		struct upcall *uc;
+
+		if (recv(sd, tmp, sizeof(tmp), MSG_DONTWAIT) < 0)
+			break;	/* drained, or socket going down */
+
+		if (ip->ip_p != 0 || igmpctl->im_msgtype != IGMPMSG_NOCACHE)
+			continue;
+
+		if (igmpctl->im_vif >= MAXVIFS)
+			continue;
+
+		uc = worker_reserve();
+		if (!uc)
+			continue;	/* ring full, kernel repeats the upcall */
+
+		memset(&mroute, 0, sizeof(mroute));
+		mroute.group.s_addr  = igmpctl->im_dst.s_addr;
+		mroute.source.s_addr = igmpctl->im_src.s_addr;
+		mroute.inbound       = igmpctl->im_vif;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		entry = snap ? snap_match4(snap, &mroute) : NULL;
+		if (entry)
+			memcpy(mroute.ttl, entry->ttl, NELEMS(mroute.ttl) * sizeof(mroute.ttl[0]));
+
+		memset(uc, 0, sizeof(*uc));
+		uc->version   = 4;
+		uc->matched   = entry ? 1 : 0;
+		uc->inbound   = mroute.inbound;
+		uc->source    = mroute.source;
+		uc->group     = mroute.group;
+		memcpy(uc->ttl, mroute.ttl, NELEMS(mroute.ttl) * sizeof(mroute.ttl[0]));
+
+		uc->installed = kern_add4_raw(sd, &mroute) ? 0 : 1;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		uc->latency = (uint32_t)((t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec));
+
+		worker_commit();
+		pushed++;
+	}
+
+	if (pushed)
+		worker_notify();
+}
+
+/*
+ * Control thread side of the worker handoff, mirrors the bookkeeping
+ * tail of mroute4_dyn_add() for a route the worker already installed.
+ */
+static void upcall4_process(struct upcall *uc)
+{
+	char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
+	struct mroute4 mroute, *entry, *new_entry;
+	struct mroute mrt;
+
+	stats.upcalls++;
+
+	memset(&mroute, 0, sizeof(mroute));
+	mroute.source  = uc->source;
+	mroute.group   = uc->group;
+	mroute.inbound = uc->inbound;
+	memcpy(mroute.ttl, uc->ttl, NELEMS(mroute.ttl) * sizeof(mroute.ttl[0]));
+
+	inet_ntop(AF_INET, &mroute.group,  group,  INET_ADDRSTRLEN);
+	inet_ntop(AF_INET, &mroute.source, origin, INET_ADDRSTRLEN);
+	smclog(LOG_DEBUG, "New multicast data from %s to group %s on VIF %d", origin, group, mroute.inbound);
+
+	if (!uc->installed) {
+		stats.kern_add_fail++;
+		smclog(LOG_WARNING, "failed adding IPv4 multicast route for (%s,%s)", origin, group);
+		return;
+	}
+
+	/* Duplicate upcall within a burst, already tracked */
+	if (hash_find4(&mroute))
+		return;
+
+	if (!uc->matched) {
+		/*
+		 * The rule snapshot can trail the live rule table for a
+		 * moment, re-check here before settling for the stop
+		 * filter the worker installed.
+		 */
+		entry = conf_match_find4(&mroute);
+		if (entry) {
+			memcpy(mroute.ttl, entry->ttl, NELEMS(mroute.ttl) * sizeof(mroute.ttl[0]));
+			if (!kern_add4(&mroute, 1))
+				uc->matched = 1;
+		}
+	} else {
+		smclog(LOG_DEBUG, "Add %s -> %s from VIF %d", origin, group, mroute.inbound);
+		mrdisc_enable(mroute.inbound);
+	}
+
+	new_entry = pool_alloc(&t4->pool);
+	if (new_entry) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		memcpy(new_entry, &mroute, sizeof(struct mroute4));
+		new_entry->dyn = 1;
+		new_entry->last_use = now.tv_sec;
+		new_entry->valid_pkt = 0;
+
+		TAILQ_INSERT_TAIL(&t4->dyn_list, new_entry, tlink);
+		hash_add4(new_entry);
+		vif_index_add4(new_entry);
+		shm_route4_add(t4->id, new_entry);
+	}
+	stats.dyn_installed++;
+	route4_event(EVENT_ROUTE_ADD, &mroute);
+
+	if (!uc->matched) {
+		stats.upcall_nomatch++;
+		smclog(LOG_INFO, "Multicast from %s, group %s, on VIF %d does not match any (*,G) rule",
+		       origin, group, mroute.inbound);
+		return;
+	}
+	stats_lat_sample(uc->latency);
+
+	mrt.version = 4;
+	mrt.u.mroute4 = mroute;
+	script_exec(&mrt);
+}
+
+static void cache_flush(void *arg)
+{
+	(void)arg;
+
+	smclog(LOG_INFO, "Cache timeout, flushing unused (*,G) routes!");
+	mroute4_dyn_expire(cache_timeout);
+}
+
+/*
+ * Set up one kernel routing table: create the mrouted API socket, bind
+ * it to @id with MRT_TABLE when not the default table, and initialize
+ * the route lists, hash indexes, pool and VIF vector.  Every table gets
+ * its own socket, registered with the shared event loop, each kernel
+ * table delivers NOCACHE upcalls on its own socket.
+ */
+static struct mrt4_table *table4_create(int id)
+{
+	struct mrt4_table *tbl, *saved;
+	struct iface *iface;
+	int arg = 1;
+	size_t i;
+
+	tbl = calloc(1, sizeof(*tbl));
+	if (!tbl) {
+		smclog(LOG_ERR, "Failed allocating IPv4 routing table %d: %s", id, strerror(errno));
+		return NULL;
+	}
+
+	tbl->id = id;
+	tbl->sd = socket_create(AF_INET, SOCK_RAW, IPPROTO_IGMP, handle_nocache4, tbl);
+	if (tbl->sd < 0) {
+		if (ENOPROTOOPT == errno)
+			smclog(LOG_WARNING, "Kernel does not even support IGMP, skipping ...");
+
+		free(tbl);
+		return NULL;
+	}
+
+#ifdef MRT_TABLE /* Currently only available on Linux  */
+	if (id != 0) {
+		smclog(LOG_INFO, "Setting IPv4 multicast routing table id %d", id);
+		if (setsockopt(tbl->sd, IPPROTO_IP, MRT_TABLE, &id, sizeof(id)) < 0) {
+			smclog(LOG_ERR, "Cannot set IPv4 multicast routing table id: %s", strerror(errno));
+			smclog(LOG_ERR, "Make sure your kernel has CONFIG_IP_MROUTE_MULTIPLE_TABLES=y");
+			goto error;
+		}
+	}
+#else
+	if (id != 0) {
+		smclog(LOG_ERR, "No support for multiple multicast routing tables on this system.");
+		errno = EOPNOTSUPP;
+		goto error;
+	}
+#endif
+
+	if (setsockopt(tbl->sd, IPPROTO_IP, MRT_INIT, (void *)&arg, sizeof(arg))) {
+		switch (errno) {
+		case EADDRINUSE:
+			smclog(LOG_ERR, "IPv4 multicast routing API already in use: %s", strerror(errno));
+			break;
+
+		case EOPNOTSUPP:
+			smclog(LOG_ERR, "Kernel does not support IPv4 multicast routing, skipping ...");
+			break;
+
+		default:
+			smclog(LOG_ERR, "Failed initializing IPv4 multicast routing API: %s", strerror(errno));
+			break;
+		}
+
+		goto error;
+	}
+
+	LIST_INIT(&tbl->conf_list);
+	TAILQ_INIT(&tbl->dyn_list);
+	LIST_INIT(&tbl->static_list);
+	for (i = 0; i < NELEMS(tbl->vif_list); i++)
+		LIST_INIT(&tbl->vif_list[i].routes);
+
+	saved = t4;
+	t4 = tbl;
+	hash_init4();
+	pool_init(&tbl->pool, sizeof(struct mroute4), 256);
+
+	/*
+	 * Create virtual interfaces (VIFs) for all non-loopback interfaces
+	 * supporting multicast.  The kernel keeps a VIF table per routing
+	 * table, so later tables also re-register the VIFs set up earlier
+	 * with `phyint` -- same numbering on every socket.
+	 */
+	for (iface = iface_iterator(1); iface; iface = iface_iterator(0)) {
+		if (do_vifs4 || iface->vif >= 0)
+			mroute4_add_vif(iface);
+	}
+	t4 = saved;
+
+	LIST_INSERT_HEAD(&table4_list, tbl, link);
+
+	return tbl;
+error:
+	socket_close(tbl->sd);
+	free(tbl);
+
+	return NULL;
+}
+
+/**
+ * mroute4_enable - Initialise IPv4 multicast routing
+ *
+ * Setup the kernel IPv4 multicast routing API and lock the multicast
+ * routing socket to this program (only!).
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute4_enable(int do_vifs, int table_id, int timeout)
+{
+	static int running = 0;
+	struct mrt4_table *tbl;
+
+	do_vifs4 = do_vifs;
+
+	tbl = table4_create(table_id);
+	if (!tbl)
+		return -1;
+
+	table4_default = t4 = tbl;
+
+	if (timeout && !running) {
+		running++;
+		cache_timeout = timeout;
+		timer_add(timeout, cache_flush, NULL);
+	}
+
+	return 0;
+}
+
+/**
+ * mroute4_table_select - Switch current routing table, create on demand
+ * @id: Kernel routing table id from a .conf `table` section
+ *
+ * Used by the .conf parser: route and rule operations that follow apply
+ * to table @id until the next switch or mroute4_table_reset().
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute4_table_select(int id)
+{
+	struct mrt4_table *tbl;
+
+	if (!table4_default) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	LIST_FOREACH(tbl, &table4_list, link) {
+		if (tbl->id == id) {
+			t4 = tbl;
+			return 0;
+		}
+	}
+
+	tbl = table4_create(id);
+	if (!tbl)
+		return -1;
+
+	t4 = tbl;
+
+	return 0;
+}
+
+/**
+ * mroute4_table_reset - Return to the default routing table
+ */
+void mroute4_table_reset(void)
+{
+	t4 = table4_default;
+}
+
+/**
+ * mroute4_table_pin - Switch to the default table, remember the current
+ *
+ * Route ops from IPC clients always target the default table, but the
+ * event loop serves clients between reload slices, which may have left
+ * the current table on a .conf `table` section.  Returns a cookie for
+ * mroute4_table_restore() so the reload resumes where it left off.
+ */
+void *mroute4_table_pin(void)
+{
+	struct mrt4_table *saved = t4;
+
+	t4 = table4_default;
+
+	return saved;
+}
+
+/**
+ * mroute4_table_restore - Undo mroute4_table_pin()
+ * @cookie: Return value from the matching mroute4_table_pin()
+ */
+void mroute4_table_restore(void *cookie)
+{
+	t4 = cookie;
+}
+
+/**
+ * mroute4_disable - Disable IPv4 multicast routing
+ *
+ * Disable IPv4 multicast routing and release all kernel routing sockets.
+ */
+void mroute4_disable(void)
+{
+	struct mrt4_table *tbl;
+
+	if (!table4_default)
+		return;
+
+	/* Reclaim the upcall sockets from the worker thread first */
+	worker_stop();
+	upcall_worker = 0;
+
+	while ((tbl = LIST_FIRST(&table4_list))) {
+		LIST_REMOVE(tbl, link);
+
+		conf4_snap_exit(tbl);
+
+		/* Drop all kernel routes set by smcroute */
+		if (setsockopt(tbl->sd, IPPROTO_IP, MRT_DONE, NULL, 0))
+			smclog(LOG_WARNING, "Failed shutting down IPv4 multicast routing socket: %s", strerror(errno));
+
+		socket_close(tbl->sd);
+		pool_exit(&tbl->pool);
+		free(tbl);
+	}
+
+	table4_default = t4 = NULL;
+	shm_route4_clear();
+}
+
+
+/* Create a virtual interface from @iface so it can be used for IPv4 multicast routing. */
+static int mroute4_add_vif(struct iface *iface)
+{
+	struct vifctl vc;
+	int vif = -1;
+	size_t i;
+
+	if (!t4 || t4->sd < 0)
+		return -1;
+
+	/* Reload case, VIF already registered with the kernel */
+	if (iface->vif >= 0 && t4->vif_list[iface->vif].iface) {
+		/* The mrdisc flag may still be news, e.g. when the VIFs
+		 * were mapped at boot before the phyint line was parsed */
+		if (iface->mrdisc && mrdisc_register(iface->name, iface->vif) && errno != EEXIST)
+			return 1;
+
+		return 0;
+	}
+
+	if ((iface->flags & IFF_MULTICAST) != IFF_MULTICAST) {
+		smclog(LOG_INFO, "Interface %s is not multicast capable, skipping VIF.", iface->name);
+		iface->vif = -1;
+		return 0;
+	}
+
+	if (iface->vif >= 0) {
+		/* Additional table, keep the VIF numbering from the first */
+		vif = iface->vif;
+	} else {
+		/* find a free vif */
+		for (i = 0; i < NELEMS(t4->vif_list); i++) {
+			if (!t4->vif_list[i].iface) {
+				vif = i;
+				break;
+			}
+		}
+	}
+
+	/* no more space */
+	if (vif == -1) {
+		errno = ENOMEM;
+		smclog(LOG_WARNING, "Kernel MAXVIFS (%d) too small for number of interfaces: %s", MAXVIFS, strerror(errno));
+		return 1;
+	}
+
+	memset(&vc, 0, sizeof(vc));
+	vc.vifc_vifi = vif;
+	vc.vifc_flags = 0;      /* no tunnel, no source routing, register ? */
+	vc.vifc_threshold = iface->threshold;
+	vc.vifc_rate_limit = 0;	/* hopefully no limit */
+#ifdef VIFF_USE_IFINDEX		/* Register VIF using ifindex, not lcl_addr, since Linux 2.6.33 */
+	vc.vifc_flags |= VIFF_USE_IFINDEX;
+	vc.vifc_lcl_ifindex = iface->ifindex;
+#else
+	vc.vifc_lcl_addr.s_addr = iface->inaddr.s_addr;
+#endif
+	vc.vifc_rmt_addr.s_addr = htonl(INADDR_ANY);
+
+	smclog(LOG_DEBUG, "Map iface %-16s => VIF %-2d ifindex %2d flags 0x%04x TTL threshold %u",
+	       iface->name, vc.vifc_vifi, iface->ifindex, vc.vifc_flags, iface->threshold);
+
+	if (setsockopt(t4->sd, IPPROTO_IP, MRT_ADD_VIF, (void *)&vc, sizeof(vc))) {
+		smclog(LOG_ERR, "Failed adding VIF for iface %s: %s", iface->name, strerror(errno));
+		return 1;
+	}
+
+	t4->vif_list[vif].iface = iface;
+
+	/*
+	 * Routes still referencing the slot from before the flap: if the
+	 * same interface got its old number back, just reinstall them in
+	 * the kernel.  If another interface claimed the slot, the stale
+	 * references must go: entries with the old inbound are dropped --
+	 * the .conf re-apply readds them when their interface returns --
+	 * and outbound sets lose the VIF for good.
+	 */
+	if (t4->vif_list[vif].stale && t4->vif_list[vif].stale != iface) {
+		struct mroute4 *route, *tmp;
+
+		LIST_FOREACH_SAFE(route, &t4->vif_list[vif].routes, vlink[vif], tmp) {
+			if (route->inbound == vif) {
+				if (route->dyn)
+					TAILQ_REMOVE(&t4->dyn_list, route, tlink);
+				else
+					LIST_REMOVE(route, link);
+				LIST_REMOVE(route, hlink);
+				vif_index_del4(route);
+				shm_route4_del(route);
+				route4_event(EVENT_ROUTE_DEL, route);
+				pool_free(&t4->pool, route);
+				continue;
+			}
+
+			route->ttl[vif] = 0;
+			route->oifs &= ~(1u << vif);
+			LIST_REMOVE(route, vlink[vif]);
+			shm_route4_add(t4->id, route);
+		}
+	} else if (t4->vif_list[vif].stale) {
+		struct mroute4 *route;
+
+		LIST_FOREACH(route, &t4->vif_list[vif].routes, vlink[vif]) {
+			/* Wait for the inbound VIF, its rebuild covers us */
+			if (!t4->vif_list[route->inbound].iface)
+				continue;
+
+			if (kern_add4_raw(t4->sd, route))
+				stats.kern_add_fail++;
+		}
+	}
+	t4->vif_list[vif].stale = NULL;
+
+	if (iface->vif >= 0)
+		return 0;	/* mrdisc already set up by the first table */
+	iface->vif = vif;
+	shm_vif_add(vif, iface->name);
+	vif_event(EVENT_VIF_UP, iface->name);
+
+	if (iface->mrdisc)
+		return mrdisc_register(iface->name, vif);
+
+	return 0;
+}
+
+static int mroute4_del_vif(struct iface *iface)
+{
+	struct mroute4 *route, *tmp;
+	int16_t vif = iface->vif;
+	int ret;
+
+	if (!t4 || t4->sd < 0)
+		return -1;
+
+	if (-1 == vif || !t4->vif_list[vif].iface)
+		return 0;	/* No VIF setup for iface, skip */
+
+	smclog(LOG_DEBUG, "Removing  %-16s => VIF %-2d", iface->name, vif);
+
+#ifdef __linux__
+	struct vifctl vc = { .vifc_vifi = vif };
+	ret = setsockopt(t4->sd, IPPROTO_IP, MRT_DEL_VIF, (void *)&vc, sizeof(vc));
+#else
+	ret = setsockopt(t4->sd, IPPROTO_IP, MRT_DEL_VIF, (void *)&vif, sizeof(vif));
+#endif
+	/*
+	 * EADDRNOTAVAIL: the kernel drops the VIF by itself when the
+	 * device unregisters, so on link removal the slot is already
+	 * gone -- carry on with our own bookkeeping.
+	 */
+	if (ret && errno != EADDRNOTAVAIL) {
+		smclog(LOG_ERR, "Failed deleting VIF for iface %s: %s", iface->name, strerror(errno));
+		return 0;
+	}
+
+	/*
+	 * Fan-out over the reverse index, only routes referencing this
+	 * VIF.  Learned (S,G) are dropped, they come back via NOCACHE
+	 * upcalls if the interface does.  Static entries stay, but the
+	 * kernel side must not keep referencing the slot -- it may be
+	 * reused by another interface -- so inbound entries are pulled
+	 * from the MFC and outbound sets reprogrammed with the VIF
+	 * masked out, to be restored by mroute4_add_vif().
+	 */
+	LIST_FOREACH_SAFE(route, &t4->vif_list[vif].routes, vlink[vif], tmp) {
+		uint8_t ttl;
+
+		if (route->dyn) {
+			stats.dyn_flushed++;
+			kern_del4(route, is_active4(route));
+			TAILQ_REMOVE(&t4->dyn_list, route, tlink);
+			LIST_REMOVE(route, hlink);
+			vif_index_del4(route);
+			shm_route4_del(route);
+			route4_event(EVENT_ROUTE_DEL, route);
+			pool_free(&t4->pool, route);
+			continue;
+		}
+
+		if (route->inbound == vif) {
+			kern_del4(route, is_active4(route));
+			continue;
+		}
+
+		/* Inbound already down, no kernel entry to reprogram */
+		if (!t4->vif_list[route->inbound].iface)
+			continue;
+
+		ttl = route->ttl[vif];
+		route->ttl[vif] = 0;
+		kern_add4_raw(t4->sd, route);
+		route->ttl[vif] = ttl;
+	}
+
+	t4->vif_list[vif].iface = NULL;
+	t4->vif_list[vif].stale = iface;
+	if (t4 != table4_default)
+		return 0;	/* mrdisc and iface->vif follow the first table */
+	iface->vif = -1;
+	shm_vif_del(vif);
+	vif_event(EVENT_VIF_DOWN, iface->name);
+
+	if (iface->mrdisc)
+		return mrdisc_deregister(vif);
+
+	return 0;
+}
+
+/*
+ * Build and issue the MRT_ADD_MFC call, shared with the upcall worker
+ * thread, so no logging or other shared daemon state in here.
+ */
+static int kern_add4_raw(int sd, struct mroute4 *route)
+{
+	struct mfcctl mc;
+
+	if (sd < 0)
+		return -1;
+
+	memset(&mc, 0, sizeof(mc));
+	mc.mfcc_origin = route->source;
+	mc.mfcc_mcastgrp = route->group;
+	mc.mfcc_parent = route->inbound;
+	memcpy(mc.mfcc_ttls, route->ttl, NELEMS(mc.mfcc_ttls) * sizeof(mc.mfcc_ttls[0]));
+
+	return setsockopt(sd, IPPROTO_IP, MRT_ADD_MFC, &mc, sizeof(mc));
+}
+
+/* Actually set in kernel - called by mroute4_add() and mroute4_check_add() */
+static int kern_add4(struct mroute4 *route, int active)
+{
+	char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
+
+	if (!t4 || t4->sd < 0)
+		return -1;
+
+	/* copy the TTL vector */
+	if (sizeof(((struct mfcctl *)0)->mfcc_ttls[0]) != sizeof(route->ttl[0]) ||
+	    NELEMS(((struct mfcctl *)0)->mfcc_ttls) != NELEMS(route->ttl)) {
+		smclog(LOG_ERR, "Critical data type validation error in %s!", __FILE__);
+		exit(255);
+	}
+
+	/* During bulk load the pool overlaps the setsockopt() with parsing */
+	if (!bulk_mode || loader_queue4(t4->sd, route)) {
+		if (kern_add4_raw(t4->sd, route)) {
+			stats.kern_add_fail++;
+			smclog(LOG_WARNING, "failed adding IPv4 multicast route: %s", strerror(errno));
+			return 1;
+		}
+	}
+
+	if (active) {
+		smclog(LOG_DEBUG, "Add %s -> %s from VIF %d",
+		       inet_ntop(AF_INET, &route->source, origin, INET_ADDRSTRLEN),
+		       inet_ntop(AF_INET, &route->group,  group,  INET_ADDRSTRLEN), route->inbound);
+
+		/* Only enable mrdisc for active routes, i.e. with outbound */
+		mrdisc_enable(route->inbound);
+	}
+
+	return 0;
+}
+
+/* Actually remove from kernel - called by mroute4_del() */
+static int kern_del4(struct mroute4 *route, int active)
+{
+	char origin[INET_ADDRSTRLEN], group[INET_ADDRSTRLEN];
+	struct mfcctl mc;
+
+	if (!t4 || t4->sd < 0)
+		return -1;
+
+	/* A queued bulk add for this route must not land after the del */
+	if (bulk_mode)
+		loader_drain();
+
+	memset(&mc, 0, sizeof(mc));
+	mc.mfcc_origin = route->source;
+	mc.mfcc_mcastgrp = route->group;
+	if (setsockopt(t4->sd, IPPROTO_IP, MRT_DEL_MFC, &mc, sizeof(mc))) {
+		stats.kern_del_fail++;
+		if (ENOENT == errno)
+			smclog(LOG_DEBUG, "failed removing multicast route, does not exist.");
+		else
+			smclog(LOG_DEBUG, "failed removing IPv4 multicast route: %s", strerror(errno));
+		return 1;
+	}
+
+	if (active) {
+		smclog(LOG_DEBUG, "Del %s -> %s",
+		       inet_ntop(AF_INET, &mc.mfcc_origin,  origin, INET_ADDRSTRLEN),
+		       inet_ntop(AF_INET, &mc.mfcc_mcastgrp, group, INET_ADDRSTRLEN));
+
+		/* Only disable mrdisc for active routes. */
+		mrdisc_disable(route->inbound);
+	}
+
+	return 0;
+}
+
+/*
+ * Used for exact (S,G) matching
+ */
+static int is_exact_match4(struct mroute4 *a, struct mroute4 *b)
+{
+	if (a->source.s_addr == b->source.s_addr &&
+	    a->group.s_addr  == b->group.s_addr  &&
+	    a->len           == b->len &&
+	    a->inbound       == b->inbound)
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Used for (*,G) matches
+ *
+ * The incoming candidate is compared to the configured rule, e.g.
+ * does 225.1.2.3 fall inside 225.0.0.0/8?  => Yes
+ * does 225.1.2.3 fall inside 225.0.0.0/15? => Yes
+ * does 225.1.2.3 fall inside 225.0.0.0/16? => No
+ */
+static int is_match4(struct mroute4 *rule, struct mroute4 *cand)
+{
+	uint32_t g1, g2, mask;
+
+	if (rule->inbound != cand->inbound)
+		return 0;
+
+	if (rule->len > 0)
+		mask = 0xFFFFFFFFu << (32 - rule->len);
+	else
+		mask = 0xFFFFFFFFu;
+	mask = htonl(mask);
+	g1 = rule->group.s_addr & mask;
+	g2 = cand->group.s_addr & mask;
+
+	return g1 == g2;
+}
+
+/**
+ * mroute4_dyn_add - Add route to kernel if it matches a known (*,G) route.
+ * @route: Pointer to candidate struct mroute4 IPv4 multicast route
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute4_dyn_add(struct mroute4 *route)
+{
+	struct mroute4 *entry, *new_entry;
+	int ret;
+
+	if (!t4) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* Already installed, kernel upcalls may race route installation */
+	entry = hash_find4(route);
+	if (entry) {
+		errno = is_active4(entry) ? EEXIST : ENOENT;
+		return -1;
+	}
+
+	/* Find matching (*,G/len) rule ... and interface. */
+	entry = conf_match_find4(route);
+	if (entry) {
+		/* Use configured template (*,G) outbound interfaces. */
+		memcpy(route->ttl, entry->ttl, NELEMS(route->ttl) * sizeof(route->ttl[0]));
+	} else {
+		/*
+		 * No match, add entry without outbound interfaces
+		 * nevertheless to avoid continuous cache misses from
+		 * the kernel. Note that this still gets reported as an
+		 * error (ENOENT) below.
+		 */
+		memset(route->ttl, 0, NELEMS(route->ttl) * sizeof(route->ttl[0]));
+	}
+
+	ret = kern_add4(route, entry ? 1 : 0);
+	if (ret)
+		return ret;
+
+	/*
+	 * Add to list of dynamically added routes. Necessary if the user
+	 * removes the (*,G) using the command line interface rather than
+	 * updating the conf file and SIGHUP. Note: if we fail to alloc()
+	 * memory we don't do anything, just add kernel route silently.
+	 */
+	new_entry = pool_alloc(&t4->pool);
+	if (new_entry) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		memcpy(new_entry, route, sizeof(struct mroute4));
+		new_entry->dyn = 1;
+		new_entry->last_use = now.tv_sec;
+		new_entry->valid_pkt = 0;
+
+		/* Tail insert keeps the list ordered on last_use */
+		TAILQ_INSERT_TAIL(&t4->dyn_list, new_entry, tlink);
+		hash_add4(new_entry);
+		vif_index_add4(new_entry);
+		shm_route4_add(t4->id, new_entry);
+	}
+	stats.dyn_installed++;
+	route4_event(EVENT_ROUTE_ADD, route);
+
+	/* Signal to cache handler we've added a stop filter */
+	if (!entry) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifdef __linux__
+#define PROC_IP_MR_CACHE "/proc/net/ip_mr_cache"
+#endif
+
+/* Set when the counters cached in each entry are current */
+static int stats_cached = 0;
+
+/*
+ * Refresh cached counters for all installed (S,G) entries in a single
+ * pass over /proc/net/ip_mr_cache, rather than one SIOCGETSGCNT ioctl
+ * per route.  At tens of thousands of routes the per-route ioctls in
+ * the expiry and show paths add up to significant syscall time.  The
+ * proc file only covers the default routing table, other tables fall
+ * back to per-route ioctls in get_stats4().
+ */
+static int stats_refresh4(void)
+{
+	stats_cached = 0;
+#ifdef __linux__
+	{
+		struct mrt4_table *saved = t4;
+		char buf[256];
+		FILE *fp;
+
+		if (!table4_default)
+			return -1;
+
+		fp = fopen(PROC_IP_MR_CACHE, "r");
+		if (!fp)
+			return -1;
+
+		t4 = table4_default;
+
+		/* Skip heading */
+		if (!fgets(buf, sizeof(buf), fp)) {
+			fclose(fp);
+			t4 = saved;
+			return -1;
+		}
+
+		while (fgets(buf, sizeof(buf), fp)) {
+			struct mroute4 probe, *entry;
+			unsigned long pktcnt, bytecnt, wrong_if;
+			uint32_t group, origin;
+			int iif;
+
+			/* Addresses are raw s_addr words printed as hex */
+			if (sscanf(buf, "%8x %8x %d %lu %lu %lu",
+				   &group, &origin, &iif, &pktcnt, &bytecnt, &wrong_if) != 6)
+				continue;
+
+			memset(&probe, 0, sizeof(probe));
+			probe.group.s_addr  = group;
+			probe.source.s_addr = origin;
+			probe.inbound       = iif;
+
+			entry = hash_find4(&probe);
+			if (!entry)
+				continue;
+
+			entry->pktcnt   = pktcnt;
+			entry->bytecnt  = bytecnt;
+			entry->wrong_if = wrong_if;
+		}
+		fclose(fp);
+		t4 = saved;
+		stats_cached = 1;
+
+		return 0;
+	}
+#else
+	return -1;
+#endif
+}
+
+/*
+ * Query kernel for install MFC entry usage statistics
+ */
+static int get_stats4(struct mroute4 *route, unsigned long *pktcnt, unsigned long *bytecnt, unsigned long *wrong_if)
+{
+	struct sioc_sg_req sg_req;
+
+	if (!t4 || t4->sd < 0)
+		return -1;
+
+	/* The proc scan behind the cache covers the default table only */
+	if (stats_cached && t4 == table4_default) {
+		if (pktcnt)
+			*pktcnt = route->pktcnt;
+		if (bytecnt)
+			*bytecnt = route->bytecnt;
+		if (wrong_if)
+			*wrong_if = route->wrong_if;
+
+		return 0;
+	}
+
+	memset(&sg_req, 0, sizeof(sg_req));
+	sg_req.src = route->source;
+	sg_req.grp = route->group;
+
+	if (ioctl(t4->sd, SIOCGETSGCNT, &sg_req) < 0) {
+		if (wrong_if)
+			smclog(LOG_WARNING, "Failed getting MFC stats: %s", strerror(errno));
+		return errno;
+	}
+
+	if (pktcnt)
+		*pktcnt = sg_req.pktcnt;
+	if (bytecnt)
+		*bytecnt = sg_req.bytecnt;
+	if (wrong_if)
+		*wrong_if = sg_req.wrong_if;
+
+	return 0;
+}
+
+static int is_active4(struct mroute4 *route)
+{
+	return route->oifs != 0;
+}
+
+/*
+ * Get valid packet usage statistics (i.e. number of actually forwarded
+ * packets) from the kernel for an installed MFC entry
+ */
+static unsigned long get_valid_pkt4(struct mroute4 *route)
+{
+	unsigned long pktcnt = 0, wrong_if = 0;
+
+	if (get_stats4(route, &pktcnt, NULL, &wrong_if) < 0)
+		return 0;
+
+	return pktcnt - wrong_if;
+}
+
+/**
+ * mroute4_dyn_expire - Expire dynamically added (*,G) routes
+ * @max_idle: Timeout for routes in seconds, 0 to expire all dynamic routes
+ *
+ * This function flushes all (*,G) routes which haven't been used (i.e. no
+ * packets matching them have been forwarded) in the last max_idle seconds.
+ * It is called periodically on cache-timeout or on request of smcroutectl.
+ * The latter is useful in case of topology changes (e.g. VRRP fail-over)
+ * or similar, and is unconditional: the operator wants a forced relearn,
+ * so active routes are not re-stamped and kept like on the timer path.
+ *
+ * The list is kept ordered on last_use, oldest first, so only entries
+ * actually due for expiry are visited; routes with recent activity are
+ * re-stamped and moved last in line.
+ */
+void mroute4_dyn_expire(int max_idle)
+{
+	struct mrt4_table *saved = t4, *tbl;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	stats_refresh4();
+
+	LIST_FOREACH(tbl, &table4_list, link) {
+		struct mroute4 *entry, *tmp, *moved = NULL;
+
+		t4 = tbl;
+		TAILQ_FOREACH_SAFE(entry, &t4->dyn_list, tlink, tmp) {
+			/* Stop at first entry moved to the tail by this very scan */
+			if (entry == moved)
+				break;
+
+			if (entry->last_use + max_idle > now.tv_sec)
+				break;	/* Rest of list is newer ... */
+
+			if (max_idle) {
+				unsigned long valid_pkt;
+
+				valid_pkt = get_valid_pkt4(entry);
+				if (valid_pkt != entry->valid_pkt) {
+					/* Used since last check, update and move last in line */
+					entry->last_use = now.tv_sec;
+					entry->valid_pkt = valid_pkt;
+					TAILQ_REMOVE(&t4->dyn_list, entry, tlink);
+					TAILQ_INSERT_TAIL(&t4->dyn_list, entry, tlink);
+					if (!moved)
+						moved = entry;
+					continue;
+				}
+
+				stats.dyn_expired++;
+			} else {
+				/* Explicit flush, expire regardless of activity */
+				stats.dyn_flushed++;
+			}
+			kern_del4(entry, is_active4(entry));
+			TAILQ_REMOVE(&t4->dyn_list, entry, tlink);
+			LIST_REMOVE(entry, hlink);
+			vif_index_del4(entry);
+			shm_route4_del(entry);
+			route4_event(EVENT_ROUTE_DEL, entry);
+			pool_free(&t4->pool, entry);
+		}
+	}
+	t4 = saved;
+}
+
+static int mroute4_exists(struct mroute4 *route)
+{
+	struct mroute4 *entry;
+
+	LIST_FOREACH(entry, &t4->conf_list, link) {
+		if (is_match4(entry, route)) {
+			smclog(LOG_INFO, "(*,G) route already exists");
+			return 1;
+		}
+	}
+
+	entry = hash_find4(route);
+	if (entry && !entry->dyn) {
+		smclog(LOG_INFO, "Static route already exists");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Outbound interface set changed, update kernel and any spawned (S,G)
+ */
+static int mroute4_update(struct mroute4 *entry, struct mroute4 *route)
+{
+	struct mroute4 *dyn;
+	int ret = 0;
+
+	memcpy(entry->ttl, route->ttl, NELEMS(entry->ttl) * sizeof(entry->ttl[0]));
+	if (entry->source.s_addr != htonl(INADDR_ANY)) {
+		vif_index_update4(entry);
+		shm_route4_add(t4->id, entry);
+		route4_event(EVENT_ROUTE_ADD, entry);
+
+		return kern_add4(entry, 1);
+	}
+
+	/* (*,G) rules stay out of the reverse index, bitmask only */
+	entry->oifs = oifs_mask4(entry);
+	shm_route4_add(t4->id, entry);
+
+	/* (*,G) template, reprogram all (S,G) routes spawned from it */
+	TAILQ_FOREACH(dyn, &t4->dyn_list, tlink) {
+		if (!is_match4(entry, dyn))
+			continue;
+
+		memcpy(dyn->ttl, entry->ttl, NELEMS(dyn->ttl) * sizeof(dyn->ttl[0]));
+		vif_index_update4(dyn);
+		shm_route4_add(t4->id, dyn);
+		route4_event(EVENT_ROUTE_ADD, dyn);
+		ret += kern_add4(dyn, is_active4(dyn));
+	}
+
+	return ret;
+}
+
+/**
+ * mroute4_add - Add route to kernel, or save a wildcard route for later use
  * @route: Pointer to struct mroute4 IPv4 multicast route to add
  *
- * Adds the given multicast @route to the kernel multicast routing table
- * unless the source IP is %INADDR_ANY, i.e., a (*,G) route.  Those we
- * save for and check against at runtime when the kernel signals us.
+ * Adds the given multicast @route to the kernel multicast routing table
+ * unless the source IP is %INADDR_ANY, i.e., a (*,G) route.  Those we
+ * save for and check against at runtime when the kernel signals us.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute4_add(struct mroute4 *route)
+{
+	struct mroute4 *entry;
+
+	if (!t4) {
+		errno = EAGAIN;
+		return 1;
+	}
+
+	/*
+	 * First look for the exact same route, used by the .conf reload
+	 * mark-and-sweep to detect unchanged and modified entries.
+	 */
+	if (route->source.s_addr == htonl(INADDR_ANY)) {
+		entry = conf_hash_find4(route);
+		if (entry) {
+			int ret;
+
+			entry->unused = 0;
+			if (!memcmp(entry->ttl, route->ttl, sizeof(entry->ttl))) {
+				smclog(LOG_INFO, "(*,G) route already exists");
+				errno = EEXIST;
+				return 1;
+			}
+
+			ret = mroute4_update(entry, route);
+			if (!bulk_mode)
+				conf4_snap_update();
+
+			return ret;
+		}
+	} else {
+		entry = hash_find4(route);
+		if (entry && !entry->dyn) {
+			entry->unused = 0;
+			if (!memcmp(entry->ttl, route->ttl, sizeof(entry->ttl))) {
+				smclog(LOG_INFO, "Static route already exists");
+				errno = EEXIST;
+				return 1;
+			}
+
+			return mroute4_update(entry, route);
+		}
+	}
+
+	if (!bulk_mode && mroute4_exists(route)) {
+		errno = EEXIST;
+		return 1;
+	}
+
+	entry = pool_alloc(&t4->pool);
+	if (!entry) {
+		smclog(LOG_WARNING, "Cannot add multicast route: %s", strerror(errno));
+		return 1;
+	}
+
+	memcpy(entry, route, sizeof(struct mroute4));
+	bulk_count++;
+
+	/*
+	 * For (*,G) we save to a linked list to be added on-demand when
+	 * the kernel sends IGMPMSG_NOCACHE.
+	 */
+	if (route->source.s_addr == htonl(INADDR_ANY)) {
+		struct mroute4 *dyn, *tmp;
+
+		LIST_INSERT_HEAD(&t4->conf_list, entry, link);
+		conf_hash_add4(entry);
+		entry->oifs = oifs_mask4(entry);
+		shm_route4_add(t4->id, entry);
+
+		/* Also, immediately expire any currently blocked traffic */
+		TAILQ_FOREACH_SAFE(dyn, &t4->dyn_list, tlink, tmp) {
+			if (!is_active4(dyn) && is_match4(entry, dyn)) {
+				kern_del4(dyn, 0);
+				TAILQ_REMOVE(&t4->dyn_list, dyn, tlink);
+				LIST_REMOVE(dyn, hlink);
+				vif_index_del4(dyn);
+				shm_route4_del(dyn);
+				route4_event(EVENT_ROUTE_DEL, dyn);
+				pool_free(&t4->pool, dyn);
+				break;
+			}
+		}
+
+		if (!bulk_mode)
+			conf4_snap_update();
+
+		return 0;
+	}
+
+	LIST_INSERT_HEAD(&t4->static_list, entry, link);
+	hash_add4(entry);
+	vif_index_add4(entry);
+	shm_route4_add(t4->id, entry);
+	route4_event(EVENT_ROUTE_ADD, entry);
+
+	return kern_add4(route, 1);
+}
+
+/* Remove from kernel and linked list */
+static int do_mroute4_del(struct mroute4 *entry)
+{
+	int ret;
+
+	ret = kern_del4(entry, is_active4(entry));
+	if (ret && ENOENT != errno)
+		return ret;
+
+	/* Also remove on ENOENT */
+	if (entry->dyn)
+		TAILQ_REMOVE(&t4->dyn_list, entry, tlink);
+	else
+		LIST_REMOVE(entry, link);
+	LIST_REMOVE(entry, hlink);
+	vif_index_del4(entry);
+	shm_route4_del(entry);
+	route4_event(EVENT_ROUTE_DEL, entry);
+	pool_free(&t4->pool, entry);
+
+	return ret;
+}
+
+/* Remove a (*,G) rule and all (S,G) routes spawned from it */
+static int conf_mroute4_del(struct mroute4 *entry)
+{
+	struct mroute4 *set, *tmp;
+	int ret = 0;
+
+	TAILQ_FOREACH_SAFE(set, &t4->dyn_list, tlink, tmp) {
+		if (!is_match4(entry, set))
+			continue;
+
+		ret += do_mroute4_del(set);
+	}
+
+	if (!ret) {
+		LIST_REMOVE(entry, link);
+		conf_hash_del4(entry);
+		shm_route4_del(entry);
+		pool_free(&t4->pool, entry);
+	}
+
+	if (!bulk_mode)
+		conf4_snap_update();
+
+	return ret;
+}
+
+/**
+ * mroute4_del - Remove route from kernel, or all matching routes if wildcard
+ * @route: Pointer to struct mroute4 IPv4 multicast route to remove
+ *
+ * Removes the given multicast @route from the kernel multicast routing
+ * table, or if the @route is a wildcard, then all matching kernel
+ * routes are removed, as well as the wildcard.
  *
  * Returns:
  * POSIX OK(0) on success, non-zero on error with @errno set.
  */
-int mroute4_add(struct mroute4 *route)
+int mroute4_del(struct mroute4 *route)
+{
+	struct mroute4 *entry, *tmp;
+
+	if (!t4) {
+		errno = EAGAIN;
+		return 1;
+	}
+
+	if (route->source.s_addr != htonl(INADDR_ANY)) {
+		/* Finds static route, or if spawned from a (*,G) rule. */
+		entry = hash_find4(route);
+		if (entry)
+			return do_mroute4_del(entry);
+
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* Find matching (*,G) ... and interface .. and prefix length. */
+	LIST_FOREACH_SAFE(entry, &t4->conf_list, link, tmp) {
+		if (!is_match4(entry, route) || entry->len != route->len)
+			continue;
+
+		return conf_mroute4_del(entry);
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+/**
+ * mroute4_mark_all - Mark all user configured routes for sweeping
+ *
+ * Used by the .conf reload logic: mark all configured routes, re-read
+ * the .conf file, which clears the mark on routes still in the file,
+ * then sweep to remove the routes no longer wanted.
+ */
+void mroute4_mark_all(void)
 {
+	struct mrt4_table *tbl;
 	struct mroute4 *entry;
 
-	if (mroute4_exists(route)){
-		errno = EEXIST;
+	LIST_FOREACH(tbl, &table4_list, link) {
+		LIST_FOREACH(entry, &tbl->conf_list, link)
+			entry->unused = 1;
+		LIST_FOREACH(entry, &tbl->static_list, link)
+			entry->unused = 1;
+	}
+}
+
+/**
+ * mroute4_sweep_all - Remove all routes still marked as unused
+ *
+ * Returns:
+ * Number of failed kernel route removals.
+ */
+int mroute4_sweep_all(void)
+{
+	struct mrt4_table *saved = t4, *tbl;
+	struct mroute4 *entry, *tmp;
+	int ret = 0;
+
+	LIST_FOREACH(tbl, &table4_list, link) {
+		t4 = tbl;
+		LIST_FOREACH_SAFE(entry, &t4->conf_list, link, tmp) {
+			if (!entry->unused)
+				continue;
+
+			ret += conf_mroute4_del(entry);
+		}
+
+		LIST_FOREACH_SAFE(entry, &t4->static_list, link, tmp) {
+			if (!entry->unused)
+				continue;
+
+			ret += do_mroute4_del(entry);
+		}
+	}
+	t4 = saved;
+
+	return ret;
+}
+
+/**
+ * mroute4_bulk_begin - Start bulk loading routes
+ *
+ * Used by the .conf parser around large route loads.  The advisory
+ * (*,G) overlap scan is skipped, exact duplicates are still caught by
+ * the hash indexes, and the kernel setsockopt() calls are handed to
+ * the loader pool so they overlap with parsing on multi-core systems.
+ */
+void mroute4_bulk_begin(void)
+{
+	bulk_mode = 1;
+	bulk_count = 0;
+	loader_start();
+}
+
+/**
+ * mroute4_bulk_end - End bulk loading routes
+ *
+ * Drains and stops the loader pool, so all routes have hit the kernel
+ * before the caller continues with sweeps or logs the result.
+ *
+ * Returns:
+ * Number of routes added since mroute4_bulk_begin().
+ */
+int mroute4_bulk_end(void)
+{
+	struct mrt4_table *saved = t4;
+
+	loader_stop();
+	bulk_mode = 0;
+
+	/* Publish the reloaded rule tables to the upcall worker */
+	t4 = table4_default;
+	conf4_snap_update();
+	t4 = saved;
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+	conf6_snap_update();
+#endif
+
+	return bulk_count;
+}
+
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+#ifdef __linux__
+#define IPV6_ALL_MC_FORWARD "/proc/sys/net/ipv6/conf/all/mc_forwarding"
+
+static int proc_set_val(char *file, int val)
+{
+	int fd, result = 0;
+
+	fd = open(file, O_WRONLY);
+	if (fd < 0)
+		return 1;
+
+	if (-1 == write(fd, "1", val))
+		result = 1;
+
+	close(fd);
+
+	return result;
+}
+#endif /* Linux only */
+
+/*
+ * Build and issue the MRT6_ADD_MFC call, shared with the upcall worker
+ * thread, so no logging or other shared daemon state in here.
+ */
+static int kern_add6_raw(struct mroute6 *route)
+{
+	struct mf6cctl mc;
+	size_t i;
+
+	if (mroute6_socket == -1)
+		return 0;
+
+	memset(&mc, 0, sizeof(mc));
+	mc.mf6cc_origin   = route->source;
+	mc.mf6cc_mcastgrp = route->group;
+	mc.mf6cc_parent   = route->inbound;
+
+	/* copy the outgoing MIFs */
+	for (i = 0; i < NELEMS(route->ttl); i++) {
+		if (route->ttl[i] > 0)
+			IF_SET(i, &mc.mf6cc_ifset);
+	}
+
+	return setsockopt(mroute6_socket, IPPROTO_IPV6, MRT6_ADD_MFC, (void *)&mc, sizeof(mc));
+}
+
+/* Actually set in kernel - called by mroute6_add() and mroute6_dyn_add() */
+static int kern_add6(struct mroute6 *route, int active)
+{
+	char origin[INET6_ADDRSTRLEN], group[INET6_ADDRSTRLEN];
+
+	if (mroute6_socket == -1)
+		return 0;
+
+	/* During bulk load the pool overlaps the setsockopt() with parsing */
+	if (!bulk_mode || loader_queue6(mroute6_socket, route)) {
+		if (kern_add6_raw(route)) {
+			smclog(LOG_DEBUG, "failed adding IPv6 multicast route: %s", strerror(errno));
+			return 1;
+		}
+	}
+
+	if (active)
+		smclog(LOG_DEBUG, "Add %s -> %s from MIF %d",
+		       inet_ntop(AF_INET6, &route->source.sin6_addr, origin, INET6_ADDRSTRLEN),
+		       inet_ntop(AF_INET6, &route->group.sin6_addr, group, INET6_ADDRSTRLEN),
+		       route->inbound);
+
+	return 0;
+}
+
+/* Actually remove from kernel - called by mroute6_del() */
+static int kern_del6(struct mroute6 *route)
+{
+	char origin[INET6_ADDRSTRLEN], group[INET6_ADDRSTRLEN];
+	struct mf6cctl mc;
+
+	if (mroute6_socket == -1)
+		return 0;
+
+	/* A queued bulk add for this route must not land after the del */
+	if (bulk_mode)
+		loader_drain();
+
+	memset(&mc, 0, sizeof(mc));
+	mc.mf6cc_origin = route->source;
+	mc.mf6cc_mcastgrp = route->group;
+	if (setsockopt(mroute6_socket, IPPROTO_IPV6, MRT6_DEL_MFC, (void *)&mc, sizeof(mc))) {
+		if (ENOENT == errno)
+			smclog(LOG_DEBUG, "failed removing multicast route, does not exist.");
+		else
+			smclog(LOG_DEBUG, "failed removing IPv6 multicast route: %s", strerror(errno));
 		return 1;
 	}
 
-	entry = malloc(sizeof(struct mroute4));
-	if (!entry) {
-		smclog(LOG_WARNING, "Cannot add multicast route: %s", strerror(errno));
-		return 1;
-	}
+	smclog(LOG_DEBUG, "Del %s -> %s",
+	       inet_ntop(AF_INET6, &mc.mf6cc_origin.sin6_addr, origin, INET6_ADDRSTRLEN),
+	       inet_ntop(AF_INET6, &mc.mf6cc_mcastgrp.sin6_addr, group, INET6_ADDRSTRLEN));
+
+	return 0;
+}
+
+/*
+ * Add route to kernel if it matches a known (*,G) rule, symmetric with
+ * mroute4_dyn_add() but the rule lookup is a hash probe, not a list scan.
+ */
+static int mroute6_dyn_add(struct mroute6 *route)
+{
+	struct mroute6 *entry, *new_entry;
+	int ret;
+
+	/* Already installed, kernel upcalls may race route installation */
+	entry = hash_find6(route);
+	if (entry) {
+		errno = is_active6(entry) ? EEXIST : ENOENT;
+		return -1;
+	}
+
+	entry = conf_hash_find6(route);
+	if (entry) {
+		/* Use configured template (*,G) outbound interfaces. */
+		memcpy(route->ttl, entry->ttl, NELEMS(route->ttl) * sizeof(route->ttl[0]));
+	} else {
+		/*
+		 * No match, add entry without outbound interfaces
+		 * nevertheless to avoid continuous cache misses from
+		 * the kernel. Note that this still gets reported as an
+		 * error (ENOENT) below.
+		 */
+		memset(route->ttl, 0, NELEMS(route->ttl) * sizeof(route->ttl[0]));
+	}
+
+	ret = kern_add6(route, entry ? 1 : 0);
+	if (ret)
+		return ret;
+
+	/*
+	 * Track learned (S,G), so the user can remove the (*,G) rule from
+	 * the command line and have the spawned routes follow.  As for
+	 * IPv4, alloc failure just leaves the kernel route untracked.
+	 */
+	new_entry = pool_alloc(&mroute6_pool);
+	if (new_entry) {
+		memcpy(new_entry, route, sizeof(struct mroute6));
+		new_entry->dyn = 1;
+		LIST_INSERT_HEAD(&mroute6_dyn_list, new_entry, link);
+		hash_add6(new_entry);
+		mif_index_add6(new_entry);
+		shm_route6_add(new_entry);
+	}
+
+	/* Signal to cache handler we've added a stop filter */
+	if (!entry) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	return 0;
+}
 
-	memcpy(entry, route, sizeof(struct mroute4));
+/* Process one MLD message or kernel upcall from the mroute6 socket */
+static void nocache6_process(char *tmp)
+{
+	struct mrt6msg *im6 = (struct mrt6msg *)tmp;
+	char origin[INET6_ADDRSTRLEN], group[INET6_ADDRSTRLEN];
+	struct mroute6 mroute;
+	struct mroute mrt;
 
-	/*
-	 * For (*,G) we save to a linked list to be added on-demand when
-	 * the kernel sends IGMPMSG_NOCACHE.
-	 */
-	if (route->source.s_addr == htonl(INADDR_ANY)) {
-		struct mroute4 *dyn, *tmp;
+	/* packets sent up from kernel to daemon have im6_mbz = 0 */
+	if (im6->im6_mbz != 0 || im6->im6_msgtype != MRT6MSG_NOCACHE)
+		return;
 
-		LIST_INSERT_HEAD(&mroute4_conf_list, entry, link);
+	memset(&mroute, 0, sizeof(mroute));
+	mroute.source.sin6_addr = im6->im6_src;
+	mroute.group.sin6_addr  = im6->im6_dst;
+	mroute.inbound          = im6->im6_mif;
 
-		/* Also, immediately expire any currently blocked traffic */
-		LIST_FOREACH_SAFE(dyn, &mroute4_dyn_list, link, tmp) {
-			if (!is_active4(dyn) && is_match4(entry, dyn)) {
-				kern_del4(dyn, 0);
-				LIST_REMOVE(dyn, link);
-				free(dyn);
-				break;
-			}
-		}
+	inet_ntop(AF_INET6, &mroute.group.sin6_addr,  group,  INET6_ADDRSTRLEN);
+	inet_ntop(AF_INET6, &mroute.source.sin6_addr, origin, INET6_ADDRSTRLEN);
+	smclog(LOG_DEBUG, "New multicast data from %s to group %s on MIF %d", origin, group, mroute.inbound);
 
-		return 0;
+	/* Find any matching route for this group on that iif. */
+	if (mroute6_dyn_add(&mroute)) {
+		/* Same policy as IPv4, see nocache4_process() */
+		if (ENOENT == errno)
+			smclog(LOG_INFO, "Multicast from %s, group %s, on MIF %d does not match any (*,G) rule",
+			       origin, group, mroute.inbound);
+		return;
 	}
 
-	LIST_INSERT_HEAD(&mroute4_static_list, entry, link);
-	return kern_add4(route, 1);
+	mrt.version = 6;
+	mrt.u.mroute6 = mroute;
+	script_exec(&mrt);
 }
 
-/* Remove from kernel and linked list */
-static int do_mroute4_del(struct mroute4 *entry)
+/*
+ * Receive MLD packets and MRT6MSG_NOCACHE upcalls for (*,G) routing,
+ * drained in a batch like handle_nocache4().
+ */
+static void handle_nocache6(int sd, void *arg)
 {
-	int ret;
-
-	ret = kern_del4(entry, is_active4(entry));
-	if (ret && ENOENT != errno)
-		return ret;
+	int budget = NOCACHE_BUDGET;
+	char tmp[128];
+	ssize_t result;
 
-	/* Also remove on ENOENT */
-	LIST_REMOVE(entry, link);
-	free(entry);
+	(void)arg;
+	while (budget-- > 0) {
+		memset(tmp, 0, sizeof(tmp));
+		result = recv(sd, tmp, sizeof(tmp), MSG_DONTWAIT);
+		if (result < 0) {
+			if (EAGAIN != errno && EWOULDBLOCK != errno)
+				smclog(LOG_WARNING, "Failed reading MLD message from kernel: %s", strerror(errno));
+			break;
+		}
 
-	return ret;
+		nocache6_process(tmp);
+	}
 }
 
-/**
- * mroute4_del - Remove route from kernel, or all matching routes if wildcard
- * @route: Pointer to struct mroute4 IPv4 multicast route to remove
- *
- * Removes the given multicast @route from the kernel multicast routing
- * table, or if the @route is a wildcard, then all matching kernel
- * routes are removed, as well as the wildcard.
- *
- * Returns:
- * POSIX OK(0) on success, non-zero on error with @errno set.
- */
-int mroute4_del(struct mroute4 *route)
+/* IPv6 counterpart of mroute4_upcall_drain(), worker thread side */
+void mroute6_upcall_drain(int sd)
 {
-	struct mroute4 *entry, *set, *tmp;
+	struct conf6_snap *snap;
+	int pushed = 0;
+	char tmp[128];
 
-	if (route->source.s_addr != htonl(INADDR_ANY)) {
-		LIST_FOREACH_SAFE(entry, &mroute4_static_list, link, tmp) {
-			if (!is_exact_match4(entry, route))
-				continue;
+	snap = __atomic_load_n(&conf6_snap, __ATOMIC_ACQUIRE);
+	if (snap)
+		__atomic_store_n(&snap6_seen, snap->gen, __ATOMIC_RELEASE);
 
-			return do_mroute4_del(entry);
-		}
+	while (1) {
+		struct mrt6msg *im6 = (struct mrt6msg *)tmp;
+		struct mroute6 mroute, *entry;
+		struct timespec t0, t1;
+		struct upcall *uc;
 
-		/* Not found in static list, check if spawned from a (*,G) rule. */
-		LIST_FOREACH_SAFE(entry, &mroute4_dyn_list, link, tmp) {
-			if (!is_exact_match4(entry, route))
-				continue;
+		if (recv(sd, tmp, sizeof(tmp), MSG_DONTWAIT) < 0)
+			break;	/* drained, or socket going down */
 
-			return do_mroute4_del(entry);
-		}
+		if (im6->im6_mbz != 0 || im6->im6_msgtype != MRT6MSG_NOCACHE)
+			continue;
 
-		errno = ENOENT;
-		return -1;
+		if (im6->im6_mif >= MAXMIFS)
+			continue;
+
+		uc = worker_reserve();
+		if (!uc)
+			continue;	/* ring full, kernel repeats the upcall */
+
+		memset(&mroute, 0, sizeof(mroute));
+		mroute.source.sin6_addr = im6->im6_src;
+		mroute.group.sin6_addr  = im6->im6_dst;
+		mroute.inbound          = im6->im6_mif;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		entry = snap ? snap_match6(snap, &mroute) : NULL;
+		if (entry)
+			memcpy(mroute.ttl, entry->ttl, NELEMS(mroute.ttl) * sizeof(mroute.ttl[0]));
+
+		memset(uc, 0, sizeof(*uc));
+		uc->version   = 6;
+		uc->matched   = entry ? 1 : 0;
+		uc->inbound   = mroute.inbound;
+		uc->source6   = mroute.source.sin6_addr;
+		uc->group6    = mroute.group.sin6_addr;
+		memcpy(uc->ttl, mroute.ttl, NELEMS(mroute.ttl) * sizeof(mroute.ttl[0]));
+
+		uc->installed = kern_add6_raw(&mroute) ? 0 : 1;
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		uc->latency = (uint32_t)((t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec));
+
+		worker_commit();
+		pushed++;
 	}
 
-	/* Find matching (*,G) ... and interface .. and prefix length. */
-	LIST_FOREACH_SAFE(entry, &mroute4_conf_list, link, tmp) {
-		int ret = 0;
+	if (pushed)
+		worker_notify();
+}
 
-		if (!is_match4(entry, route) || entry->len != route->len)
-			continue;
+/* IPv6 counterpart of upcall4_process(), control thread side */
+static void upcall6_process(struct upcall *uc)
+{
+	char origin[INET6_ADDRSTRLEN], group[INET6_ADDRSTRLEN];
+	struct mroute6 mroute, *entry, *new_entry;
+	struct mroute mrt;
 
-		/* Remove all (S,G) routes spawned from the (*,G) as well ... */
-		LIST_FOREACH_SAFE(set, &mroute4_dyn_list, link, tmp) {
-			if (!is_match4(entry, set) || entry->len != route->len)
-				continue;
+	stats.upcalls++;
 
-			ret += do_mroute4_del(set);
-		}
+	memset(&mroute, 0, sizeof(mroute));
+	mroute.source.sin6_addr = uc->source6;
+	mroute.group.sin6_addr  = uc->group6;
+	mroute.inbound          = uc->inbound;
+	memcpy(mroute.ttl, uc->ttl, NELEMS(mroute.ttl) * sizeof(mroute.ttl[0]));
 
-		if (!ret) {
-			LIST_REMOVE(entry, link);
-			free(entry);
-		}
+	inet_ntop(AF_INET6, &mroute.group.sin6_addr,  group,  INET6_ADDRSTRLEN);
+	inet_ntop(AF_INET6, &mroute.source.sin6_addr, origin, INET6_ADDRSTRLEN);
+	smclog(LOG_DEBUG, "New multicast data from %s to group %s on MIF %d", origin, group, mroute.inbound);
 
-		return ret;
+	if (!uc->installed) {
+		stats.kern_add_fail++;
+		smclog(LOG_WARNING, "failed adding IPv6 multicast route for (%s,%s)", origin, group);
+		return;
 	}
 
-	errno = ENOENT;
-	return -1;
-}
+	/* Duplicate upcall within a burst, already tracked */
+	if (hash_find6(&mroute))
+		return;
 
-#ifdef HAVE_IPV6_MULTICAST_ROUTING
-#ifdef __linux__
-#define IPV6_ALL_MC_FORWARD "/proc/sys/net/ipv6/conf/all/mc_forwarding"
+	if (!uc->matched) {
+		/* Snapshot may trail the live rule table, see upcall4_process() */
+		entry = conf_hash_find6(&mroute);
+		if (entry) {
+			memcpy(mroute.ttl, entry->ttl, NELEMS(mroute.ttl) * sizeof(mroute.ttl[0]));
+			if (!kern_add6(&mroute, 1))
+				uc->matched = 1;
+		}
+	} else
+		smclog(LOG_DEBUG, "Add %s -> %s from MIF %d", origin, group, mroute.inbound);
 
-static int proc_set_val(char *file, int val)
-{
-	int fd, result = 0;
+	new_entry = pool_alloc(&mroute6_pool);
+	if (new_entry) {
+		memcpy(new_entry, &mroute, sizeof(struct mroute6));
+		new_entry->dyn = 1;
+		LIST_INSERT_HEAD(&mroute6_dyn_list, new_entry, link);
+		hash_add6(new_entry);
+		mif_index_add6(new_entry);
+		shm_route6_add(new_entry);
+	}
 
-	fd = open(file, O_WRONLY);
-	if (fd < 0)
-		return 1;
+	if (!uc->matched) {
+		stats.upcall_nomatch++;
+		smclog(LOG_INFO, "Multicast from %s, group %s, on MIF %d does not match any (*,G) rule",
+		       origin, group, mroute.inbound);
+		return;
+	}
+	stats_lat_sample(uc->latency);
 
-	if (-1 == write(fd, "1", val))
-		result = 1;
+	mrt.version = 6;
+	mrt.u.mroute6 = mroute;
+	script_exec(&mrt);
+}
+#endif /* HAVE_IPV6_MULTICAST_ROUTING */
 
-	close(fd);
+/**
+ * mroute_upcall - Process one upcall handed over by the worker thread
+ * @uc: Upcall record popped from the handoff ring
+ */
+void mroute_upcall(struct upcall *uc)
+{
+	struct mrt4_table *saved = t4;
 
-	return result;
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+	if (uc->version == 6) {
+		upcall6_process(uc);
+		return;
+	}
+#endif
+	/* The worker thread serves the default table only */
+	t4 = table4_default;
+	upcall4_process(uc);
+	t4 = saved;
 }
-#endif /* Linux only */
 
-/*
- * Receive and drop ICMPv6 stuff. This is either MLD packets or upcall
- * messages sent up from the kernel.
+/**
+ * mroute_upcall_attach - Hand the kernel upcall sockets to a worker thread
  *
- * XXX: Currently MRT6MSG_NOCACHE messages for IPv6 (*,G) is unsupported.
+ * Called once at startup, after the routing sockets are enabled and the
+ * initial configuration is loaded.  When no worker thread can be started
+ * the inline handlers registered by mroute4_enable()/mroute6_enable()
+ * keep servicing upcalls from the event loop, as before.
  */
-static void handle_nocache6(int sd, void *arg)
+void mroute_upcall_attach(void)
 {
-	int result;
-	char tmp[128];
+	struct mrt4_table *saved = t4;
+	int sd4 = -1, sd6 = -1;
 
-	(void)arg;
-	result = read(sd, tmp, sizeof(tmp));
-	if (result < 0)
-		smclog(LOG_INFO, "Failed clearing MLD message from kernel: %s", strerror(errno));
+	if (table4_default)
+		sd4 = table4_default->sd;
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+	sd6 = mroute6_socket;
+#endif
+	if (sd4 < 0 && sd6 < 0)
+		return;
+
+	/*
+	 * The worker serves the default table only, additional .conf
+	 * `table` sections keep their inline upcall handlers.
+	 */
+	upcall_worker = 1;
+	t4 = table4_default;
+	conf4_snap_update();
+	t4 = saved;
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+	conf6_snap_update();
+#endif
+	if (worker_start(sd4, sd6)) {
+		smclog(LOG_WARNING, "No upcall worker thread, falling back to inline upcall handling.");
+		upcall_worker = 0;
+		return;
+	}
+
+	/* The worker owns the upcall path now, stop polling the sockets */
+	if (sd4 >= 0)
+		socket_deregister(sd4);
+	if (sd6 >= 0)
+		socket_deregister(sd6);
+
+	smclog(LOG_DEBUG, "Kernel upcalls handled by dedicated worker thread");
 }
-#endif /* HAVE_IPV6_MULTICAST_ROUTING */
 
 /**
  * mroute6_enable - Initialise IPv6 multicast routing
@@ -923,6 +2953,12 @@ int mroute6_enable(int do_vifs, int table_id)
 			mroute6_add_mif(iface);
 	}
 
+	LIST_INIT(&mroute6_conf_list);
+	LIST_INIT(&mroute6_dyn_list);
+	LIST_INIT(&mroute6_static_list);
+	hash_init6();
+	pool_init(&mroute6_pool, sizeof(struct mroute6), 256);
+
 	return 0;
 error:
 	socket_close(mroute6_socket);
@@ -943,11 +2979,23 @@ void mroute6_disable(void)
 	if (mroute6_socket < 0)
 		return;
 
+	/* Reclaim the upcall sockets from the worker thread first */
+	worker_stop();
+	upcall_worker = 0;
+	conf6_snap_exit();
+
 	if (setsockopt(mroute6_socket, IPPROTO_IPV6, MRT6_DONE, NULL, 0))
 		smclog(LOG_WARNING, "Failed shutting down IPv6 multicast routing socket: %s", strerror(errno));
 
 	socket_close(mroute6_socket);
 	mroute6_socket = -1;
+
+	/* Bulk release all (*,G), (S,G) and static routes on SIGHUP */
+	LIST_INIT(&mroute6_conf_list);
+	LIST_INIT(&mroute6_dyn_list);
+	LIST_INIT(&mroute6_static_list);
+	hash_init6();
+	pool_exit(&mroute6_pool);
 #endif /* HAVE_IPV6_MULTICAST_ROUTING */
 }
 
@@ -962,6 +3010,10 @@ static int mroute6_add_mif(struct iface *iface)
 	if (mroute6_socket == -1)
 		return 0;
 
+	/* Reload case, MIF already registered with the kernel */
+	if (iface->mif >= 0)
+		return 0;
+
 	if ((iface->flags & IFF_MULTICAST) != IFF_MULTICAST) {
 		smclog(LOG_INFO, "Interface %s is not multicast capable, skipping MIF.", iface->name);
 		iface->mif = -1;
@@ -1005,107 +3057,370 @@ static int mroute6_add_mif(struct iface *iface)
 
 	iface->mif = mif;
 	mif_list[mif].iface = iface;
+	shm_mif_add(mif, iface->name);
+
+	/*
+	 * Routes still referencing the slot from before the flap, same
+	 * policy as mroute4_add_vif(): reinstall for the returning owner,
+	 * purge stale references when another interface claimed the slot.
+	 */
+	if (mif_list[mif].stale && mif_list[mif].stale != iface) {
+		struct mroute6 *route, *tmp;
+
+		LIST_FOREACH_SAFE(route, &mif_list[mif].routes, mlink[mif], tmp) {
+			if (route->inbound == mif) {
+				LIST_REMOVE(route, link);
+				LIST_REMOVE(route, hlink);
+				mif_index_del6(route);
+				shm_route6_del(route);
+				pool_free(&mroute6_pool, route);
+				continue;
+			}
+
+			route->ttl[mif] = 0;
+			route->oifs &= ~(1u << mif);
+			LIST_REMOVE(route, mlink[mif]);
+			shm_route6_add(route);
+		}
+	} else if (mif_list[mif].stale) {
+		struct mroute6 *route;
+
+		LIST_FOREACH(route, &mif_list[mif].routes, mlink[mif]) {
+			/* Wait for the inbound MIF, its rebuild covers us */
+			if (!mif_list[route->inbound].iface)
+				continue;
+
+			if (kern_add6_raw(route))
+				stats.kern_add_fail++;
+		}
+	}
+	mif_list[mif].stale = NULL;
 
 	return 0;
 }
 
 static int mroute6_del_mif(struct iface *iface)
 {
-	int16_t mif = iface->mif;
+	struct mroute6 *route, *tmp;
+	int16_t mif = iface->mif;
+
+	if (mroute6_socket == -1)
+		return 0;
+
+	if (-1 == mif)
+		return 0;	/* No MIF setup for iface, skip */
+
+	smclog(LOG_DEBUG, "Removing  %-16s => MIF %-2d", iface->name, mif);
+
+	/* Kernel drops the MIF itself when the device unregisters */
+	if (setsockopt(mroute6_socket, IPPROTO_IPV6, MRT6_DEL_MIF, (void *)&mif, sizeof(mif)) &&
+	    errno != EADDRNOTAVAIL) {
+		smclog(LOG_ERR, "Failed deleting MIF for iface %s: %s", iface->name, strerror(errno));
+		return 1;
+	}
+
+	/*
+	 * Fan out over the reverse index, same policy as mroute4_del_vif():
+	 * learned routes are dropped, static routes with this inbound stay
+	 * tracked for the flap rebuild, outbound references are masked out
+	 * of the kernel entry while keeping the index intact.
+	 */
+	LIST_FOREACH_SAFE(route, &mif_list[mif].routes, mlink[mif], tmp) {
+		uint8_t ttl;
+
+		if (route->dyn) {
+			kern_del6(route);
+			LIST_REMOVE(route, link);
+			LIST_REMOVE(route, hlink);
+			mif_index_del6(route);
+			shm_route6_del(route);
+			pool_free(&mroute6_pool, route);
+			continue;
+		}
+
+		if (route->inbound == mif) {
+			kern_del6(route);
+			continue;
+		}
+
+		/* Inbound already down, no kernel entry to reprogram */
+		if (!mif_list[route->inbound].iface)
+			continue;
+
+		ttl = route->ttl[mif];
+		route->ttl[mif] = 0;
+		kern_add6_raw(route);
+		route->ttl[mif] = ttl;
+	}
+
+	mif_list[mif].iface = NULL;
+	mif_list[mif].stale = iface;
+	iface->mif = -1;
+	shm_mif_del(mif);
+
+	return 0;
+}
+
+/*
+ * Outbound interface set changed, update kernel and any spawned (S,G)
+ */
+static int mroute6_update(struct mroute6 *entry, struct mroute6 *route)
+{
+	struct mroute6 *dyn;
+	int ret = 0;
+
+	memcpy(entry->ttl, route->ttl, NELEMS(entry->ttl) * sizeof(entry->ttl[0]));
+	if (!IN6_IS_ADDR_UNSPECIFIED(&entry->source.sin6_addr)) {
+		mif_index_update6(entry);
+		shm_route6_add(entry);
+		return kern_add6(entry, 1);
+	}
+	entry->oifs = oifs_mask6(entry);	/* (*,G) rules are not indexed */
+	shm_route6_add(entry);
+
+	/* (*,G) template, reprogram all (S,G) routes spawned from it */
+	LIST_FOREACH(dyn, &mroute6_dyn_list, link) {
+		if (!is_match6(entry, dyn))
+			continue;
+
+		memcpy(dyn->ttl, entry->ttl, NELEMS(dyn->ttl) * sizeof(dyn->ttl[0]));
+		mif_index_update6(dyn);
+		shm_route6_add(dyn);
+		ret += kern_add6(dyn, is_active6(dyn));
+	}
+
+	return ret;
+}
+
+/**
+ * mroute6_add - Add route to kernel, or save a wildcard route for later use
+ * @route: Pointer to struct mroute6 IPv6 multicast route to add
+ *
+ * Adds the given multicast @route to the kernel multicast routing table
+ * unless the source is the unspecified address, i.e., a (*,G) route.
+ * Those we save and check against at runtime when the kernel signals us,
+ * same as for IPv4.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute6_add(struct mroute6 *route)
+{
+	struct mroute6 *entry;
+
+	if (mroute6_socket == -1)
+		return 0;
+
+	/*
+	 * First look for the exact same route, used by the .conf reload
+	 * mark-and-sweep to detect unchanged and modified entries.
+	 */
+	if (IN6_IS_ADDR_UNSPECIFIED(&route->source.sin6_addr)) {
+		entry = conf_hash_find6(route);
+		if (entry) {
+			int ret;
+
+			entry->unused = 0;
+			if (!memcmp(entry->ttl, route->ttl, sizeof(entry->ttl))) {
+				smclog(LOG_INFO, "(*,G) route already exists");
+				errno = EEXIST;
+				return 1;
+			}
+
+			ret = mroute6_update(entry, route);
+			if (!bulk_mode)
+				conf6_snap_update();
+
+			return ret;
+		}
+	} else {
+		entry = hash_find6(route);
+		if (entry && !entry->dyn) {
+			entry->unused = 0;
+			if (!memcmp(entry->ttl, route->ttl, sizeof(entry->ttl))) {
+				smclog(LOG_INFO, "Static route already exists");
+				errno = EEXIST;
+				return 1;
+			}
+
+			return mroute6_update(entry, route);
+		}
+	}
+
+	entry = pool_alloc(&mroute6_pool);
+	if (!entry) {
+		smclog(LOG_WARNING, "Cannot add IPv6 multicast route: %s", strerror(errno));
+		return 1;
+	}
+
+	memcpy(entry, route, sizeof(struct mroute6));
+
+	/*
+	 * For (*,G) we save the rule to be matched on-demand when the
+	 * kernel sends MRT6MSG_NOCACHE.
+	 */
+	if (IN6_IS_ADDR_UNSPECIFIED(&route->source.sin6_addr)) {
+		struct mroute6 *dyn, *tmp;
+
+		LIST_INSERT_HEAD(&mroute6_conf_list, entry, link);
+		conf_hash_add6(entry);
+		entry->oifs = oifs_mask6(entry);	/* (*,G) rules are not indexed */
+		shm_route6_add(entry);
+
+		/* Also, immediately expire any currently blocked traffic */
+		LIST_FOREACH_SAFE(dyn, &mroute6_dyn_list, link, tmp) {
+			if (!is_active6(dyn) && is_match6(entry, dyn)) {
+				kern_del6(dyn);
+				LIST_REMOVE(dyn, link);
+				LIST_REMOVE(dyn, hlink);
+				mif_index_del6(dyn);
+				shm_route6_del(dyn);
+				pool_free(&mroute6_pool, dyn);
+				break;
+			}
+		}
+
+		if (!bulk_mode)
+			conf6_snap_update();
+
+		return 0;
+	}
+
+	LIST_INSERT_HEAD(&mroute6_static_list, entry, link);
+	hash_add6(entry);
+	mif_index_add6(entry);
+	shm_route6_add(entry);
+
+	return kern_add6(route, 1);
+}
+
+/* Remove from kernel and linked list */
+static int do_mroute6_del(struct mroute6 *entry)
+{
+	int ret;
+
+	ret = kern_del6(entry);
+	if (ret && ENOENT != errno)
+		return ret;
+
+	/* Also remove on ENOENT */
+	LIST_REMOVE(entry, link);
+	LIST_REMOVE(entry, hlink);
+	mif_index_del6(entry);
+	shm_route6_del(entry);
+	pool_free(&mroute6_pool, entry);
+
+	return ret;
+}
+
+/* Remove a (*,G) rule and all (S,G) routes spawned from it */
+static int conf_mroute6_del(struct mroute6 *entry)
+{
+	struct mroute6 *set, *tmp;
+	int ret = 0;
 
-	if (mroute6_socket == -1)
-		return 0;
+	LIST_FOREACH_SAFE(set, &mroute6_dyn_list, link, tmp) {
+		if (!is_match6(entry, set))
+			continue;
 
-	if (-1 == mif)
-		return 0;	/* No MIF setup for iface, skip */
+		ret += do_mroute6_del(set);
+	}
 
-	smclog(LOG_DEBUG, "Removing  %-16s => MIF %-2d", iface->name, mif);
+	if (!ret) {
+		LIST_REMOVE(entry, link);
+		LIST_REMOVE(entry, hlink);
+		shm_route6_del(entry);
+		pool_free(&mroute6_pool, entry);
+	}
 
-	if (setsockopt(mroute6_socket, IPPROTO_IPV6, MRT6_DEL_MIF, (void *)&mif, sizeof(mif)))
-		smclog(LOG_ERR, "Failed deleting MIF for iface %s: %s", iface->name, strerror(errno));
-	else
-		iface->mif = -1;
+	if (!bulk_mode)
+		conf6_snap_update();
 
-	return 0;
+	return ret;
 }
 
 /**
- * mroute6_add - Add route to kernel, or save a wildcard route for later use
- * @route: Pointer to struct mroute6 IPv6 multicast route to add
+ * mroute6_del - Remove route from kernel, or all matching routes if wildcard
+ * @route: Pointer to struct mroute6 IPv6 multicast route to remove
  *
- * Adds the given multicast @route to the kernel multicast routing table.
+ * Removes the given multicast @route from the kernel multicast routing
+ * table, or if the @route is a (*,G) wildcard, then all matching kernel
+ * routes are removed, as well as the wildcard.
  *
  * Returns:
  * POSIX OK(0) on success, non-zero on error with @errno set.
  */
-int mroute6_add(struct mroute6 *route)
+int mroute6_del(struct mroute6 *route)
 {
-	size_t i;
-	char origin[INET6_ADDRSTRLEN], group[INET6_ADDRSTRLEN];
-	struct mf6cctl mc;
+	struct mroute6 *entry;
 
 	if (mroute6_socket == -1)
 		return 0;
 
-	memset(&mc, 0, sizeof(mc));
-	mc.mf6cc_origin   = route->source;
-	mc.mf6cc_mcastgrp = route->group;
-	mc.mf6cc_parent   = route->inbound;
+	if (!IN6_IS_ADDR_UNSPECIFIED(&route->source.sin6_addr)) {
+		/* Finds static route, or if spawned from a (*,G) rule. */
+		entry = hash_find6(route);
+		if (entry)
+			return do_mroute6_del(entry);
 
-	/* copy the outgoing MIFs */
-	for (i = 0; i < NELEMS(route->ttl); i++) {
-		if (route->ttl[i] > 0)
-			IF_SET(i, &mc.mf6cc_ifset);
-	}
-	if (setsockopt(mroute6_socket, IPPROTO_IPV6, MRT6_ADD_MFC, (void *)&mc, sizeof(mc))) {
-		smclog(LOG_DEBUG, "failed adding IPv6 multicast route: %s", strerror(errno));
-		return 1;
+		/* Not tracked by us, try kernel anyway */
+		return kern_del6(route);
 	}
 
-	smclog(LOG_DEBUG, "Add %s -> %s from MIF %d",
-	       inet_ntop(AF_INET6, &mc.mf6cc_origin.sin6_addr, origin, INET6_ADDRSTRLEN),
-	       inet_ntop(AF_INET6, &mc.mf6cc_mcastgrp.sin6_addr, group, INET6_ADDRSTRLEN),
-	       mc.mf6cc_parent);
+	entry = conf_hash_find6(route);
+	if (entry)
+		return conf_mroute6_del(entry);
 
-	return 0;
+	errno = ENOENT;
+	return -1;
 }
+#endif /* HAVE_IPV6_MULTICAST_ROUTING */
 
 /**
- * mroute6_del - Remove route from kernel
- * @route: Pointer to struct mroute6 IPv6 multicast route to remove
+ * mroute6_mark_all - Mark all user configured IPv6 routes for sweeping
  *
- * Removes the given multicast @route from the kernel multicast routing
- * table.
+ * IPv6 counterpart of mroute4_mark_all(), used by the .conf reload.
+ */
+void mroute6_mark_all(void)
+{
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+	struct mroute6 *entry;
+
+	LIST_FOREACH(entry, &mroute6_conf_list, link)
+		entry->unused = 1;
+	LIST_FOREACH(entry, &mroute6_static_list, link)
+		entry->unused = 1;
+#endif
+}
+
+/**
+ * mroute6_sweep_all - Remove all IPv6 routes still marked as unused
  *
  * Returns:
- * POSIX OK(0) on success, non-zero on error with @errno set.
+ * Number of failed kernel route removals.
  */
-int mroute6_del(struct mroute6 *route)
+int mroute6_sweep_all(void)
 {
-	char origin[INET6_ADDRSTRLEN], group[INET6_ADDRSTRLEN];
-	struct mf6cctl mc;
+	int ret = 0;
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+	struct mroute6 *entry, *tmp;
 
-	if (mroute6_socket == -1)
-		return 0;
+	LIST_FOREACH_SAFE(entry, &mroute6_conf_list, link, tmp) {
+		if (!entry->unused)
+			continue;
 
-	memset(&mc, 0, sizeof(mc));
-	mc.mf6cc_origin = route->source;
-	mc.mf6cc_mcastgrp = route->group;
-	if (setsockopt(mroute6_socket, IPPROTO_IPV6, MRT6_DEL_MFC, (void *)&mc, sizeof(mc))) {
-		if (ENOENT == errno)
-			smclog(LOG_DEBUG, "failed removing multicast route, does not exist.");
-		else
-			smclog(LOG_DEBUG, "failed removing IPv6 multicast route: %s", strerror(errno));
-		return 1;
+		ret += conf_mroute6_del(entry);
 	}
 
-	smclog(LOG_DEBUG, "Del %s -> %s",
-	       inet_ntop(AF_INET6, &mc.mf6cc_origin.sin6_addr, origin, INET6_ADDRSTRLEN),
-	       inet_ntop(AF_INET6, &mc.mf6cc_mcastgrp.sin6_addr, group, INET6_ADDRSTRLEN));
+	LIST_FOREACH_SAFE(entry, &mroute6_static_list, link, tmp) {
+		if (!entry->unused)
+			continue;
 
-	return 0;
+		ret += do_mroute6_del(entry);
+	}
+#endif
+	return ret;
 }
-#endif /* HAVE_IPV6_MULTICAST_ROUTING */
 
 /* Used by file parser to add VIFs/MIFs after setup */
 int mroute_add_vif(char *ifname, uint8_t mrdisc, uint8_t threshold)
@@ -1117,9 +3432,15 @@ int mroute_add_vif(char *ifname, uint8_t mrdisc, uint8_t threshold)
 	smclog(LOG_DEBUG, "Adding %s to list of multicast routing interfaces", ifname);
 	iface_match_init(&state);
 	while ((iface = iface_match_by_name(ifname, &state))) {
+		struct mrt4_table *saved = t4, *tbl;
+
 		iface->mrdisc    = mrdisc;
 		iface->threshold = threshold;
-		ret += mroute4_add_vif(iface);
+		LIST_FOREACH(tbl, &table4_list, link) {
+			t4 = tbl;
+			ret += mroute4_add_vif(iface);
+		}
+		t4 = saved;
 #ifdef HAVE_IPV6_MULTICAST_ROUTING
 		ret += mroute6_add_mif(iface);
 #endif
@@ -1141,7 +3462,18 @@ int mroute_del_vif(char *ifname)
 	smclog(LOG_DEBUG, "Pruning %s from list of multicast routing interfaces", ifname);
 	iface_match_init(&state);
 	while ((iface = iface_match_by_name(ifname, &state))) {
+		struct mrt4_table *saved = t4, *tbl;
+
+		/* Default table last, it owns iface->vif and mrdisc */
+		LIST_FOREACH(tbl, &table4_list, link) {
+			if (tbl == table4_default)
+				continue;
+			t4 = tbl;
+			ret += mroute4_del_vif(iface);
+		}
+		t4 = table4_default;
 		ret += mroute4_del_vif(iface);
+		t4 = saved;
 #ifdef HAVE_IPV6_MULTICAST_ROUTING
 		ret += mroute6_del_mif(iface);
 #endif
@@ -1153,49 +3485,284 @@ int mroute_del_vif(char *ifname)
 		return ret;
 }
 
+/*
+ * Warm-restart state file: compact binary dump of the static and
+ * learned (S,G) routes plus the VIF assignments, written on shutdown
+ * and reloaded on start.  Fixed-size versioned records, so loading is
+ * a couple of read() calls instead of re-parsing the text config, and
+ * learned routes come back without waiting for new kernel upcalls.
+ *
+ * Each route record carries its kernel routing table id; the VIF map
+ * is written once since VIF numbering is identical on every table
+ * socket, see table4_create().
+ *
+ * Note: on Linux the kernel flushes the MFC when the routing socket
+ * closes, so a restart still interrupts forwarding briefly; the state
+ * file minimizes that window.
+ */
+#define STATE_MAGIC   0x534d4352u	/* "SMCR" */
+#define STATE_VERSION 2
+
+struct state_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t pad;
+	uint32_t num_vifs;
+	uint32_t num_routes;
+};
+
+struct state_vif {
+	int16_t vif;
+	char    ifname[IFNAMSIZ + 2];
+};
+
+struct state_route {
+	uint32_t source;	/* network order */
+	uint32_t group;
+	uint32_t table;		/* kernel routing table id */
+	int16_t  inbound;	/* VIF at save time, translated on load */
+	uint8_t  dyn;
+	uint8_t  len;
+	uint8_t  ttl[MAX_MC_VIFS];
+};
+
+static int state_write_route(FILE *fp, int table, struct mroute4 *entry)
+{
+	struct state_route r;
+
+	memset(&r, 0, sizeof(r));
+	r.source  = entry->source.s_addr;
+	r.group   = entry->group.s_addr;
+	r.table   = table;
+	r.inbound = entry->inbound;
+	r.dyn     = entry->dyn;
+	r.len     = entry->len;
+	memcpy(r.ttl, entry->ttl, sizeof(r.ttl));
+
+	return fwrite(&r, sizeof(r), 1, fp) != 1;
+}
+
+/**
+ * mroute4_state_save - Save routes and VIF map for warm restart
+ * @fn: State file path
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int mroute4_state_save(char *fn)
+{
+	struct state_hdr hdr = { STATE_MAGIC, STATE_VERSION, 0, 0, 0 };
+	struct mrt4_table *tbl;
+	struct mroute4 *entry;
+	size_t i;
+	FILE *fp;
+	int ret = 0;
+
+	if (!t4 || t4->sd < 0)
+		return 0;
+
+	for (i = 0; i < NELEMS(t4->vif_list); i++) {
+		if (t4->vif_list[i].iface)
+			hdr.num_vifs++;
+	}
+	LIST_FOREACH(tbl, &table4_list, link) {
+		LIST_FOREACH(entry, &tbl->static_list, link)
+			hdr.num_routes++;
+		TAILQ_FOREACH(entry, &tbl->dyn_list, tlink)
+			hdr.num_routes++;
+	}
+
+	fp = fopen(fn, "w");
+	if (!fp)
+		return -1;
+
+	ret += fwrite(&hdr, sizeof(hdr), 1, fp) != 1;
+	for (i = 0; i < NELEMS(t4->vif_list); i++) {
+		struct state_vif v;
+
+		if (!t4->vif_list[i].iface)
+			continue;
+
+		memset(&v, 0, sizeof(v));
+		v.vif = i;
+		strlcpy(v.ifname, t4->vif_list[i].iface->name, sizeof(v.ifname));
+		ret += fwrite(&v, sizeof(v), 1, fp) != 1;
+	}
+
+	LIST_FOREACH(tbl, &table4_list, link) {
+		LIST_FOREACH(entry, &tbl->static_list, link)
+			ret += state_write_route(fp, tbl->id, entry);
+		TAILQ_FOREACH(entry, &tbl->dyn_list, tlink)
+			ret += state_write_route(fp, tbl->id, entry);
+	}
+
+	if (fclose(fp) || ret) {
+		unlink(fn);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * mroute4_state_load - Restore routes saved by mroute4_state_save()
+ * @fn: State file path
+ *
+ * Reinstalls all saved routes, translating VIF numbers via the saved
+ * interface names in case VIF assignment changed.  The state file is
+ * removed afterwards, it is only ever valid for one restart.
+ *
+ * Returns:
+ * Number of routes restored, zero if no usable state file exists.
+ */
+int mroute4_state_load(char *fn)
+{
+	int16_t map[MAX_MC_VIFS];
+	struct state_hdr hdr;
+	struct timespec now;
+	uint32_t i;
+	FILE *fp;
+	int num = 0;
+
+	if (!t4)
+		return 0;
+
+	fp = fopen(fn, "r");
+	if (!fp)
+		return 0;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != STATE_MAGIC || hdr.version != STATE_VERSION) {
+		smclog(LOG_WARNING, "Incompatible or corrupt state file %s, skipping.", fn);
+		goto done;
+	}
+
+	/* Translate saved VIF numbers to this run's assignments */
+	for (i = 0; i < NELEMS(map); i++)
+		map[i] = -1;
+	for (i = 0; i < hdr.num_vifs; i++) {
+		struct state_vif v;
+		struct iface *iface;
+
+		if (fread(&v, sizeof(v), 1, fp) != 1)
+			goto done;
+
+		if (v.vif < 0 || v.vif >= (int16_t)NELEMS(map))
+			continue;
+
+		iface = iface_find_by_name(v.ifname);
+		if (iface && iface->vif >= 0)
+			map[v.vif] = iface->vif;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < hdr.num_routes; i++) {
+		struct state_route r;
+		struct mroute4 route;
+		size_t vif;
+
+		if (fread(&r, sizeof(r), 1, fp) != 1)
+			goto done;
+
+		/* Records are grouped per table, switch creates on demand */
+		if ((int)r.table != t4->id && mroute4_table_select(r.table)) {
+			smclog(LOG_WARNING, "Failed restoring routing table %u: %s",
+			       r.table, strerror(errno));
+			continue;
+		}
+
+		if (r.inbound < 0 || r.inbound >= (int16_t)NELEMS(map) || map[r.inbound] < 0)
+			continue;
+
+		memset(&route, 0, sizeof(route));
+		route.source.s_addr = r.source;
+		route.group.s_addr  = r.group;
+		route.inbound       = map[r.inbound];
+		route.len           = r.len;
+		for (vif = 0; vif < NELEMS(r.ttl); vif++) {
+			if (r.ttl[vif] && map[vif] >= 0)
+				route.ttl[map[vif]] = r.ttl[vif];
+		}
+		route.oifs = oifs_mask4(&route);
+
+		if (!r.dyn) {
+			if (!mroute4_add(&route))
+				num++;
+			continue;
+		}
+
+		/* Learned (S,G), restore without waiting for an upcall */
+		if (!kern_add4(&route, is_active4(&route))) {
+			struct mroute4 *entry;
+
+			entry = pool_alloc(&t4->pool);
+			if (entry) {
+				memcpy(entry, &route, sizeof(*entry));
+				entry->dyn       = 1;
+				entry->last_use  = now.tv_sec;
+				entry->valid_pkt = 0;
+				TAILQ_INSERT_TAIL(&t4->dyn_list, entry, tlink);
+				hash_add4(entry);
+				vif_index_add4(entry);
+				shm_route4_add(t4->id, entry);
+				route4_event(EVENT_ROUTE_ADD, entry);
+			}
+			num++;
+		}
+	}
+
+	if (num)
+		smclog(LOG_NOTICE, "Restored %d multicast routes from %s", num, fn);
+done:
+	mroute4_table_reset();
+	fclose(fp);
+	unlink(fn);
+
+	return num;
+}
+
 #ifdef ENABLE_CLIENT
 static int show_mroute(int sd, struct mroute4 *r, int detail)
 {
-	int vif;
-	char src[INET_ADDRSTRLEN] = "*";
-	char grp[INET_ADDRSTRLEN];
-	char sg[INET_ADDRSTRLEN * 2 + 5];
-	char buf[MAX_MC_VIFS * 17 + 80];
+	/* Backs queued, not yet flushed, iovec entries in ipc_queue() */
+	static char arena[IPC_IOV_MAX][sizeof(struct show_msg) + (MAX_MC_VIFS + 1) * 17];
+	static int slot = 0;
+	struct show_msg *sm = (struct show_msg *)arena[slot];
+	size_t len, max = sizeof(arena[0]) - sizeof(*sm);
 	struct iface *i;
+	uint32_t oifs;
+	int vif;
 
-	if (r->source.s_addr != htonl(INADDR_ANY))
-		inet_ntop(AF_INET, &r->source, src, sizeof(src));
-	inet_ntop(AF_INET, &r->group, grp, sizeof(grp));
-
-	i = iface_find_by_vif(r->inbound);
-	snprintf(sg, sizeof(sg), "(%s, %s)", src, grp);
-	snprintf(buf, sizeof(buf), "%-34s %-16s", sg, i->name);
+	memset(sm, 0, sizeof(*sm));
+	sm->type   = 'r';
+	sm->source = r->source.s_addr;
+	sm->group  = r->group.s_addr;
 
 	if (detail) {
-		char stats[20];
 		unsigned long p = 0, b = 0;
 
 		get_stats4(r, &p, &b, NULL);
-		snprintf(stats, sizeof(stats), " %10lu %10lu ", p, b);
-		strcat(buf, stats);
+		sm->pktcnt  = p;
+		sm->bytecnt = b;
 	}
 
-	for (vif = 0; vif < MAX_MC_VIFS; vif++) {
-		char tmp[22];
+	i = iface_find_by_vif(r->inbound);
+	len = snprintf(sm->ifname, max, "%s", i ? i->name : "?");
 
-		if (r->ttl[vif] == 0)
+	for (vif = 0, oifs = r->oifs; oifs; vif++, oifs >>= 1) {
+		if (!(oifs & 1))
 			continue;
 
 		i = iface_find_by_vif(vif);
 		if (!i)
 			continue;
 
-		snprintf(tmp, sizeof(tmp), " %s", i->name);
-		strcat(buf, tmp);
+		len += snprintf(sm->ifname + len, max - len, " %s", i->name);
 	}
-	strcat(buf, "\n");
+	sm->len = sizeof(*sm) + len + 1;
 
-	if (ipc_send(sd, buf, strlen(buf)) < 0) {
+	slot = (slot + 1) % IPC_IOV_MAX;
+	if (ipc_queue(sd, sm, sm->len) < 0) {
 		smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
 		return -1;
 	}
@@ -1203,28 +3770,184 @@ static int show_mroute(int sd, struct mroute4 *r, int detail)
 	return 0;
 }
 
-/* Write all (*,G) routes to client socket */
-int mroute_show(int sd, int detail)
+/* Heading line separating tables in the show output, type 't' is plain text */
+static int show_table_heading(int sd, int id)
+{
+	/* Backs queued, not yet flushed, iovec entries in ipc_queue() */
+	static char arena[IPC_IOV_MAX][sizeof(struct show_msg) + 32];
+	static int slot = 0;
+	struct show_msg *sm = (struct show_msg *)arena[slot];
+	int len;
+
+	memset(sm, 0, sizeof(*sm));
+	sm->type = 't';
+	len = snprintf(sm->ifname, sizeof(arena[0]) - sizeof(*sm), "\nTable %d:", id);
+	sm->len = sizeof(*sm) + len + 1;
+
+	slot = (slot + 1) % IPC_IOV_MAX;
+
+	return ipc_queue(sd, sm, sm->len);
+}
+
+static int show_table(int sd, int detail)
 {
 	struct mroute4 *r;
 
-	LIST_FOREACH(r, &mroute4_conf_list, link) {
+	LIST_FOREACH(r, &t4->conf_list, link) {
 		if (show_mroute(sd, r, detail) < 0)
 			return 1;
 	}
 
-	LIST_FOREACH(r, &mroute4_dyn_list, link) {
+	TAILQ_FOREACH(r, &t4->dyn_list, tlink) {
 		if (show_mroute(sd, r, detail) < 0)
 			return 1;
 	}
 
-	LIST_FOREACH(r, &mroute4_static_list, link) {
+	LIST_FOREACH(r, &t4->static_list, link) {
 		if (show_mroute(sd, r, detail) < 0)
 			return 1;
 	}
 
 	return 0;
 }
+
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+static int get_stats6(struct mroute6 *route, unsigned long *pktcnt, unsigned long *bytecnt)
+{
+	struct sioc_sg_req6 sg_req;
+
+	if (mroute6_socket == -1)
+		return -1;
+
+	memset(&sg_req, 0, sizeof(sg_req));
+	sg_req.src = route->source;
+	sg_req.grp = route->group;
+
+	if (ioctl(mroute6_socket, SIOCGETSGCNT_IN6, &sg_req) < 0)
+		return errno;
+
+	if (pktcnt)
+		*pktcnt = sg_req.pktcnt;
+	if (bytecnt)
+		*bytecnt = sg_req.bytecnt;
+
+	return 0;
+}
+
+/* IPv6 counterpart of show_mroute(), 16-byte addresses in a '6' record */
+static int show_mroute6(int sd, struct mroute6 *r, int detail)
+{
+	/* Backs queued, not yet flushed, iovec entries in ipc_queue() */
+	static char arena[IPC_IOV_MAX][sizeof(struct show6_msg) + (MAX_MC_MIFS + 1) * 17];
+	static int slot = 0;
+	struct show6_msg *sm = (struct show6_msg *)arena[slot];
+	size_t len, max = sizeof(arena[0]) - sizeof(*sm);
+	struct iface *i;
+	uint32_t oifs;
+	int mif;
+
+	memset(sm, 0, sizeof(*sm));
+	sm->type = '6';
+	memcpy(sm->source, &r->source.sin6_addr, sizeof(sm->source));
+	memcpy(sm->group,  &r->group.sin6_addr,  sizeof(sm->group));
+
+	if (detail) {
+		unsigned long p = 0, b = 0;
+
+		get_stats6(r, &p, &b);
+		sm->pktcnt  = p;
+		sm->bytecnt = b;
+	}
+
+	i = iface_find_by_mif(r->inbound);
+	len = snprintf(sm->ifname, max, "%s", i ? i->name : "?");
+
+	for (mif = 0, oifs = r->oifs; oifs; mif++, oifs >>= 1) {
+		if (!(oifs & 1))
+			continue;
+
+		i = iface_find_by_mif(mif);
+		if (!i)
+			continue;
+
+		len += snprintf(sm->ifname + len, max - len, " %s", i->name);
+	}
+	sm->len = sizeof(*sm) + len + 1;
+
+	slot = (slot + 1) % IPC_IOV_MAX;
+	if (ipc_queue(sd, sm, sm->len) < 0) {
+		smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int show_table6(int sd, int detail)
+{
+	struct mroute6 *r;
+
+	LIST_FOREACH(r, &mroute6_conf_list, link) {
+		if (show_mroute6(sd, r, detail) < 0)
+			return 1;
+	}
+
+	LIST_FOREACH(r, &mroute6_dyn_list, link) {
+		if (show_mroute6(sd, r, detail) < 0)
+			return 1;
+	}
+
+	LIST_FOREACH(r, &mroute6_static_list, link) {
+		if (show_mroute6(sd, r, detail) < 0)
+			return 1;
+	}
+
+	return 0;
+}
+#endif /* HAVE_IPV6_MULTICAST_ROUTING */
+
+/* Write all (*,G) routes to client socket, default table first */
+int mroute_show(int sd, int detail)
+{
+	struct mrt4_table *saved = t4, *tbl;
+	int ret = 0;
+
+	if (detail)
+		stats_refresh4();
+
+	if (table4_default) {
+		t4 = table4_default;
+		ret = show_table(sd, detail);
+	}
+
+	LIST_FOREACH(tbl, &table4_list, link) {
+		if (ret || tbl == table4_default)
+			continue;
+
+		t4 = tbl;
+		if (show_table_heading(sd, tbl->id) < 0) {
+			ret = 1;
+			break;
+		}
+		ret = show_table(sd, detail);
+	}
+	t4 = saved;
+
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+	if (!ret && mroute6_socket != -1)
+		ret = show_table6(sd, detail);
+#endif
+
+	if (ret)
+		return 1;
+
+	if (ipc_flush(sd) < 0) {
+		smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
 #endif
 
 /**
@@ -61,15 +61,29 @@
 
 struct mroute4 {
 	LIST_ENTRY(mroute4) link;
+	LIST_ENTRY(mroute4) hlink;	/* (S,G) hash bucket, internal to mroute.c */
+	TAILQ_ENTRY(mroute4) tlink;	/* dyn (S,G) in expiry order, oldest first */
 
 	struct in_addr source;
 	struct in_addr group;           /* multicast group */
 	short          len;		/* prefix len, or 0:disabled */
 
 	short          inbound;         /* incoming VIF    */
+	uint8_t        dyn;             /* set for (S,G) learned from a (*,G) rule */
+	uint8_t        unused;          /* mark-and-sweep flag for conf reload */
+	uint32_t       shm;             /* slot cookie in the show snapshot, 0:none */
+	uint32_t       oifs;            /* outbound VIF set as a bitmask, mirrors ttl[] */
 	uint8_t        ttl[MAX_MC_VIFS];/* outgoing VIFs   */
+
+	/* Per-VIF reverse index, internal to mroute.c: linked into the
+	 * list of every VIF referenced as inbound or outbound */
+	LIST_ENTRY(mroute4) vlink[MAX_MC_VIFS];
 	unsigned long  valid_pkt;       /* packet counter at last mroute4_dyn_expire() */
 	time_t         last_use;        /* timestamp of last forwarded packet */
+
+	unsigned long  pktcnt;          /* kernel counters, cached by stats_refresh4() */
+	unsigned long  bytecnt;
+	unsigned long  wrong_if;
 };
 
 /*
@@ -86,10 +100,21 @@ struct mroute4 {
 #endif
 
 struct mroute6 {
+	LIST_ENTRY(mroute6) link;
+	LIST_ENTRY(mroute6) hlink;	/* (S,G) or (*,G) hash bucket, internal to mroute.c */
+
 	struct sockaddr_in6 source;
 	struct sockaddr_in6 group;      /* multicast group */
-	short   inbound;                /* incoming VIF    */
-	uint8_t ttl[MAX_MC_MIFS];       /* outgoing VIFs   */
+	short   inbound;                /* incoming MIF    */
+	uint8_t dyn;                    /* set for (S,G) learned from a (*,G) rule */
+	uint8_t unused;                 /* mark-and-sweep flag for conf reload */
+	uint32_t shm;                   /* slot cookie in the show snapshot, 0:none */
+	uint32_t oifs;                  /* outbound MIF set as a bitmask, mirrors ttl[] */
+	uint8_t ttl[MAX_MC_MIFS];       /* outgoing MIFs   */
+
+	/* Per-MIF reverse index, internal to mroute.c: linked into the
+	 * list of every MIF referenced as inbound or outbound */
+	LIST_ENTRY(mroute6) mlink[MAX_MC_MIFS];
 };
 
 /*
@@ -105,15 +130,34 @@ struct mroute {
 
 int  mroute4_enable    (int do_vifs, int table_id, int timeout);
 void mroute4_disable   (void);
+int  mroute4_table_select(int id);
+void mroute4_table_reset (void);
+void *mroute4_table_pin  (void);
+void mroute4_table_restore(void *cookie);
 int  mroute4_dyn_add   (struct mroute4 *mroute);
 void mroute4_dyn_expire(int max_idle);
 int  mroute4_add       (struct mroute4 *mroute);
 int  mroute4_del       (struct mroute4 *mroute);
+void mroute4_mark_all  (void);
+int  mroute4_sweep_all (void);
+void mroute4_bulk_begin(void);
+int  mroute4_bulk_end  (void);
+int  mroute4_state_save(char *fn);
+int  mroute4_state_load(char *fn);
 
 int  mroute6_enable    (int do_vifs, int table_id);
 void mroute6_disable   (void);
 int  mroute6_add       (struct mroute6 *mroute);
 int  mroute6_del       (struct mroute6 *mroute);
+void mroute6_mark_all  (void);
+int  mroute6_sweep_all (void);
+
+struct upcall;
+
+void mroute_upcall_attach(void);
+void mroute_upcall       (struct upcall *uc);
+void mroute4_upcall_drain(int sd);
+void mroute6_upcall_drain(int sd);
 
 int  mroute_add_vif    (char *ifname, uint8_t mrdisc, uint8_t threshold);
 int  mroute_del_vif    (char *ifname);
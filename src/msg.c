@@ -25,11 +25,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "ipc.h"
 #include "log.h"
 #include "msg.h"
 #include "ifvc.h"
 #include "mroute.h"
 #include "mcgroup.h"
+#include "stats.h"
 
 extern int running;
 extern void reload(int signo);
@@ -336,6 +338,9 @@ static int do_show(struct ipc_msg *msg, int sd, int detail)
 	if (msg->argv[0][0] == 'g')
 		return mcgroup_show(sd, detail);
 
+	if (msg->argv[0][0] == 's')
+		return stats_show(sd);
+
 	return mroute_show(sd, detail);
 }
 
@@ -349,9 +354,15 @@ int msg_do(int sd, struct ipc_msg *msg)
 
 	switch (msg->cmd) {
 	case 'a':
-	case 'r':
+	case 'r': {
+		/* A sliced reload may be paused on a .conf `table` section,
+		 * client routes always go in the default table */
+		void *cookie = mroute4_table_pin();
+
 		result = do_mroute(msg);
+		mroute4_table_restore(cookie);
 		break;
+	}
 
 	case 'j':
 	case 'l':
@@ -370,6 +381,10 @@ int msg_do(int sd, struct ipc_msg *msg)
 		running = 0;
 		break;
 
+	case 'm':
+		result = ipc_monitor(sd);
+		break;
+
 	case 'S':
 		result = do_show(msg, sd, 1);
 		break;
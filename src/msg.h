@@ -45,6 +45,62 @@ struct ipc_msg {
 	char    *argv[0]; 	/* 'count' * '\0' terminated strings + '\0' */
 };
 
+/*
+ * Binary reply record for the show commands.  The daemon batches many
+ * of these per writev() and smcroutectl does all text formatting, so
+ * dumping tens of thousands of routes no longer costs one snprintf()
+ * and one write() each in the daemon's event loop.  Client and daemon
+ * always run on the same host, so native byte order is fine; len is
+ * the length prefix allowing the record to grow.
+ */
+struct show_msg {
+	uint16_t len;		/* total record length, incl. ifname */
+	uint8_t  type;		/* 'r'=mroute, 'g'=group */
+	uint8_t  pad[5];	/* align counters */
+	uint64_t pktcnt;	/* kernel counters, detailed show only */
+	uint64_t bytecnt;
+	uint32_t source;	/* IPv4, network order, INADDR_ANY => (*,G) */
+	uint32_t group;
+	char     ifname[0];	/* inbound, then space separated outbound */
+};
+
+/*
+ * IPv6 variant of struct show_msg, kept separate so the common IPv4
+ * record stays compact.  Same length-prefixed framing, distinguished
+ * by the type byte.
+ */
+struct show6_msg {
+	uint16_t len;		/* total record length, incl. ifname */
+	uint8_t  type;		/* '6'=IPv6 mroute */
+	uint8_t  pad[5];	/* align counters */
+	uint64_t pktcnt;	/* kernel counters, detailed show only */
+	uint64_t bytecnt;
+	uint8_t  source[16];	/* in6_addr, unspecified => (*,G) */
+	uint8_t  group[16];
+	char     ifname[0];	/* inbound, then space separated outbound */
+};
+
+/*
+ * Binary event record pushed to `smcroutectl monitor` subscribers, a
+ * cheap alternative to forking the event script once per installed
+ * route.  Same native byte order rationale as struct show_msg; len is
+ * the length prefix allowing the record to grow.
+ */
+struct event_msg {
+	uint16_t len;		/* total record length, incl. ifname */
+	uint8_t  type;		/* see EVENT_* below */
+	uint8_t  pad;
+	uint32_t table;		/* kernel routing table id */
+	uint32_t source;	/* IPv4, network order, INADDR_ANY => (*,G) */
+	uint32_t group;
+	char     ifname[0];	/* interface name, VIF events only */
+};
+
+#define EVENT_ROUTE_ADD	'+'	/* route installed or reprogrammed */
+#define EVENT_ROUTE_DEL	'-'	/* route removed or expired */
+#define EVENT_VIF_UP	'i'	/* interface mapped to a VIF */
+#define EVENT_VIF_DOWN	'o'	/* interface lost its VIF */
+
 int msg_do(int sd, struct ipc_msg *msg);
 
 #endif /* SMCROUTE_MSG_H_ */
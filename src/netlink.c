@@ -0,0 +1,177 @@
+/* Netlink interface tracker
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#ifdef HAVE_LINUX_RTNETLINK_H
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "log.h"
+#include "conf.h"
+#include "ifvc.h"
+#include "mroute.h"
+#include "netlink.h"
+#include "socket.h"
+#include "util.h"
+
+extern int   do_vifs;
+extern char *conf_file;
+
+/*
+ * Listens to RTM_NEWLINK/RTM_DELLINK so interfaces that appear after
+ * startup, e.g. PPP or VLAN interfaces provisioned at runtime, can be
+ * used without a full SIGHUP restart, which drops all traffic.
+ */
+static void nl_link(struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct rtattr *rta;
+	char ifname[IFNAMSIZ + 1] = "";
+	struct iface *iface;
+	int len;
+
+	len = IFLA_PAYLOAD(nlh);
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME) {
+			strlcpy(ifname, RTA_DATA(rta), sizeof(ifname));
+			break;
+		}
+	}
+
+	if (!ifname[0])
+		return;
+
+	if (nlh->nlmsg_type == RTM_DELLINK) {
+		iface = iface_find_by_name(ifname);
+		if (!iface)
+			return;
+
+		smclog(LOG_DEBUG, "Interface %s gone, removing VIF/MIF", ifname);
+		if (iface->vif >= 0 || iface->mif >= 0)
+			mroute_del_vif(ifname);
+		iface->ifindex = 0;
+		iface->flags = 0;
+
+		return;
+	}
+
+	/* RTM_NEWLINK is sent for flag changes as well */
+	iface = iface_find_by_name(ifname);
+	if (iface) {
+		int returned = !iface->ifindex;
+
+		iface->flags = ifi->ifi_flags;
+		if (!returned)
+			return;
+
+		/*
+		 * Known interface back after RTM_DELLINK.  Re-registering
+		 * the VIF/MIF reinstalls the kernel routes still tied to
+		 * it via the per-VIF reverse index in mroute.c.
+		 */
+		smclog(LOG_INFO, "Interface %s is back, restoring VIF/MIF", ifname);
+		iface->ifindex = ifi->ifi_index;
+		if (do_vifs || iface->threshold)
+			mroute_add_vif(ifname, iface->mrdisc,
+				       iface->threshold ? iface->threshold : DEFAULT_THRESHOLD);
+	} else {
+		smclog(LOG_INFO, "New interface %s, adding to interface list", ifname);
+		iface = iface_add(ifname);
+		iface->flags = ifi->ifi_flags;
+
+		if (do_vifs)
+			mroute_add_vif(ifname, 0, DEFAULT_THRESHOLD);
+	}
+
+#ifdef ENABLE_DOTCONF
+	/*
+	 * Re-apply the .conf to pick up routes and joins referencing the
+	 * new interface.  Cheap since established entries are detected
+	 * and skipped, only rules for this interface cause kernel calls.
+	 */
+	conf_read(conf_file, do_vifs);
+#endif
+}
+
+static void netlink_read(int sd, void *arg)
+{
+	char buf[8192];
+	ssize_t len;
+
+	(void)arg;
+	while ((len = recv(sd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		struct nlmsghdr *nlh;
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				break;
+
+			if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK)
+				nl_link(nlh);
+		}
+	}
+}
+
+/**
+ * netlink_init - Start tracking interface link events
+ *
+ * Returns:
+ * The netlink socket descriptor, or -1 on error with @errno set.
+ */
+int netlink_init(void)
+{
+	struct sockaddr_nl snl;
+	int sd;
+
+	sd = socket_create(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE, netlink_read, NULL);
+	if (sd < 0) {
+		smclog(LOG_WARNING, "Failed creating netlink socket, no interface tracking: %s", strerror(errno));
+		return -1;
+	}
+
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = RTMGRP_LINK;
+	if (bind(sd, (struct sockaddr *)&snl, sizeof(snl)) < 0) {
+		smclog(LOG_WARNING, "Failed binding netlink socket, no interface tracking: %s", strerror(errno));
+		socket_close(sd);
+		return -1;
+	}
+
+	return sd;
+}
+#else /* HAVE_LINUX_RTNETLINK_H */
+int netlink_init(void)
+{
+	return -1;
+}
+#endif /* HAVE_LINUX_RTNETLINK_H */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,14 @@
+/* Netlink interface tracker API */
+#ifndef SMCROUTE_NETLINK_H_
+#define SMCROUTE_NETLINK_H_
+
+int netlink_init(void);
+
+#endif /* SMCROUTE_NETLINK_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,123 @@
+/* Fixed-size object pool allocator
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+
+#include "pool.h"
+
+struct pool_obj {
+	SLIST_ENTRY(pool_obj) link;
+};
+
+struct pool_blk {
+	SLIST_ENTRY(pool_blk) link;
+	char mem[];		/* count objects of size bytes */
+};
+
+/**
+ * pool_init - Initialise an object pool
+ * @p:     Pool to initialise
+ * @size:  Object size in bytes, at least sizeof(void *)
+ * @count: Number of objects allocated per block
+ */
+void pool_init(struct pool *p, size_t size, size_t count)
+{
+	if (size < sizeof(struct pool_obj))
+		size = sizeof(struct pool_obj);
+
+	p->size  = size;
+	p->count = count;
+	SLIST_INIT(&p->free_list);
+	SLIST_INIT(&p->blk_list);
+}
+
+/* Allocate another contiguous block and chop it up on the free list */
+static int pool_grow(struct pool *p)
+{
+	struct pool_blk *blk;
+	size_t i;
+
+	blk = malloc(sizeof(*blk) + p->size * p->count);
+	if (!blk)
+		return -1;
+
+	SLIST_INSERT_HEAD(&p->blk_list, blk, link);
+	for (i = 0; i < p->count; i++) {
+		struct pool_obj *obj = (struct pool_obj *)(blk->mem + i * p->size);
+
+		SLIST_INSERT_HEAD(&p->free_list, obj, link);
+	}
+
+	return 0;
+}
+
+/**
+ * pool_alloc - Get an object from the pool
+ * @p: Pool initialised with pool_init()
+ *
+ * Returns:
+ * Pointer to an uninitialised object, or %NULL if out of memory.
+ */
+void *pool_alloc(struct pool *p)
+{
+	struct pool_obj *obj;
+
+	if (SLIST_EMPTY(&p->free_list) && pool_grow(p))
+		return NULL;
+
+	obj = SLIST_FIRST(&p->free_list);
+	SLIST_REMOVE_HEAD(&p->free_list, link);
+
+	return obj;
+}
+
+/**
+ * pool_free - Return an object to the pool for recycling
+ * @p:   Pool the object was allocated from
+ * @obj: Object from pool_alloc()
+ */
+void pool_free(struct pool *p, void *obj)
+{
+	SLIST_INSERT_HEAD(&p->free_list, (struct pool_obj *)obj, link);
+}
+
+/**
+ * pool_exit - Bulk release all blocks of a pool
+ * @p: Pool initialised with pool_init()
+ *
+ * Releases every block in one go, regardless of objects still in use.
+ * The pool can be reused afterwards, new blocks are allocated on demand.
+ */
+void pool_exit(struct pool *p)
+{
+	struct pool_blk *blk, *tmp;
+
+	SLIST_FOREACH_SAFE(blk, &p->blk_list, link, tmp)
+		free(blk);
+
+	SLIST_INIT(&p->free_list);
+	SLIST_INIT(&p->blk_list);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,51 @@
+/* Fixed-size object pool allocator
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_POOL_H_
+#define SMCROUTE_POOL_H_
+
+#include <stddef.h>
+#include "queue.h"
+
+/*
+ * Pool of fixed-size objects, allocated in contiguous blocks with a
+ * free list for recycling.  Used for the route and group entries that
+ * otherwise churn the heap one malloc()/free() per learned route.
+ */
+struct pool {
+	size_t size;		/* object size in bytes  */
+	size_t count;		/* objects per block     */
+
+	SLIST_HEAD(, pool_obj) free_list;
+	SLIST_HEAD(, pool_blk) blk_list;
+};
+
+void  pool_init (struct pool *p, size_t size, size_t count);
+void *pool_alloc(struct pool *p);
+void  pool_free (struct pool *p, void *obj);
+void  pool_exit (struct pool *p);
+
+#endif /* SMCROUTE_POOL_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
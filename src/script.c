@@ -17,6 +17,7 @@
 
 #include <errno.h>
 #include <signal.h>		/* sigemptyset(), sigaction() */
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -27,10 +28,36 @@
 
 #include "log.h"
 #include "script.h"
+#include "timer.h"
+#include "util.h"
+
+/*
+ * Install events are queued and coalesced over a debounce window
+ * instead of one fork()+exec() per installed route, which dominates
+ * CPU during channel-change storms on small boards.  The script is
+ * invoked once per batch:
+ *
+ *    script install source,group [source,group ...]
+ *
+ * with the environment variables "source" and "group" set to the
+ * first event for compatibility with old scripts.  On queue overflow
+ * the whole batch collapses into a single "reload" invocation.
+ */
+#define SCRIPT_DEBOUNCE   1	/* seconds */
+#define SCRIPT_MAX_EVENTS 128
+
+struct event {
+	char source[INET6_ADDRSTRLEN];
+	char group[INET6_ADDRSTRLEN];
+};
 
 static char *exec   = NULL;
 static pid_t script = 0;
 
+static struct event queue[SCRIPT_MAX_EVENTS];
+static size_t num_events = 0;
+static int    do_reload  = 0;
+
 static void handler(int signo)
 {
 	int status;
@@ -55,6 +82,55 @@ static void handler(int signo)
 	}
 }
 
+/* Debounce timer callback, runs the script once for all queued events */
+static void script_flush(void *arg)
+{
+	static char args[SCRIPT_MAX_EVENTS][2 * INET6_ADDRSTRLEN + 1];
+	char *argv[SCRIPT_MAX_EVENTS + 3];
+	size_t i, num = 0;
+	pid_t pid;
+
+	(void)arg;
+	if (!num_events && !do_reload)
+		return;
+
+	/* Previous run still going, never overrun it, retry next tick */
+	if (script)
+		return;
+
+	argv[num++] = exec;
+	if (do_reload) {
+		unsetenv("source");
+		unsetenv("group");
+		argv[num++] = "reload";
+	} else {
+		/* For old scripts that only read the environment */
+		setenv("source", queue[0].source, 1);
+		setenv("group", queue[0].group, 1);
+
+		argv[num++] = "install";
+		for (i = 0; i < num_events; i++) {
+			snprintf(args[i], sizeof(args[i]), "%.*s,%.*s",
+				 INET6_ADDRSTRLEN - 1, queue[i].source,
+				 INET6_ADDRSTRLEN - 1, queue[i].group);
+			argv[num++] = args[i];
+		}
+	}
+	argv[num] = NULL;
+
+	pid = fork();
+	if (!pid)
+		_exit(execv(argv[0], argv));
+	if (pid < 0) {
+		smclog(LOG_WARNING, "Cannot start script %s: %s", exec, strerror(errno));
+		return;		/* Keep queue, retry next tick */
+	}
+
+	script = pid;
+	num_events = 0;
+	do_reload  = 0;
+}
+
 int script_init(char *script)
 {
 	struct sigaction sa;
@@ -70,50 +146,48 @@ int script_init(char *script)
 	sigemptyset(&sa.sa_mask);
 	sigaction(SIGCHLD, &sa, NULL);
 
+	if (exec && timer_add(SCRIPT_DEBOUNCE, script_flush, NULL) < 0) {
+		smclog(LOG_ERR, "Failed starting script debounce timer: %s", strerror(errno));
+		return -1;
+	}
+
 	return 0;
 }
 
 int script_exec(struct mroute *mroute)
 {
-	pid_t pid;
-
-	char *argv[] = {
-		exec,
-		"reload",
-		NULL,
-	};
+	struct event *e;
 
 	if (!exec)
 		return 0;
 
-	if (mroute) {
-		char source[INET6_ADDRSTRLEN], group[INET6_ADDRSTRLEN];
+	if (!mroute) {
+		/* Full reload supersedes any queued installs */
+		do_reload  = 1;
+		num_events = 0;
+		return 0;
+	}
 
-		if (mroute->version == 4) {
-			inet_ntop(AF_INET, &mroute->u.mroute4.source.s_addr, source, INET_ADDRSTRLEN);
-			inet_ntop(AF_INET, &mroute->u.mroute4.group.s_addr, group, INET_ADDRSTRLEN);
-		} else {
-			inet_ntop(AF_INET6, &mroute->u.mroute6.source.sin6_addr, source, INET_ADDRSTRLEN);
-			inet_ntop(AF_INET6, &mroute->u.mroute6.group.sin6_addr, group, INET_ADDRSTRLEN);
-		}
+	/* A pending reload already covers this event */
+	if (do_reload)
+		return 0;
 
-		setenv("source", source, 1);
-		setenv("group", group, 1);
-		argv[1] = "install";
-	} else {
-		unsetenv("source");
-		unsetenv("group");
+	if (num_events == NELEMS(queue)) {
+		/* Event storm, collapse the batch into one reload */
+		do_reload  = 1;
+		num_events = 0;
+		return 0;
 	}
 
-	pid = fork();
-	if (!pid)
-		_exit(execv(argv[0], argv));
-	if (pid < 0) {
-		smclog(LOG_WARNING, "Cannot start script %s: %s", exec, strerror(errno));
-		return -1;
+	e = &queue[num_events++];
+	if (mroute->version == 4) {
+		inet_ntop(AF_INET, &mroute->u.mroute4.source.s_addr, e->source, sizeof(e->source));
+		inet_ntop(AF_INET, &mroute->u.mroute4.group.s_addr, e->group, sizeof(e->group));
+	} else {
+		inet_ntop(AF_INET6, &mroute->u.mroute6.source.sin6_addr, e->source, sizeof(e->source));
+		inet_ntop(AF_INET6, &mroute->u.mroute6.group.sin6_addr, e->group, sizeof(e->group));
 	}
 
-	script = pid;
 	return 0;
 }
 
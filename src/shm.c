@@ -0,0 +1,339 @@
+/* Shared memory route snapshot for zero-cost monitoring
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>		/* AF_INET, AF_INET6 */
+#include <sys/stat.h>
+
+#include "log.h"
+#include "shm.h"
+#include "util.h"
+
+extern char *ident;
+
+#define SHM_INITIAL_SLOTS 512
+
+static struct shm_hdr *hdr;	/* NULL when the snapshot is disabled */
+static struct shm_route *slots;
+static int shm_fd = -1;
+static unsigned int next_free;	/* slot allocation hint */
+static char shm_path[256];
+
+static size_t shm_size(uint32_t max)
+{
+	return sizeof(struct shm_hdr) + max * sizeof(struct shm_route);
+}
+
+static void seq_begin(void)
+{
+	hdr->seq++;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_end(void)
+{
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	hdr->seq++;
+}
+
+/**
+ * shm_init - Create and map the route snapshot file
+ *
+ * Called once at startup.  Failure only disables the fast show path,
+ * the daemon keeps running and smcroutectl falls back to regular IPC.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error with @errno set.
+ */
+int shm_init(void)
+{
+	size_t len = shm_size(SHM_INITIAL_SLOTS);
+
+	snprintf(shm_path, sizeof(shm_path), "%s/run/%s.shm", LOCALSTATEDIR, ident);
+
+	shm_fd = open(shm_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (shm_fd < 0) {
+		smclog(LOG_WARNING, "Failed creating route snapshot %s: %s", shm_path, strerror(errno));
+		return -1;
+	}
+
+	if (ftruncate(shm_fd, len))
+		goto error;
+
+	hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	if (hdr == MAP_FAILED) {
+		hdr = NULL;
+		goto error;
+	}
+	slots = (struct shm_route *)(hdr + 1);
+
+	memset(hdr, 0, len);
+	hdr->magic   = SHM_MAGIC;
+	hdr->version = SHM_VERSION;
+	hdr->max     = SHM_INITIAL_SLOTS;
+
+	return 0;
+error:
+	smclog(LOG_WARNING, "Failed setting up route snapshot %s: %s", shm_path, strerror(errno));
+	close(shm_fd);
+	shm_fd = -1;
+	unlink(shm_path);
+
+	return -1;
+}
+
+void shm_exit(void)
+{
+	if (!hdr)
+		return;
+
+	munmap(hdr, shm_size(hdr->max));
+	hdr = NULL;
+	slots = NULL;
+	close(shm_fd);
+	shm_fd = -1;
+	unlink(shm_path);
+}
+
+/* Snapshot full, double the file; readers notice via the seqlock */
+static int shm_grow(void)
+{
+	uint32_t max = hdr->max * 2;
+	struct shm_hdr copy = *hdr;
+
+	munmap(hdr, shm_size(hdr->max));
+	hdr = NULL;
+
+	if (ftruncate(shm_fd, shm_size(max)))
+		goto error;
+
+	hdr = mmap(NULL, shm_size(max), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	if (hdr == MAP_FAILED) {
+		hdr = NULL;
+		goto error;
+	}
+	slots = (struct shm_route *)(hdr + 1);
+
+	memset(&slots[copy.max], 0, (max - copy.max) * sizeof(slots[0]));
+	next_free = copy.max;
+	hdr->max  = max;
+
+	return 0;
+error:
+	smclog(LOG_WARNING, "Failed growing route snapshot, disabling: %s", strerror(errno));
+	close(shm_fd);
+	shm_fd = -1;
+	unlink(shm_path);
+
+	return -1;
+}
+
+void shm_vif_add(int vif, char *ifname)
+{
+	if (!hdr || vif < 0 || vif >= (int)NELEMS(hdr->vifs))
+		return;
+
+	seq_begin();
+	strlcpy(hdr->vifs[vif], ifname, sizeof(hdr->vifs[vif]));
+	seq_end();
+}
+
+void shm_vif_del(int vif)
+{
+	if (!hdr || vif < 0 || vif >= (int)NELEMS(hdr->vifs))
+		return;
+
+	seq_begin();
+	hdr->vifs[vif][0] = 0;
+	seq_end();
+}
+
+void shm_mif_add(int mif, char *ifname)
+{
+	if (!hdr || mif < 0 || mif >= (int)NELEMS(hdr->mifs))
+		return;
+
+	seq_begin();
+	strlcpy(hdr->mifs[mif], ifname, sizeof(hdr->mifs[mif]));
+	seq_end();
+}
+
+void shm_mif_del(int mif)
+{
+	if (!hdr || mif < 0 || mif >= (int)NELEMS(hdr->mifs))
+		return;
+
+	seq_begin();
+	hdr->mifs[mif][0] = 0;
+	seq_end();
+}
+
+/* Find a free slot, or reuse the route's own via its 1-based cookie */
+static int shm_slot(uint32_t cookie)
+{
+	unsigned int i, slot;
+
+	if (cookie && cookie <= hdr->max)
+		return cookie - 1;
+
+	for (i = 0; i < hdr->max; i++) {
+		slot = (next_free + i) % hdr->max;
+		if (!slots[slot].valid)
+			break;
+	}
+	if (i == hdr->max) {
+		seq_begin();
+		if (shm_grow()) {
+			/* seq left odd on purpose, mapping is stale */
+			return -1;
+		}
+		slot = next_free;
+		seq_end();
+	}
+	next_free = slot + 1;
+
+	return slot;
+}
+
+/**
+ * shm_route4_add - Publish one route in the snapshot
+ * @table: Kernel routing table id, 0 for the default table
+ * @route: Route to publish, its slot cookie is updated
+ *
+ * Also used to refresh a route already in the snapshot, e.g. when the
+ * outbound interface set of a rule changes, the slot is rewritten in
+ * place.
+ */
+void shm_route4_add(int table, struct mroute4 *route)
+{
+	struct shm_route *r;
+	int slot;
+
+	if (!hdr)
+		return;
+
+	slot = shm_slot(route->shm);
+	if (slot < 0)
+		return;
+
+	seq_begin();
+	r = &slots[slot];
+	r->af      = AF_INET;
+	r->len     = route->len;
+	r->inbound = route->inbound;
+	r->table   = table;
+	r->oifs    = route->oifs;
+	memset(r->source, 0, sizeof(r->source));
+	memcpy(r->source, &route->source.s_addr, sizeof(route->source.s_addr));
+	memset(r->group, 0, sizeof(r->group));
+	memcpy(r->group, &route->group.s_addr, sizeof(route->group.s_addr));
+	r->valid = 1;
+	seq_end();
+
+	route->shm = slot + 1;	/* 0 means not in the snapshot */
+}
+
+void shm_route4_del(struct mroute4 *route)
+{
+	if (!hdr || !route->shm || route->shm > hdr->max)
+		return;
+
+	seq_begin();
+	slots[route->shm - 1].valid = 0;
+	seq_end();
+
+	next_free = route->shm - 1;
+	route->shm = 0;
+}
+
+/* Wipe all routes and VIF/MIF mappings, when routing is disabled on shutdown or restart */
+void shm_route4_clear(void)
+{
+	if (!hdr)
+		return;
+
+	seq_begin();
+	memset(hdr->vifs, 0, sizeof(hdr->vifs));
+	memset(hdr->mifs, 0, sizeof(hdr->mifs));
+	memset(slots, 0, hdr->max * sizeof(slots[0]));
+	seq_end();
+
+	next_free = 0;
+}
+
+/**
+ * shm_route6_add - Publish one IPv6 route in the snapshot
+ * @route: Route to publish, its slot cookie is updated
+ *
+ * IPv6 counterpart of shm_route4_add(), sharing the same slot array;
+ * the kernel has a single IPv6 multicast routing table, so no table id.
+ */
+void shm_route6_add(struct mroute6 *route)
+{
+	struct shm_route *r;
+	int slot;
+
+	if (!hdr)
+		return;
+
+	slot = shm_slot(route->shm);
+	if (slot < 0)
+		return;
+
+	seq_begin();
+	r = &slots[slot];
+	r->af      = AF_INET6;
+	r->len     = 0;
+	r->inbound = route->inbound;
+	r->table   = 0;
+	r->oifs    = route->oifs;
+	memcpy(r->source, &route->source.sin6_addr, sizeof(r->source));
+	memcpy(r->group, &route->group.sin6_addr, sizeof(r->group));
+	r->valid = 1;
+	seq_end();
+
+	route->shm = slot + 1;	/* 0 means not in the snapshot */
+}
+
+void shm_route6_del(struct mroute6 *route)
+{
+	if (!hdr || !route->shm || route->shm > hdr->max)
+		return;
+
+	seq_begin();
+	slots[route->shm - 1].valid = 0;
+	seq_end();
+
+	next_free = route->shm - 1;
+	route->shm = 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,87 @@
+/* Shared memory route snapshot for zero-cost monitoring
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_SHM_H_
+#define SMCROUTE_SHM_H_
+
+#include <stdint.h>
+#include <net/if.h>		/* IFNAMSIZ */
+
+#include "mroute.h"
+
+/*
+ * File format of the mmap'd route snapshot, LOCALSTATEDIR/run/IDENT.shm.
+ * The daemon updates it incrementally as routes come and go, smcroutectl
+ * maps it read-only and renders `show` without a round-trip to the
+ * daemon, so monitoring pollers cost the daemon nothing per query.
+ *
+ * Consistency uses a seqlock: seq is odd while the daemon writes, and
+ * bumped again when done.  Readers retry, and remap, until they see the
+ * same even seq before and after copying out the slots.
+ */
+#define SHM_MAGIC   0x534d4353u	/* "SMCS" */
+#define SHM_VERSION 2
+
+struct shm_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t pad;
+	uint32_t seq;		/* seqlock, odd while updating */
+	uint32_t max;		/* slot capacity, file may grow */
+
+	char     vifs[MAX_MC_VIFS][IFNAMSIZ];	/* VIF => ifname, "" unused */
+	char     mifs[MAX_MC_MIFS][IFNAMSIZ];	/* MIF => ifname, "" unused */
+};
+
+struct shm_route {
+	uint8_t  valid;
+	uint8_t  af;		/* AF_INET or AF_INET6 */
+	uint8_t  len;		/* prefix len for (*,G/LEN) rules, or 0 */
+	uint8_t  pad;
+	int16_t  inbound;	/* VIF or MIF */
+	uint16_t pad2;
+	uint32_t table;		/* kernel routing table id, 0 = default */
+	uint32_t oifs;		/* outbound VIF/MIF bitmask */
+	uint8_t  source[16];	/* network order, any-address => (*,G) */
+	uint8_t  group[16];
+};
+
+int  shm_init(void);
+void shm_exit(void);
+
+void shm_vif_add(int vif, char *ifname);
+void shm_vif_del(int vif);
+void shm_mif_add(int mif, char *ifname);
+void shm_mif_del(int mif);
+
+void shm_route4_add(int table, struct mroute4 *route);
+void shm_route4_del(struct mroute4 *route);
+void shm_route4_clear(void);
+
+void shm_route6_add(struct mroute6 *route);
+void shm_route6_del(struct mroute6 *route);
+
+#endif /* SMCROUTE_SHM_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -21,6 +21,7 @@
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stddef.h>
@@ -29,12 +30,16 @@
 # include <termios.h>
 #endif
 #include <unistd.h>
+#include <arpa/inet.h>
 #include <netinet/in.h>
-#include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <sys/un.h>
 
 #include "msg.h"
+#include "shm.h"
 #include "util.h"
 
 struct arg {
@@ -55,6 +60,8 @@ struct arg {
 	{ "kill",    0, 'k', NULL,   "Kill running daemon", NULL, 0 },
 	{ "restart", 0, 'H', NULL,   "Tell daemon to restart and reload its .conf file, like SIGHUP", NULL, 0 },
 	{ "show",    0, 's', NULL,   "Show passive (*,G) and active routes, as well as joined groups", NULL, 1 },
+	{ "monitor", 0, 'm', NULL,   "Subscribe to route and interface events, one line per event", NULL, 0 },
+	{ "batch",   0, 'b', NULL,   "Run commands from stdin, one per line, over a single connection", "< commands.txt", 0 },
 	{ "add",     3, 'a', NULL,   "Add a multicast route",    "eth0 192.168.2.42 225.1.2.3 eth1 eth2", 0 },
 	{ "remove",  2, 'r', NULL,   "Remove a multicast route", "eth0 192.168.2.42 225.1.2.3", 0 },
 	{ "del",     2, 'r', NULL,   NULL, NULL, 0 }, /* Alias */
@@ -146,6 +153,10 @@ static void table_heading(char *argv[], size_t count, int detail)
 	if (!heading || !isatty(STDOUT_FILENO))
 		return;
 
+	/* Stats dump is self-describing text */
+	if (count && argv[0][0] == 's')
+		return;
+
 	if (count && argv[0][0] == 'g')
 		snprintf(line, sizeof(line), "\e[7m%-34s %-16s", g, i);
 	else if (detail)
@@ -157,6 +168,267 @@ static void table_heading(char *argv[], size_t count, int detail)
 	fprintf(stderr, "%s%*s\n\e[0m", line, len < 0 ? 0 : len, "");
 }
 
+/*
+ * Format and print one binary show reply record from the daemon.  The
+ * type byte selects the header layout, IPv6 mroutes come as a larger
+ * '6' record with 16-byte addresses, see struct show6_msg.
+ */
+static void show_record(char *rec, int detail)
+{
+	char src[INET6_ADDRSTRLEN] = "*";
+	char grp[INET6_ADDRSTRLEN];
+	char sg[INET6_ADDRSTRLEN * 2 + 5];
+	uint64_t pktcnt, bytecnt;
+	char *ifname, *out;
+	struct show_msg sm;
+
+	memcpy(&sm, rec, sizeof(sm));
+
+	/* Preformatted text record, e.g. stats dump */
+	if (sm.type == 't') {
+		puts(rec + sizeof(struct show_msg));
+		return;
+	}
+
+	if (sm.type == '6') {
+		struct show6_msg sm6;
+
+		memcpy(&sm6, rec, sizeof(sm6));
+		if (!IN6_IS_ADDR_UNSPECIFIED((struct in6_addr *)sm6.source))
+			inet_ntop(AF_INET6, sm6.source, src, sizeof(src));
+		inet_ntop(AF_INET6, sm6.group, grp, sizeof(grp));
+		pktcnt  = sm6.pktcnt;
+		bytecnt = sm6.bytecnt;
+		ifname  = rec + sizeof(struct show6_msg);
+	} else {
+		if (sm.source != htonl(INADDR_ANY))
+			inet_ntop(AF_INET, &sm.source, src, sizeof(src));
+		inet_ntop(AF_INET, &sm.group, grp, sizeof(grp));
+		pktcnt  = sm.pktcnt;
+		bytecnt = sm.bytecnt;
+		ifname  = rec + sizeof(struct show_msg);
+	}
+
+	out = strchr(ifname, ' ');
+	if (out)
+		*out++ = 0;
+
+	snprintf(sg, sizeof(sg), "(%s, %s)", src, grp);
+
+	if (sm.type == 'g') {
+		printf("%-34s %s\n", sg, ifname);
+		return;
+	}
+
+	if (detail)
+		printf("%-34s %-16s %10llu %10llu %s\n", sg, ifname,
+		       (unsigned long long)pktcnt,
+		       (unsigned long long)bytecnt, out ? out : "");
+	else
+		printf("%-34s %-16s %s\n", sg, ifname, out ? out : "");
+}
+
+/*
+ * Read length-prefixed show reply records until the daemon closes the
+ * connection or sends its final status byte.  Records can straddle
+ * read() boundaries, so partial tails are kept for the next round.
+ */
+static int show_result(int sd, char *buf, size_t num, size_t len, int detail)
+{
+	size_t pos = 0;
+
+	while (1) {
+		ssize_t n;
+
+		while (num - pos >= sizeof(struct show_msg)) {
+			struct show_msg sm;
+
+			memcpy(&sm, &buf[pos], sizeof(sm));
+			if (sm.len < sizeof(sm) || sm.len > len) {
+				/* Not a record, likely an error message */
+				buf[num] = 0;
+				warnx("%s", &buf[pos]);
+				return 1;
+			}
+
+			if (num - pos < sm.len)
+				break;
+
+			show_record(&buf[pos], detail);
+			pos += sm.len;
+		}
+
+		/* Trailing status byte from the daemon, we're done */
+		if (num - pos == 1 && !buf[pos])
+			return 0;
+
+		memmove(buf, &buf[pos], num - pos);
+		num -= pos;
+		pos  = 0;
+
+		n = read(sd, &buf[num], len - num);
+		if (n <= 0)
+			return 0;
+		num += n;
+	}
+}
+
+/* Print all routes in @table from a consistent snapshot copy */
+static void shm_show_table(struct shm_hdr *hdr, struct shm_route *slots, uint32_t table)
+{
+	unsigned int i;
+	int vif;
+
+	for (i = 0; i < hdr->max; i++) {
+		struct shm_route *r = &slots[i];
+		char src[INET6_ADDRSTRLEN] = "*";
+		char grp[INET6_ADDRSTRLEN];
+		char sg[INET6_ADDRSTRLEN * 2 + 5];
+		char out[MAX_MC_VIFS * (IFNAMSIZ + 1)];
+		char (*ifs)[IFNAMSIZ];
+		size_t len = 0;
+		int nif;
+
+		if (!r->valid || r->table != table)
+			continue;
+
+		/* VIF or MIF numbering and names, depending on family */
+		if (r->af == AF_INET6) {
+			struct in6_addr any = IN6ADDR_ANY_INIT;
+
+			if (memcmp(r->source, &any, sizeof(any)))
+				inet_ntop(AF_INET6, r->source, src, sizeof(src));
+			inet_ntop(AF_INET6, r->group, grp, sizeof(grp));
+			ifs = hdr->mifs;
+			nif = MAX_MC_MIFS;
+		} else {
+			uint32_t addr;
+
+			memcpy(&addr, r->source, sizeof(addr));
+			if (addr != htonl(INADDR_ANY))
+				inet_ntop(AF_INET, &addr, src, sizeof(src));
+			memcpy(&addr, r->group, sizeof(addr));
+			inet_ntop(AF_INET, &addr, grp, sizeof(grp));
+			ifs = hdr->vifs;
+			nif = MAX_MC_VIFS;
+		}
+		snprintf(sg, sizeof(sg), "(%s, %s)", src, grp);
+
+		out[0] = 0;
+		for (vif = 0; vif < nif; vif++) {
+			if (!(r->oifs & (1u << vif)) || !ifs[vif][0])
+				continue;
+
+			len += snprintf(&out[len], sizeof(out) - len, "%s%s",
+					len ? " " : "", ifs[vif]);
+		}
+
+		printf("%-34s %-16s %s\n", sg,
+		       r->inbound >= 0 && r->inbound < nif
+		       ? ifs[r->inbound] : "", out);
+	}
+}
+
+/*
+ * Fast path for plain `show [routes]`: render directly from the route
+ * snapshot the daemon keeps mapped at LOCALSTATEDIR/run/IDENT.shm.  No
+ * IPC round-trip, and no work in the daemon, so arbitrary-frequency
+ * monitoring pollers are free.  The seqlock is odd while the daemon
+ * updates the file; retry, and remap in case it grew, until the same
+ * even value is read before and after copying it out.
+ *
+ * Returns non-zero if the snapshot is unavailable or never settles, the
+ * caller falls back to regular IPC.
+ */
+static int shm_show(char *argv[], size_t count)
+{
+	struct shm_hdr *hdr = NULL;
+	void *copy = NULL;
+	size_t len = 0;
+	char path[256];
+	struct stat st;
+	int fd, tries, ok = 0;
+
+	snprintf(path, sizeof(path), "%s/run/%s.shm", LOCALSTATEDIR, ident);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	for (tries = 0; tries < 100; tries++) {
+		uint32_t seq;
+
+		if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*hdr))
+			break;
+
+		if (len != (size_t)st.st_size) {
+			if (hdr)
+				munmap(hdr, len);
+			len = st.st_size;
+			hdr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+			if (hdr == MAP_FAILED) {
+				hdr = NULL;
+				break;
+			}
+		}
+
+		if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION)
+			break;
+
+		seq = hdr->seq;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq & 1 || sizeof(*hdr) + hdr->max * sizeof(struct shm_route) > len) {
+			usleep(1000);	/* Daemon mid-update, or the file grew */
+			continue;
+		}
+
+		copy = realloc(copy, len);
+		if (!copy)
+			break;
+		memcpy(copy, hdr, len);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (hdr->seq == seq) {
+			ok = 1;
+			break;
+		}
+	}
+
+	if (hdr)
+		munmap(hdr, len);
+	close(fd);
+
+	if (ok) {
+		struct shm_hdr *h = copy;
+		struct shm_route *slots = (struct shm_route *)(h + 1);
+		uint32_t cur = 0;
+		unsigned int i;
+
+		table_heading(argv, count, 0);
+		shm_show_table(h, slots, 0);
+
+		/* Other kernel tables follow, lowest id first */
+		while (1) {
+			uint32_t next = 0;
+
+			for (i = 0; i < h->max; i++) {
+				if (!slots[i].valid || slots[i].table <= cur)
+					continue;
+				if (!next || slots[i].table < next)
+					next = slots[i].table;
+			}
+			if (!next)
+				break;
+
+			printf("\nTable %u:\n", next);
+			shm_show_table(h, slots, next);
+			cur = next;
+		}
+	}
+	free(copy);
+
+	return !ok;
+}
+
 /*
  * Connects to the IPC socket of the server
  */
@@ -261,12 +533,7 @@ static int ipc_command(uint16_t cmd, char *argv[], size_t count)
 			detail = 1;
 		case 's':
 			table_heading(argv, count, detail);
-			do {
-				fputs(buf, stdout);
-				len = read(sd, buf, sizeof(buf) - 1);
-				if (len >= 0)
-					buf[len] = 0;
-			} while (len > 0);
+			result = show_result(sd, buf, len, sizeof(buf) - 1, detail);
 			break;
 
 		default:
@@ -282,6 +549,194 @@ static int ipc_command(uint16_t cmd, char *argv[], size_t count)
 	return result;
 }
 
+/*
+ * Batch mode, reads commands from stdin, one per line, and sends them
+ * all over a single connection.  Saves one fork+connect per command
+ * for orchestration that loads thousands of routes.  Prints a single
+ * aggregated status at the end.
+ */
+static int ipc_batch(void)
+{
+	char line[MX_CMDPKT_SZ];
+	int sd, num = 0, fail = 0;
+
+	sd = ipc_connect();
+	if (sd < 0) {
+		warn("Failed connecting to daemon");
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), stdin)) {
+		char buf[MX_CMDPKT_SZ + 1];
+		char *argv[36];		/* in1 source group out1 .. out32 */
+		struct ipc_msg *msg;
+		struct arg *cmd = NULL;
+		size_t count = 0;
+		ssize_t len;
+		char *token;
+		int i;
+
+		token = strtok(line, " \t\n");
+		if (!token || token[0] == '#')
+			continue;
+
+		for (i = 0; args[i].val; i++) {
+			if (args[i].name && !strcmp(args[i].name, token)) {
+				cmd = &args[i];
+				break;
+			}
+		}
+
+		num++;
+		if (!cmd || cmd->val == 's' || cmd->val == 'b' || cmd->val == 'm') {
+			warnx("Unsupported command in batch: %s", token);
+			fail++;
+			continue;
+		}
+
+		while (count < NELEMS(argv) && (token = strtok(NULL, " \t\n")))
+			argv[count++] = token;
+
+		if ((int)count < cmd->min_args) {
+			warnx("Not enough arguments to command %s", cmd->name);
+			fail++;
+			continue;
+		}
+
+		msg = msg_create(cmd->val, argv, count);
+		if (!msg) {
+			warn("Failed constructing IPC command");
+			fail++;
+			continue;
+		}
+
+		if (write(sd, msg, msg->len) != (ssize_t)msg->len) {
+			warn("Communication with daemon failed");
+			free(msg);
+			close(sd);
+			return 1;
+		}
+		free(msg);
+
+		len = read(sd, buf, sizeof(buf) - 1);
+		if (len < 0) {
+			warn("Communication with daemon failed");
+			close(sd);
+			return 1;
+		}
+
+		if (len != 1 || buf[0] != '\0') {
+			buf[len] = 0;
+			warnx("%s: %s", cmd->name, buf);
+			fail++;
+		}
+	}
+
+	close(sd);
+	printf("%d commands, %d failed\n", num, fail);
+
+	return fail ? 1 : 0;
+}
+
+/*
+ * Subscribe to the daemon event stream and print one line per route
+ * install/remove and interface change until either side exits.  A
+ * controller would consume the same struct event_msg records raw,
+ * tracking state without one fork+exec per event like the script.
+ */
+static int ipc_monitor(void)
+{
+	struct ipc_msg *msg;
+	char buf[768];
+	size_t num = 0;
+	int sd, ack = 0;
+
+	msg = msg_create('m', NULL, 0);
+	if (!msg) {
+		warn("Failed constructing IPC command");
+		return 1;
+	}
+
+	sd = ipc_connect();
+	if (sd < 0) {
+		warn("Failed connecting to daemon");
+		free(msg);
+		return 1;
+	}
+
+	if (write(sd, msg, msg->len) != (ssize_t)msg->len) {
+		warn("Communication with daemon failed");
+		free(msg);
+		close(sd);
+		return 1;
+	}
+	free(msg);
+
+	while (1) {
+		size_t pos = 0;
+		ssize_t n;
+
+		n = read(sd, &buf[num], sizeof(buf) - num);
+		if (n <= 0)
+			break;
+		num += n;
+
+		if (!ack) {
+			if (buf[0]) {	/* Error message, not the ACK byte */
+				buf[num - 1] = 0;
+				warnx("%s", buf);
+				close(sd);
+				return 1;
+			}
+			pos = 1;
+			ack = 1;
+		}
+
+		while (num - pos >= sizeof(struct event_msg)) {
+			char src[INET_ADDRSTRLEN] = "*", grp[INET_ADDRSTRLEN];
+			struct event_msg ev;
+
+			memcpy(&ev, &buf[pos], sizeof(ev));
+			if (ev.len < sizeof(ev) || ev.len > sizeof(buf)) {
+				warnx("Bad event record from daemon");
+				close(sd);
+				return 1;
+			}
+
+			if (num - pos < ev.len)
+				break;
+
+			switch (ev.type) {
+			case EVENT_VIF_UP:
+			case EVENT_VIF_DOWN:
+				buf[pos + ev.len - 1] = 0;
+				printf("iface %-4s %s\n",
+				       ev.type == EVENT_VIF_UP ? "up" : "down",
+				       &buf[pos + sizeof(ev)]);
+				break;
+
+			default:
+				if (ev.source != htonl(INADDR_ANY))
+					inet_ntop(AF_INET, &ev.source, src, sizeof(src));
+				inet_ntop(AF_INET, &ev.group, grp, sizeof(grp));
+				printf("route %-4s (%s, %s) table %u\n",
+				       ev.type == EVENT_ROUTE_ADD ? "add" : "del",
+				       src, grp, ev.table);
+				break;
+			}
+			pos += ev.len;
+		}
+		fflush(stdout);
+
+		memmove(buf, &buf[pos], num - pos);
+		num -= pos;
+	}
+
+	close(sd);
+
+	return 0;
+}
+
 static int usage(int code)
 {
 	int i;
@@ -406,7 +861,8 @@ int main(int argc, char *argv[])
 
 			default:
 				cmd = &args[i];
-				if (argc - ++pos < args[i].min_args) {
+				pos = optind;	/* command args follow the matched token */
+				if (argc - pos < args[i].min_args) {
 					warnx("Not enough arguments to command %s", nm);
 					status = 1;
 					goto help;
@@ -436,9 +892,21 @@ int main(int argc, char *argv[])
 		return usage(1);
 
 	c = cmd->val;
-	if (cmd->has_detail)
+	if (detail && cmd->has_detail)
 		c -= 0x20;
 
+	if (c == 'b')
+		return ipc_batch();
+
+	if (c == 'm')
+		return ipc_monitor();
+
+	/* Plain `show [routes]` is served from the daemon's route snapshot */
+	if (c == 's' && (argc - pos < 1 || argv[pos][0] == 'r')) {
+		if (!shm_show(&argv[pos], argc - pos))
+			return 0;
+	}
+
 	return ipc_command(c, &argv[pos], argc - pos);
 }
 
@@ -21,11 +21,17 @@
 
 #include <err.h>
 #include <errno.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 #include <getopt.h>
 #include <stdio.h>
 #include <signal.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
 #include <sys/time.h>		/* gettimeofday() */
 #include <sys/un.h>
 
@@ -42,6 +48,8 @@
 #include "mrdisc.h"
 #include "mroute.h"
 #include "mcgroup.h"
+#include "netlink.h"
+#include "shm.h"
 
 int running    = 1;
 int background = 1;
@@ -64,18 +72,33 @@ static gid_t gid = 0;
 static const char version_info[] = PACKAGE_NAME " v" PACKAGE_VERSION;
 
 
+/* Warm-restart state file, only ever valid for one restart */
+static char *state_file(void)
+{
+	static char path[256];
+
+	snprintf(path, sizeof(path), "%s/run/%s.state", LOCALSTATEDIR, ident);
+
+	return path;
+}
+
 /* Cleans up, i.e. releases allocated resources. Called via atexit() */
 static void clean(void)
 {
+	if (mroute4_state_save(state_file()))
+		smclog(LOG_WARNING, "Failed saving state for warm restart: %s", strerror(errno));
 	mroute4_disable();
 	mroute6_disable();
+	shm_exit();
 	mcgroup4_disable();
 	mcgroup6_disable();
 	ipc_exit();
 	iface_exit();
+	log_exit();
 	smclog(LOG_NOTICE, "Exiting.");
 }
 
+#ifndef ENABLE_DOTCONF
 static void restart(void)
 {
 	mroute4_disable();
@@ -89,38 +112,209 @@ static void restart(void)
 	mroute4_enable(do_vifs, table_id, cache_tmo);
 	mroute6_enable(do_vifs, table_id);
 }
+#endif
+
+#ifdef ENABLE_DOTCONF
+/*
+ * Incremental reload: the config is compiled up front, then applied in
+ * bounded slices from the event loop, re-armed over a self-wake pipe.
+ * Upcall and IPC processing keep running while a large config loads.
+ */
+#define RELOAD_CHUNK 64		/* records applied per loop iteration */
+
+void reload(int signo);
+
+static int reload_wake[2] = { -1, -1 };
+static int reloading = 0;
+static int reload_queued = 0;
+
+static void reload_kick(void)
+{
+	if (write(reload_wake[1], "!", 1) < 0 && EAGAIN != errno)
+		smclog(LOG_WARNING, "Failed scheduling reload step: %s", strerror(errno));
+}
+
+static void reload_finish(void)
+{
+	mroute4_sweep_all();
+	mroute6_sweep_all();
+	mcgroup4_sweep_all();
+
+	/* Acknowledge client SIGHUP/reload by touching the pidfile */
+	pidfile(NULL, uid, gid);
+
+	reloading = 0;
+	if (reload_queued) {
+		reload_queued = 0;
+		reload(0);
+	}
+}
+
+static void reload_step(int sd, void *arg)
+{
+	char buf[16];
+	int num;
+
+	(void)arg;
+	while (read(sd, buf, sizeof(buf)) > 0)
+		;
+
+	if (conf_apply_some(RELOAD_CHUNK) > 0) {
+		reload_kick();
+		return;
+	}
+
+	script_exec(NULL);
+
+	/* Route ops from IPC clients always target the default table */
+	mroute4_table_reset();
+
+	num = mroute4_bulk_end();
+	if (num)
+		smclog(LOG_INFO, "Loaded %d multicast routes from %s", num, conf_file);
+
+	reload_finish();
+}
+
+static void reload_init(void)
+{
+	if (pipe(reload_wake)) {
+		smclog(LOG_ERR, "Failed creating reload pipe: %s", strerror(errno));
+		exit(1);
+	}
+
+#ifdef HAVE_FCNTL_H
+	fcntl(reload_wake[0], F_SETFL, fcntl(reload_wake[0], F_GETFL) | O_NONBLOCK);
+	fcntl(reload_wake[1], F_SETFL, fcntl(reload_wake[1], F_GETFL) | O_NONBLOCK);
+#endif
+	if (socket_register(reload_wake[0], reload_step, NULL) < 0) {
+		smclog(LOG_ERR, "Failed registering reload pipe: %s", strerror(errno));
+		exit(1);
+	}
+}
+#else
+static void reload_init(void)
+{
+}
+#endif /* ENABLE_DOTCONF */
 
 void reload(int signo)
 {
 #ifdef ENABLE_DOTCONF
+	if (reloading) {
+		/* Coalesce, rerun once the current reload completes */
+		reload_queued = 1;
+		return;
+	}
+
 	smclog(LOG_NOTICE, "Got %s, reloading %s ...",
 	       signo ? "SIGHUP" : "client restart command", conf_file);
+
+	/*
+	 * Mark and sweep: re-reading the .conf file clears the mark on
+	 * all routes and group joins still in the file, the sweep then
+	 * only issues kernel calls for entries that actually changed.
+	 * This keeps live multicast flowing over a reload, instead of
+	 * tearing down and reinstalling every route.
+	 */
+	mroute4_mark_all();
+	mroute6_mark_all();
+	mcgroup4_mark_all();
+
+	if (conf_load(conf_file, do_vifs)) {
+		/* Nothing to apply, sweep whatever is no longer wanted */
+		reload_finish();
+		return;
+	}
+
+	mroute4_bulk_begin();
+	reloading = 1;
+	reload_kick();
 #else
 	smclog(LOG_NOTICE, "Got %s, restarting ...",
 	       signo ? "SIGHUP" : "client restart command");
-#endif
 	restart();
 	conf_read(conf_file, do_vifs);
 
 	/* Acknowledge client SIGHUP/reload by touching the pidfile */
 	pidfile(NULL, uid, gid);
+#endif
 }
 
+#ifdef __linux__
 /*
- * Signal handler.  Take note of the fact that the signal arrived
- * so that the main loop can take care of it.
+ * Signals are blocked and routed through a signalfd dispatched by the
+ * event loop, so reload runs in normal context instead of from the
+ * signal handler, where it was both async-signal-unsafe and froze
+ * upcall and IPC processing for the duration.
  */
+static void signal_cb(int sd, void *arg)
+{
+	struct signalfd_siginfo fdsi;
+
+	(void)arg;
+	while (read(sd, &fdsi, sizeof(fdsi)) == (ssize_t)sizeof(fdsi)) {
+		switch (fdsi.ssi_signo) {
+		case SIGINT:
+		case SIGTERM:
+			running = 0;
+			break;
+
+		case SIGHUP:
+			reload(SIGHUP);
+			break;
+		}
+	}
+}
+
+static void signal_init(void)
+{
+	sigset_t mask;
+	int sd;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+
+	/* Block normal delivery, threads inherit this mask */
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	sd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sd < 0 || socket_register(sd, signal_cb, NULL) < 0) {
+		smclog(LOG_ERR, "Failed setting up signalfd: %s", strerror(errno));
+		exit(1);
+	}
+}
+
+#else  /* self-pipe, for systems without signalfd */
+
+static int sig_pipe[2] = { -1, -1 };
+
 static void handler(int signo)
 {
-	switch (signo) {
-	case SIGINT:
-	case SIGTERM:
-		running = 0;
-		break;
-
-	case SIGHUP:
-		reload(signo);
-		break;
+	char signo_c = (char)signo;
+
+	if (write(sig_pipe[1], &signo_c, 1) < 0)
+		;	/* Pipe full, signal already pending */
+}
+
+static void signal_cb(int sd, void *arg)
+{
+	char signo;
+
+	(void)arg;
+	while (read(sd, &signo, 1) == 1) {
+		switch (signo) {
+		case SIGINT:
+		case SIGTERM:
+			running = 0;
+			break;
+
+		case SIGHUP:
+			reload(SIGHUP);
+			break;
+		}
 	}
 }
 
@@ -128,6 +322,20 @@ static void signal_init(void)
 {
 	struct sigaction sa;
 
+	if (pipe(sig_pipe)) {
+		smclog(LOG_ERR, "Failed creating signal pipe: %s", strerror(errno));
+		exit(1);
+	}
+
+#ifdef HAVE_FCNTL_H
+	fcntl(sig_pipe[0], F_SETFL, fcntl(sig_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(sig_pipe[1], F_SETFL, fcntl(sig_pipe[1], F_GETFL) | O_NONBLOCK);
+#endif
+	if (socket_register(sig_pipe[0], signal_cb, NULL) < 0) {
+		smclog(LOG_ERR, "Failed registering signal pipe: %s", strerror(errno));
+		exit(1);
+	}
+
 	sa.sa_handler = handler;
 	sa.sa_flags = 0;	/* Interrupt system calls */
 	sigemptyset(&sa.sa_mask);
@@ -135,6 +343,7 @@ static void signal_init(void)
 	sigaction(SIGTERM, &sa, NULL);
 	sigaction(SIGINT, &sa, NULL);
 }
+#endif /* __linux__ */
 
 static int server_loop(void)
 {
@@ -183,6 +392,17 @@ static int start_server(void)
 	 */
 	timer_init();
 
+	/* Block signals before any thread is created, so they all
+	 * inherit the mask and delivery goes to the signalfd only */
+	signal_init();
+	reload_init();
+
+	/* Route snapshot for smcroutectl show, before any VIF is added */
+	shm_init();
+
+	/* Move syslog writing off the hot paths, after daemon() fork */
+	log_init();
+
 	if (mroute4_enable(do_vifs, table_id, cache_tmo)) {
 		if (errno == EADDRINUSE)
 			busy++;
@@ -206,10 +426,23 @@ static int start_server(void)
 	}
 
 	atexit(clean);
-	signal_init();
 	ipc_init();
+	netlink_init();
 
-	conf_read(conf_file, do_vifs);
+	/*
+	 * Warm restart: reinstall routes saved by the previous instance
+	 * before parsing the .conf file, then reconcile so routes no
+	 * longer configured are swept out again.
+	 */
+	if (mroute4_state_load(state_file()) > 0) {
+		mroute4_mark_all();
+		conf_read(conf_file, do_vifs);
+		mroute4_sweep_all();
+	} else
+		conf_read(conf_file, do_vifs);
+
+	/* Initial config loaded, hand the upcall sockets to the worker */
+	mroute_upcall_attach();
 
 	/* Everything setup, notify any clients by creating the pidfile */
 	if (pidfile(pid_file, uid, gid))
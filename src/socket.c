@@ -30,19 +30,31 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#elif defined(HAVE_SYS_EVENT_H)
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
 
 #include "log.h"
 #include "queue.h"
+#include "stats.h"
+#include "util.h"
 
 struct sock {
 	LIST_ENTRY(sock) link;
 
 	int sd;
+	int wr;			/* also watch for write readiness */
 
 	void (*cb)(int, void *arg);
 	void *arg;
 };
 
+/* Max number of descriptors dispatched per socket_poll() */
+#define SOCKET_EVENTS_MAX 64
+
 static int max_fdnum = -1;
 LIST_HEAD(, sock) sl = LIST_HEAD_INITIALIZER();
 
@@ -52,6 +64,244 @@ int nfds(void)
 	return max_fdnum + 1;
 }
 
+#ifdef HAVE_SYS_EPOLL_H
+/*
+ * Linux epoll backend.  Wakeup cost is O(ready fds) rather than
+ * O(registered fds), and we are not limited by FD_SETSIZE, which
+ * matters with mrdisc enabled on hundreds of interfaces.
+ */
+static int epfd = -1;
+
+/* Events currently being dispatched, cleared by socket_close() */
+static struct epoll_event events[SOCKET_EVENTS_MAX];
+static int num_events = 0;
+
+static int sock_backend_add(struct sock *entry)
+{
+	struct epoll_event ev;
+
+	if (epfd < 0) {
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (epfd < 0) {
+			smclog(LOG_ERR, "Failed creating epoll descriptor: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	/* Descriptors without callback are only tracked for cleanup */
+	if (!entry->cb)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = entry;
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, entry->sd, &ev);
+}
+
+static int sock_backend_wantwr(struct sock *entry)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (entry->wr ? EPOLLOUT : 0);
+	ev.data.ptr = entry;
+
+	return epoll_ctl(epfd, EPOLL_CTL_MOD, entry->sd, &ev);
+}
+
+static void sock_backend_del(struct sock *entry)
+{
+	int i;
+
+	if (entry->cb && epfd >= 0)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, entry->sd, NULL);
+
+	/* Make sure a callback cannot close an entry with pending events */
+	for (i = 0; i < num_events; i++) {
+		if (events[i].data.ptr == entry)
+			events[i].data.ptr = NULL;
+	}
+}
+
+int socket_poll(struct timeval *timeout)
+{
+	int i, num, msec = -1;
+
+	if (timeout)
+		msec = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+
+	num = epoll_wait(epfd, events, NELEMS(events), msec);
+	if (num <= 0) {
+		/* Log all errors, except when signalled, ignore failures. */
+		if (num < 0 && EINTR != errno)
+			smclog(LOG_WARNING, "Failed epoll_wait(): %s", strerror(errno));
+
+		return num;
+	}
+
+	stats.wakeups++;
+	num_events = num;
+	for (i = 0; i < num; i++) {
+		struct sock *entry = events[i].data.ptr;
+
+		if (entry && entry->cb)
+			entry->cb(entry->sd, entry->arg);
+	}
+	num_events = 0;
+
+	return num;
+}
+
+#elif defined(HAVE_SYS_EVENT_H)
+/*
+ * *BSD kqueue backend, same rationale as the epoll backend above.
+ */
+static int kqfd = -1;
+
+/* Events currently being dispatched, cleared by socket_close() */
+static struct kevent events[SOCKET_EVENTS_MAX];
+static int num_events = 0;
+
+static int sock_backend_add(struct sock *entry)
+{
+	struct kevent ev;
+
+	if (kqfd < 0) {
+		kqfd = kqueue();
+		if (kqfd < 0) {
+			smclog(LOG_ERR, "Failed creating kqueue descriptor: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	/* Descriptors without callback are only tracked for cleanup */
+	if (!entry->cb)
+		return 0;
+
+	EV_SET(&ev, entry->sd, EVFILT_READ, EV_ADD, 0, 0, entry);
+
+	return kevent(kqfd, &ev, 1, NULL, 0, NULL);
+}
+
+static int sock_backend_wantwr(struct sock *entry)
+{
+	struct kevent ev;
+
+	EV_SET(&ev, entry->sd, EVFILT_WRITE, entry->wr ? EV_ADD : EV_DELETE, 0, 0, entry);
+
+	return kevent(kqfd, &ev, 1, NULL, 0, NULL);
+}
+
+static void sock_backend_del(struct sock *entry)
+{
+	struct kevent ev;
+	int i;
+
+	if (entry->cb && kqfd >= 0) {
+		EV_SET(&ev, entry->sd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+		kevent(kqfd, &ev, 1, NULL, 0, NULL);
+		if (entry->wr) {
+			EV_SET(&ev, entry->sd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+			kevent(kqfd, &ev, 1, NULL, 0, NULL);
+		}
+	}
+
+	/* Make sure a callback cannot close an entry with pending events */
+	for (i = 0; i < num_events; i++) {
+		if (events[i].udata == entry)
+			events[i].udata = NULL;
+	}
+}
+
+int socket_poll(struct timeval *timeout)
+{
+	struct timespec ts, *tsp = NULL;
+	int i, num;
+
+	if (timeout) {
+		ts.tv_sec  = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_usec * 1000;
+		tsp = &ts;
+	}
+
+	num = kevent(kqfd, NULL, 0, events, NELEMS(events), tsp);
+	if (num <= 0) {
+		/* Log all errors, except when signalled, ignore failures. */
+		if (num < 0 && EINTR != errno)
+			smclog(LOG_WARNING, "Failed kevent(): %s", strerror(errno));
+
+		return num;
+	}
+
+	stats.wakeups++;
+	num_events = num;
+	for (i = 0; i < num; i++) {
+		struct sock *entry = events[i].udata;
+
+		if (entry && entry->cb)
+			entry->cb(entry->sd, entry->arg);
+	}
+	num_events = 0;
+
+	return num;
+}
+
+#else  /* select() fallback */
+
+static int sock_backend_add(struct sock *entry)
+{
+	(void)entry;
+	return 0;
+}
+
+static int sock_backend_wantwr(struct sock *entry)
+{
+	(void)entry;
+	return 0;
+}
+
+static void sock_backend_del(struct sock *entry)
+{
+	(void)entry;
+}
+
+int socket_poll(struct timeval *timeout)
+{
+	int num;
+	fd_set fds, wfds;
+	struct sock *entry;
+
+	FD_ZERO(&fds);
+	FD_ZERO(&wfds);
+	LIST_FOREACH(entry, &sl, link) {
+		FD_SET(entry->sd, &fds);
+		if (entry->wr)
+			FD_SET(entry->sd, &wfds);
+	}
+
+	num = select(nfds(), &fds, &wfds, NULL, timeout);
+	if (num <= 0) {
+		/* Log all errors, except when signalled, ignore failures. */
+		if (num < 0 && EINTR != errno)
+			smclog(LOG_WARNING, "Failed select(): %s", strerror(errno));
+
+		return num;
+	}
+
+	stats.wakeups++;
+	LIST_FOREACH(entry, &sl, link) {
+		if (!FD_ISSET(entry->sd, &fds) && !FD_ISSET(entry->sd, &wfds))
+			continue;
+
+		if (entry->cb)
+			entry->cb(entry->sd, entry->arg);
+	}
+
+	return num;
+}
+#endif
+
 /*
  * register socket/fd/pipe created elsewhere, optional callback
  */
@@ -64,15 +314,21 @@ int socket_register(int sd, void (*cb)(int, void *), void *arg)
 		return -1;
 
 	entry->sd  = sd;
+	entry->wr  = 0;
 	entry->cb  = cb;
 	entry->arg = arg;
+
+	if (sock_backend_add(entry)) {
+		free(entry);
+		return -1;
+	}
 	LIST_INSERT_HEAD(&sl, entry, link);
 
 #if !defined(HAVE_SOCK_CLOEXEC) && defined(HAVE_FCNTL_H)
 	fcntl(sd, F_SETFD, fcntl(sd, F_GETFD) | FD_CLOEXEC);
 #endif
 
-	/* Keep track for select() */
+	/* Keep track for select() fallback */
 	if (sd > max_fdnum)
 		max_fdnum = sd;
 
@@ -101,14 +357,40 @@ int socket_create(int domain, int type, int proto, void (*cb)(int, void *), void
 	return sd;
 }
 
-int socket_close(int sd)
+/*
+ * toggle write-readiness notification for a registered descriptor,
+ * the callback is then invoked for both read and write events
+ */
+int socket_wantwr(int sd, int enable)
+{
+	struct sock *entry;
+
+	LIST_FOREACH(entry, &sl, link) {
+		if (entry->sd == sd) {
+			if (entry->wr == enable)
+				return 0;
+
+			entry->wr = enable;
+			return sock_backend_wantwr(entry);
+		}
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+/*
+ * stop polling descriptor, without closing it, e.g. when another
+ * thread takes over reading from the descriptor
+ */
+int socket_deregister(int sd)
 {
 	struct sock *entry, *tmp;
 
 	LIST_FOREACH_SAFE(entry, &sl, link, tmp) {
 		if (entry->sd == sd) {
+			sock_backend_del(entry);
 			LIST_REMOVE(entry, link);
-			close(entry->sd);
 			free(entry);
 
 			return 0;
@@ -119,34 +401,23 @@ int socket_close(int sd)
 	return -1;
 }
 
-int socket_poll(struct timeval *timeout)
+int socket_close(int sd)
 {
-	int num;
-	fd_set fds;
-	struct sock *entry;
-
-	FD_ZERO(&fds);
-	LIST_FOREACH(entry, &sl, link)
-		FD_SET(entry->sd, &fds);
-
-	num = select(nfds(), &fds, NULL, NULL, timeout);
-	if (num <= 0) {
-		/* Log all errors, except when signalled, ignore failures. */
-		if (num < 0 && EINTR != errno)
-			smclog(LOG_WARNING, "Failed select(): %s", strerror(errno));
-
-		return num;
-	}
+	struct sock *entry, *tmp;
 
-	LIST_FOREACH(entry, &sl, link) {
-		if (!FD_ISSET(entry->sd, &fds))
-			continue;
+	LIST_FOREACH_SAFE(entry, &sl, link, tmp) {
+		if (entry->sd == sd) {
+			sock_backend_del(entry);
+			LIST_REMOVE(entry, link);
+			close(entry->sd);
+			free(entry);
 
-		if (entry->cb)
-			entry->cb(entry->sd, entry->arg);
+			return 0;
+		}
 	}
 
-	return num;
+	errno = ENOENT;
+	return -1;
 }
 
 /**
@@ -24,9 +24,11 @@
 #include <string.h>
 #include <sys/time.h>
 
-int socket_register(int sd, void (*cb)(int, void *), void *arg);
-int socket_create  (int domain, int type, int proto, void (*cb)(int, void *), void *arg);
-int socket_close   (int sd);
+int socket_register  (int sd, void (*cb)(int, void *), void *arg);
+int socket_wantwr    (int sd, int enable);
+int socket_create    (int domain, int type, int proto, void (*cb)(int, void *), void *arg);
+int socket_deregister(int sd);
+int socket_close     (int sd);
 int socket_poll    (struct timeval *timeout);
 
 #endif /* SMCROUTE_SOCKET_H_ */
@@ -0,0 +1,118 @@
+/* Runtime statistics counters
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ipc.h"
+#include "log.h"
+#include "msg.h"
+#include "stats.h"
+
+/*
+ * Plain counters incremented inline by the hot paths, see stats.h for
+ * the fields.  Kept deliberately dumb: no locks, no sampling logic, so
+ * the cost in handle_nocache4() and friends is a single increment.
+ */
+struct stats stats;
+
+/**
+ * stats_lat_sample - Account one upcall-to-install latency sample
+ * @ns: Measured latency in nanoseconds
+ */
+void stats_lat_sample(uint64_t ns)
+{
+	uint64_t limit = 1000;
+	size_t i;
+
+	for (i = 0; i < STATS_LAT_BUCKETS - 1; i++) {
+		if (ns < limit)
+			break;
+
+		limit *= 10;
+	}
+
+	stats.lat_hist[i]++;
+}
+
+#ifdef ENABLE_CLIENT
+/* Queue one preformatted text record, type 't', for the client */
+static int stats_line(int sd, const char *fmt, ...)
+{
+	/* Backs queued, not yet flushed, iovec entries in ipc_queue() */
+	static char arena[IPC_IOV_MAX][sizeof(struct show_msg) + 64];
+	static int slot = 0;
+	struct show_msg *sm = (struct show_msg *)arena[slot];
+	va_list ap;
+	int len;
+
+	memset(sm, 0, sizeof(*sm));
+	sm->type = 't';
+
+	va_start(ap, fmt);
+	len = vsnprintf(sm->ifname, sizeof(arena[0]) - sizeof(*sm), fmt, ap);
+	va_end(ap);
+	sm->len = sizeof(*sm) + len + 1;
+
+	slot = (slot + 1) % IPC_IOV_MAX;
+
+	return ipc_queue(sd, sm, sm->len);
+}
+
+/* Write all runtime counters to client socket */
+int stats_show(int sd)
+{
+	static const char *bucket[STATS_LAT_BUCKETS] = {
+		"< 1 usec", "< 10 usec", "< 100 usec", "< 1 msec", "< 10 msec", "slower"
+	};
+	int ret = 0;
+	size_t i;
+
+	ret += stats_line(sd, "%-24s %12llu", "Upcalls received", (unsigned long long)stats.upcalls);
+	ret += stats_line(sd, "%-24s %12llu", "Upcalls dropped", (unsigned long long)stats.upcall_drops);
+	ret += stats_line(sd, "%-24s %12llu", "Upcalls unmatched", (unsigned long long)stats.upcall_nomatch);
+	ret += stats_line(sd, "%-24s %12llu", "Routes learned", (unsigned long long)stats.dyn_installed);
+	ret += stats_line(sd, "%-24s %12llu", "Routes expired", (unsigned long long)stats.dyn_expired);
+	ret += stats_line(sd, "%-24s %12llu", "Routes flushed", (unsigned long long)stats.dyn_flushed);
+	ret += stats_line(sd, "%-24s %12llu", "Kernel add failures", (unsigned long long)stats.kern_add_fail);
+	ret += stats_line(sd, "%-24s %12llu", "Kernel del failures", (unsigned long long)stats.kern_del_fail);
+	ret += stats_line(sd, "%-24s %12llu", "Event loop wakeups", (unsigned long long)stats.wakeups);
+	ret += stats_line(sd, "%-24s %12llu", "IPC commands served", (unsigned long long)stats.ipc_commands);
+
+	ret += stats_line(sd, "Upcall install latency:");
+	for (i = 0; i < STATS_LAT_BUCKETS; i++)
+		ret += stats_line(sd, "  %-22s %12llu", bucket[i], (unsigned long long)stats.lat_hist[i]);
+
+	if (ret || ipc_flush(sd) < 0) {
+		smclog(LOG_ERR, "Failed sending reply to client: %s", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,40 @@
+/* Runtime statistics counters */
+#ifndef SMCROUTE_STATS_H_
+#define SMCROUTE_STATS_H_
+
+#include "config.h"
+#include <stdint.h>
+
+/* Coarse upcall-to-install latency histogram, decade buckets */
+#define STATS_LAT_BUCKETS 6	/* <1us <10us <100us <1ms <10ms rest */
+
+struct stats {
+	uint64_t upcalls;	/* NOCACHE upcalls received */
+	uint64_t upcall_drops;	/* recv() errors draining the mroute socket */
+	uint64_t upcall_nomatch;/* upcalls not matching any (*,G) rule */
+	uint64_t dyn_installed;	/* (S,G) routes learned from (*,G) rules */
+	uint64_t dyn_expired;	/* learned routes timed out */
+	uint64_t dyn_flushed;	/* learned routes flushed by smcroutectl */
+	uint64_t kern_add_fail;	/* setsockopt(MRT_ADD_MFC) failures */
+	uint64_t kern_del_fail;	/* setsockopt(MRT_DEL_MFC) failures */
+	uint64_t wakeups;	/* event loop wakeups */
+	uint64_t ipc_commands;	/* IPC commands served */
+	uint64_t lat_hist[STATS_LAT_BUCKETS];
+};
+
+extern struct stats stats;
+
+void stats_lat_sample(uint64_t ns);
+
+#ifdef ENABLE_CLIENT
+int  stats_show(int sd);
+#endif
+
+#endif /* SMCROUTE_STATS_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
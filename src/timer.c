@@ -30,11 +30,10 @@
 
 /*
  * TODO
- * - Timers should ideally be sorted in priority order, and/or
  * - Investigate using the pipe to notify which timer expired
  */
 struct timer {
-	LIST_ENTRY(timer) link;
+	LIST_ENTRY(timer) link;	/* pending dispatch chain in run() */
 
 	int             period;	/* period time in seconds */
 	struct timespec timeout;
@@ -45,7 +44,15 @@ struct timer {
 
 static timer_t timer;
 static int timerfd[2];
-static LIST_HEAD(, timer) tl = LIST_HEAD_INITIALIZER();
+
+/*
+ * Binary min-heap ordered on timeout, earliest deadline at heap[0].
+ * Both arming the POSIX timer and expiry dispatch only ever look at
+ * the top, so per-route timers scale without full list scans.
+ */
+static struct timer **heap = NULL;
+static size_t heap_num = 0;
+static size_t heap_max = 0;
 
 
 static void set(struct timer *t, struct timespec *now)
@@ -65,33 +72,91 @@ static int expired(struct timer *t, struct timespec *now)
 	return 0;
 }
 
-static struct timer *compare(struct timer *a, struct timer *b)
+/* is a due before (or at the same time as) b? */
+static int before(struct timer *a, struct timer *b)
 {
-	if (a->timeout.tv_sec <= b->timeout.tv_sec) {
-		if (a->timeout.tv_nsec <= b->timeout.tv_nsec)
-			return a;
+	if (a->timeout.tv_sec != b->timeout.tv_sec)
+		return a->timeout.tv_sec < b->timeout.tv_sec;
+
+	return a->timeout.tv_nsec <= b->timeout.tv_nsec;
+}
+
+static void swap(size_t i, size_t j)
+{
+	struct timer *tmp = heap[i];
+
+	heap[i] = heap[j];
+	heap[j] = tmp;
+}
 
-		return b;
+static int heap_push(struct timer *t)
+{
+	size_t i;
+
+	if (heap_num == heap_max) {
+		struct timer **ptr;
+		size_t max = heap_max ? heap_max * 2 : 16;
+
+		ptr = realloc(heap, max * sizeof(*heap));
+		if (!ptr)
+			return -1;
+
+		heap = ptr;
+		heap_max = max;
 	}
 
-	return b;
+	i = heap_num++;
+	heap[i] = t;
+	while (i > 0 && before(heap[i], heap[(i - 1) / 2])) {
+		swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	return 0;
+}
+
+static struct timer *heap_pop(void)
+{
+	struct timer *t;
+	size_t i = 0;
+
+	if (!heap_num)
+		return NULL;
+
+	t = heap[0];
+	heap[0] = heap[--heap_num];
+	while (1) {
+		size_t left = 2 * i + 1, right = 2 * i + 2, min = i;
+
+		if (left  < heap_num && before(heap[left],  heap[min]))
+			min = left;
+		if (right < heap_num && before(heap[right], heap[min]))
+			min = right;
+		if (min == i)
+			break;
+
+		swap(i, min);
+		i = min;
+	}
+
+	return t;
 }
 
 static int start(struct timespec *now)
 {
-	struct timer *next, *entry;
 	struct itimerspec it;
 
-	if (LIST_EMPTY(&tl))
+	if (!heap_num)
 		return -1;
 
-	next = LIST_FIRST(&tl);
-	LIST_FOREACH(entry, &tl, link)
-		next = compare(next, entry);
-
 	memset(&it, 0, sizeof(it));
-	it.it_value.tv_sec  = next->timeout.tv_sec - now->tv_sec;
+	it.it_value.tv_sec  = heap[0]->timeout.tv_sec - now->tv_sec;
 	it.it_value.tv_nsec = 0;
+	if (it.it_value.tv_sec <= 0) {
+		/* Already due, fire asap, zero would disarm */
+		it.it_value.tv_sec  = 0;
+		it.it_value.tv_nsec = 1;
+	}
 	timer_settime(timer, 0, &it, NULL);
 
 	return 0;
@@ -102,19 +167,28 @@ static void run(int sd, void *arg)
 {
 	char dummy;
 	struct timespec now;
-	struct timer *entry;
+	struct timer *entry, *tmp;
+	LIST_HEAD(, timer) exp = LIST_HEAD_INITIALIZER();
 
 	(void)arg;
 	if (read(sd, &dummy, 1) < 0)
 		smclog(LOG_DEBUG, "Failed read(pipe): %s", strerror(errno));
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
-	LIST_FOREACH(entry, &tl, link) {
-		if (expired(entry, &now)) {
-			if (entry->cb)
-				entry->cb(entry->arg);
-			set(entry, &now);
-		}
+
+	/* Pop all due timers first, then dispatch and rearm, so a
+	 * timer is never rescheduled into the same expiry round. */
+	while (heap_num && expired(heap[0], &now)) {
+		entry = heap_pop();
+		LIST_INSERT_HEAD(&exp, entry, link);
+	}
+
+	LIST_FOREACH_SAFE(entry, &exp, link, tmp) {
+		LIST_REMOVE(entry, link);
+		if (entry->cb)
+			entry->cb(entry->arg);
+		set(entry, &now);
+		heap_push(entry);
 	}
 
 	start(&now);
@@ -178,7 +252,10 @@ int timer_add(int period, void (*cb)(void *), void *arg)
 
 	set(t, &now);
 
-	LIST_INSERT_HEAD(&tl, t, link);
+	if (heap_push(t)) {
+		free(t);
+		return -1;
+	}
 
 	return start(&now);
 }
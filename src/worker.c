@@ -0,0 +1,265 @@
+/* Dedicated kernel upcall worker thread
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <poll.h>
+#include <pthread.h>
+#endif
+
+#include "log.h"
+#include "mroute.h"
+#include "socket.h"
+#include "worker.h"
+
+#ifdef HAVE_PTHREAD
+/*
+ * The worker owns the kernel routing sockets: it blocks in poll() on
+ * them, drains NOCACHE upcalls, matches them against a read-only rule
+ * snapshot and programs the kernel, so a slow IPC client or script can
+ * never delay forwarding setup.  Results are handed to the control
+ * thread over a single-producer/single-consumer ring, with a pipe as
+ * the wakeup for the control thread's event loop.
+ */
+#define RING_SIZE 2048		/* must be a power of two */
+
+static struct upcall ring[RING_SIZE];
+static unsigned int ring_head;	/* written by the worker only */
+static unsigned int ring_tail;	/* written by the control thread only */
+
+static uint64_t ring_drops;	/* upcalls deferred due to a full ring */
+
+static int notify_pipe[2] = { -1, -1 };
+static int stop_pipe[2]   = { -1, -1 };
+
+static int upcall_sd4 = -1;
+static int upcall_sd6 = -1;
+
+static pthread_t worker_thread;
+static int worker_running = 0;
+
+
+/* Control thread side: process handed-over upcalls */
+static void worker_drain(int sd, void *arg)
+{
+	unsigned int head, tail;
+	uint64_t drops;
+	char buf[32];
+
+	(void)arg;
+	while (read(sd, buf, sizeof(buf)) > 0)
+		;
+
+	tail = ring_tail;
+	head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+	while (tail != head) {
+		mroute_upcall(&ring[tail & (RING_SIZE - 1)]);
+		tail++;
+		__atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+		head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+	}
+
+	drops = __atomic_exchange_n(&ring_drops, 0, __ATOMIC_RELAXED);
+	if (drops)
+		smclog(LOG_WARNING, "Upcall ring full, deferred %llu kernel upcalls",
+		       (unsigned long long)drops);
+}
+
+/*
+ * Reserve the next free ring slot, or NULL when the ring is full.  The
+ * caller skips the kernel install as well in that case, the kernel
+ * repeats the upcall until an MFC entry exists.
+ */
+struct upcall *worker_reserve(void)
+{
+	unsigned int head = ring_head;
+	unsigned int tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= RING_SIZE) {
+		__atomic_fetch_add(&ring_drops, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	return &ring[head & (RING_SIZE - 1)];
+}
+
+void worker_commit(void)
+{
+	__atomic_store_n(&ring_head, ring_head + 1, __ATOMIC_RELEASE);
+}
+
+void worker_notify(void)
+{
+	if (write(notify_pipe[1], "!", 1) < 0 && EAGAIN != errno)
+		smclog(LOG_DEBUG, "Failed waking control thread: %s", strerror(errno));
+}
+
+static void *worker_loop(void *arg)
+{
+	struct pollfd pfd[3];
+	nfds_t i, num = 0;
+
+	(void)arg;
+	if (upcall_sd4 >= 0) {
+		pfd[num].fd     = upcall_sd4;
+		pfd[num++].events = POLLIN;
+	}
+	if (upcall_sd6 >= 0) {
+		pfd[num].fd     = upcall_sd6;
+		pfd[num++].events = POLLIN;
+	}
+	pfd[num].fd     = stop_pipe[0];
+	pfd[num++].events = POLLIN;
+
+	while (1) {
+		if (poll(pfd, num, -1) < 0) {
+			if (EINTR == errno)
+				continue;
+			break;
+		}
+
+		if (pfd[num - 1].revents)
+			break;
+
+		for (i = 0; i < num - 1; i++) {
+			if (!(pfd[i].revents & (POLLIN | POLLERR)))
+				continue;
+
+			if (pfd[i].fd == upcall_sd4)
+				mroute4_upcall_drain(pfd[i].fd);
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+			else
+				mroute6_upcall_drain(pfd[i].fd);
+#endif
+		}
+	}
+
+	return NULL;
+}
+
+static void close_pipes(void)
+{
+	close(notify_pipe[1]);
+	close(stop_pipe[0]);
+	close(stop_pipe[1]);
+	notify_pipe[0] = notify_pipe[1] = -1;
+	stop_pipe[0]   = stop_pipe[1]   = -1;
+}
+
+int worker_start(int sd4, int sd6)
+{
+	if (worker_running)
+		return 0;
+
+	if (sd4 < 0 && sd6 < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pipe(notify_pipe))
+		return -1;
+	if (pipe(stop_pipe)) {
+		close(notify_pipe[0]);
+		close(notify_pipe[1]);
+		notify_pipe[0] = notify_pipe[1] = -1;
+		return -1;
+	}
+
+#ifdef HAVE_FCNTL_H
+	fcntl(notify_pipe[0], F_SETFL, fcntl(notify_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(notify_pipe[1], F_SETFL, fcntl(notify_pipe[1], F_GETFL) | O_NONBLOCK);
+#endif
+	if (socket_register(notify_pipe[0], worker_drain, NULL) < 0) {
+		close(notify_pipe[0]);
+		close_pipes();
+		return -1;
+	}
+
+	upcall_sd4 = sd4;
+	upcall_sd6 = sd6;
+	if (pthread_create(&worker_thread, NULL, worker_loop, NULL)) {
+		socket_close(notify_pipe[0]);
+		close_pipes();
+		upcall_sd4 = upcall_sd6 = -1;
+		return -1;
+	}
+	worker_running = 1;
+
+	return 0;
+}
+
+void worker_stop(void)
+{
+	if (!worker_running)
+		return;
+
+	if (write(stop_pipe[1], "!", 1) < 0)
+		smclog(LOG_WARNING, "Failed stopping upcall worker: %s", strerror(errno));
+	pthread_join(worker_thread, NULL);
+	worker_running = 0;
+
+	/* Process anything still queued before tearing down */
+	worker_drain(notify_pipe[0], NULL);
+
+	socket_close(notify_pipe[0]);
+	close_pipes();
+	upcall_sd4 = upcall_sd6 = -1;
+	ring_head = ring_tail = 0;
+}
+
+#else  /* no pthreads, upcalls are handled inline in the event loop */
+
+int worker_start(int sd4, int sd6)
+{
+	(void)sd4;
+	(void)sd6;
+	errno = ENOSYS;
+	return -1;
+}
+
+void worker_stop(void)
+{
+}
+
+struct upcall *worker_reserve(void)
+{
+	return NULL;
+}
+
+void worker_commit(void)
+{
+}
+
+void worker_notify(void)
+{
+}
+#endif /* HAVE_PTHREAD */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,67 @@
+/* Dedicated kernel upcall worker thread
+ *
+ * Copyright (C) 2017  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef SMCROUTE_WORKER_H_
+#define SMCROUTE_WORKER_H_
+
+#include <stdint.h>
+
+#include "mroute.h"
+
+#if MAX_MC_VIFS > MAX_MC_MIFS
+#define MAX_MC_OIFS MAX_MC_VIFS
+#else
+#define MAX_MC_OIFS MAX_MC_MIFS
+#endif
+
+/*
+ * One kernel NOCACHE upcall, matched and installed by the worker
+ * thread, handed over to the control thread for route tracking, stats,
+ * logging and script execution.
+ */
+struct upcall {
+	uint8_t  version;	/* 4 or 6 */
+	uint8_t  matched;	/* a (*,G) rule covered the flow */
+	uint8_t  installed;	/* kernel route installed by the worker */
+	short    inbound;
+	uint32_t latency;	/* upcall-to-install latency, in nanoseconds */
+
+	struct in_addr  source, group;
+#ifdef HAVE_IPV6_MULTICAST_ROUTING
+	struct in6_addr source6, group6;
+#endif
+	uint8_t  ttl[MAX_MC_OIFS];
+};
+
+int  worker_start(int sd4, int sd6);
+void worker_stop (void);
+
+/* Worker thread side of the handoff ring */
+struct upcall *worker_reserve(void);
+void           worker_commit (void);
+void           worker_notify (void);
+
+#endif /* SMCROUTE_WORKER_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */